@@ -182,7 +182,8 @@ int main(int argc, char *argv[])
     }
 
     printf("cmd> "); // Print first command prompt
-    char *commandLine = readLine(stdin); // Read a line from stdin using input.c
+    LineReader *reader = makeLineReader(stdin);
+    char *commandLine = readerLine(reader, NULL); // Read a line from stdin using input.c
 
     while (commandLine != NULL) {
         char command[COMMAND_MAX_LENGTH + 1]; // Create string with room for max command length and null terminator
@@ -194,8 +195,6 @@ int main(int argc, char *argv[])
 
         printf("%s\n", commandLine); // Echo command to stdout
 
-        free(commandLine);
-
         if (strcmp(command, "list") == 0) { // List command
             if (matches == LIST_ALL_ARGS) {
                 listEmployees(database, compareID, testAll, NULL);
@@ -239,6 +238,7 @@ int main(int argc, char *argv[])
         } else if (strcmp(command, "quit") == 0) { // Quit command
             if (matches == QUIT_ARGS) {
                 freeDatabase(database); // Free all contents of database
+                freeLineReader(reader);
                 return EXIT_SUCCESS;
             } else { // Number of arguments given is not valid
                 printf("Invalid command\n");
@@ -249,9 +249,17 @@ int main(int argc, char *argv[])
 
         printf("\n"); // Line of space between commands
         printf("cmd> "); // Print next command prompt
-        commandLine = readLine(stdin); // Read next line from stdin using input.c
+        commandLine = readerLine(reader, NULL); // Read next line from stdin using input.c
     }
-    
+
+    // Input that ended with a read error, rather than EOF, is a failure
+    int status = EXIT_SUCCESS;
+    if (readerFailed(reader)) {
+        fprintf(stderr, "Can't read standard input\n");
+        status = EXIT_FAILURE;
+    }
+
     freeDatabase(database);
-    free(commandLine);
+    freeLineReader(reader);
+    return status;
 }
\ No newline at end of file
@@ -52,17 +52,17 @@ void readEmployees(char const *filename, Database *database)
         exit(EXIT_FAILURE);
     }
 
-    char *currentLine = readLine(fp);
+    LineReader *reader = makeLineReader(fp);
+    char *currentLine = readerLine(reader, NULL);
     while (currentLine != NULL) {
         Employee *employee = (Employee *) malloc(sizeof(Employee));
 
         int matches = sscanf(currentLine, "%s%s%s%s", employee->id, employee->firstName, employee->lastName,
                 employee->skill);
 
-        free(currentLine); // Free memory allocated for currentLine
-
         if (matches != NUM_FIELDS) { // If the line did not have all of the required fields for an Employee
             fprintf(stderr, "Invalid employee file: %s\n", filename);
+            freeLineReader(reader);
             fclose(fp);
             freeDatabase(database);
             free(employee);
@@ -75,6 +75,7 @@ void readEmployees(char const *filename, Database *database)
         if (strlen(employee->id) != ID_MAX_LENGTH || strlen(employee->firstName) > FIRST_NAME_MAX_LENGTH ||
                 strlen(employee->lastName) > LAST_NAME_MAX_LENGTH || strlen(employee->skill) > SKILL_MAX_LENGTH) {
             fprintf(stderr, "Invalid employee file: %s\n", filename);
+            freeLineReader(reader);
             fclose(fp);
             freeDatabase(database);
             free(employee);
@@ -101,9 +102,19 @@ void readEmployees(char const *filename, Database *database)
         database->list[database->count] = employee;
         database->count++;
 
-        currentLine = readLine(fp); // Read the next line of the file (or NULL if there is no next line)
+        currentLine = readerLine(reader, NULL); // Read the next line of the file (or NULL if there is no next line)
+    }
+
+    // A read error isn't the end of the file, so don't keep a partial list
+    if (readerFailed(reader)) {
+        fprintf(stderr, "Can't read file: %s\n", filename);
+        freeLineReader(reader);
+        fclose(fp);
+        freeDatabase(database);
+        exit(EXIT_FAILURE);
     }
 
+    freeLineReader(reader);
     fclose(fp);
 }
 
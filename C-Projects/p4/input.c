@@ -1,49 +1,161 @@
 /**
  * @file input.c
  * @author Christopher Fields (cwfields)
- * 
+ *
  * Implementation of the input component in the Agency Database Management
- * system. Includes a single function, readLine, which reads a line of input
- * and returns a pointer to a string with that input as dynamically allocated
- * memory.
+ * system. A LineReader reads its file with read() a large block at a time
+ * and finds the end of each line with memchr, so reading a line costs no
+ * system call, no per-character function call and no allocation unless the
+ * caller asks for a copy.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "input.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/** Initial size of a reader's buffer, and the most read at a time */
+#define BLOCK_SIZE (64 * 1024)
 
-/** Multiple for resizing the line string size when at capacity */
+/** Multiple for resizing the buffer when a line doesn't fit in it */
 #define RESIZE_MULTIPLE 2
 
-char *readLine(FILE *fp)
+/** Representation of a LineReader. */
+struct LineReaderStruct {
+    /** File descriptor to read from */
+    int fd;
+
+    /** Buffer of input, with one extra byte for a terminator */
+    char *buf;
+
+    /** Size of buf, not counting the extra byte */
+    size_t capacity;
+
+    /** Index in buf of the first character not handed out yet */
+    size_t start;
+
+    /** Index in buf just past the last character read */
+    size_t end;
+
+    /** Index in buf up to which no newline was found by the last search */
+    size_t scanned;
+
+    /** True once read() has reported the end of the file */
+    int eof;
+
+    /** True once read() has failed with an error other than EINTR */
+    int failed;
+
+    /** True if the file is a terminal */
+    int interactive;
+};
+
+LineReader *makeLineReader(FILE *fp)
 {
-    // Allocate an array of characters (string) to store the line contents
-    char *line = (char *) malloc(sizeof(char));
-    int size = 0;
-    int capacity = 1;
+    LineReader *reader = (LineReader *) malloc(sizeof(LineReader));
+    reader->fd = fileno(fp);
+    reader->capacity = BLOCK_SIZE;
+    reader->buf = (char *) malloc(reader->capacity + 1);
+    reader->start = reader->end = reader->scanned = 0;
+    reader->eof = reader->failed = 0;
+    reader->interactive = isatty(reader->fd);
+    return reader;
+}
 
-    // Read the first character of input
-    int nextChar = fgetc(fp);
+/**
+ * Reads more input into the reader's buffer, first moving the unfinished
+ * line to the front of the buffer and growing the buffer if that line
+ * already fills it.
+ *
+ * @param reader pointer to the reader to fill
+ */
+static void fillBuffer(LineReader *reader)
+{
+    size_t pending = reader->end - reader->start;
+    memmove(reader->buf, reader->buf + reader->start, pending);
+    reader->scanned -= reader->start;
+    reader->start = 0;
+    reader->end = pending;
 
-    if (nextChar == EOF) { // No more input to read
-        free(line); // Free memory! (Not returning a reference to it so caller cannot)
-        return NULL;
+    if (pending == reader->capacity) { // The line is longer than the buffer
+        reader->capacity *= RESIZE_MULTIPLE;
+        reader->buf = (char *) realloc(reader->buf, reader->capacity + 1);
     }
 
-    // Read each character until EOF or newline is reached, dynamically resizing the line
-    while (nextChar != EOF && nextChar != '\n') {
-        if (size >= capacity) {
-            capacity *= RESIZE_MULTIPLE; // Increase capacity by specified factor
-            line = (char *) realloc(line, capacity * sizeof(char *)); // Reallocate to reflect capacity increase
+    // Like stdio, make sure any prompt is showing before waiting on a user
+    if (reader->interactive) {
+        fflush(stdout);
+    }
+
+    size_t want = reader->capacity - reader->end;
+    ssize_t got;
+    do { // A signal arriving before any data isn't the end of the input
+        got = read(reader->fd, reader->buf + reader->end, want < BLOCK_SIZE ? want : BLOCK_SIZE);
+    } while (got < 0 && errno == EINTR);
+    if (got == 0) {
+        reader->eof = 1;
+    } else if (got < 0) {
+        reader->failed = 1;
+    } else {
+        reader->end += got;
+    }
+}
+
+char *readerLine(LineReader *reader, size_t *len)
+{
+    while (1) {
+        // Only search the part of the buffer not already searched
+        char *nl = memchr(reader->buf + reader->scanned, '\n', reader->end - reader->scanned);
+        int done = reader->eof || reader->failed;
+        if (nl || (done && reader->start < reader->end)) {
+            // Either a whole line, or a last line with no newline
+            char *line = reader->buf + reader->start;
+            if (!nl) {
+                nl = reader->buf + reader->end;
+            }
+            *nl = '\0';
+            if (len) {
+                *len = nl - line;
+            }
+            reader->start = reader->scanned = nl + 1 - reader->buf;
+            if (reader->start > reader->end) {
+                reader->start = reader->scanned = reader->end;
+            }
+            return line;
+        }
+        if (done) { // No more input to read
+            return NULL;
         }
-        line[size++] = nextChar; // Add the character to the line string
-        nextChar = fgetc(fp); // Read the next character of input
+
+        reader->scanned = reader->end;
+        fillBuffer(reader);
     }
+}
 
-    // Reallocate the line to be more space efficient (only big enough to store line contents)
-    line = (char *) realloc(line, size + 1);
-    line[size] = '\0';
+int readerFailed(LineReader *reader)
+{
+    return reader->failed;
+}
 
-    return line;
-}
\ No newline at end of file
+char *readerLineCopy(LineReader *reader)
+{
+    size_t len;
+    char *line = readerLine(reader, &len);
+    if (!line) {
+        return NULL;
+    }
+
+    char *copy = (char *) malloc(len + 1);
+    memcpy(copy, line, len + 1);
+    return copy;
+}
+
+void freeLineReader(LineReader *reader)
+{
+    free(reader->buf);
+    free(reader);
+}
@@ -1,23 +1,69 @@
 /**
  * @file input.h
  * @author Christopher Fields (cwfields)
- * 
+ *
  * Header file for the input component of the Agency Database Management
- * system. Provides prototype for a single function, readLine, which is
- * used for reading a single line of input from a given file, returning
- * a pointer to that string as dynamically allocated memory.
+ * system. Provides a LineReader, which reads a file a large block at a
+ * time and hands out the lines in it one at a time, either as views into
+ * its own buffer or as dynamically allocated copies.
  */
 
+#ifndef INPUT_H
+#define INPUT_H
+
 #include <stdio.h>
 
+/** Incomplete type for the LineReader representation. */
+typedef struct LineReaderStruct LineReader;
+
+/**
+ * Makes a LineReader for the given file. The reader reads straight from
+ * the file's descriptor, so nothing else should read from fp while the
+ * reader is in use. Closing fp is still up to the caller.
+ *
+ * @param fp pointer to the file stream to read lines from
+ * @return LineReader* a pointer to the new reader
+ */
+LineReader *makeLineReader(FILE *fp);
+
+/**
+ * Reads the next line, without its newline, and returns it as a string
+ * inside the reader's buffer. The string is only good until the next call
+ * to readerLine, readerLineCopy or freeLineReader, but the caller may
+ * change its contents. Lines can be arbitrarily long. Returns NULL if
+ * there is no input left to read.
+ *
+ * @param reader pointer to the reader to read from
+ * @param len if not NULL, returns the length of the line
+ * @return char* a pointer to the start of the line in the reader's buffer
+ */
+char *readerLine(LineReader *reader, size_t *len);
+
 /**
- * Reads a single line of input from the given file and returns it as a
- * string inside a block of dynamically allocated memory. Used to read
- * commands from the user and to read employee descriptions from an employee
- * list file. Implements a resizable array to read in a line of text that
- * could be arbitrarily long. Returns NULL if there is no input to read.
- * 
- * @param fp pointer to the file stream to read a line from
+ * Reports whether the reader stopped because read() failed, rather than
+ * because it reached the end of the file. Once that happens, readerLine
+ * returns whatever was read before the error and then NULL.
+ *
+ * @param reader pointer to the reader to check
+ * @return int nonzero if a read error ended the input
+ */
+int readerFailed(LineReader *reader);
+
+/**
+ * Reads the next line, like readerLine, and returns a copy of it in a
+ * block of dynamically allocated memory that the caller must free.
+ * Returns NULL if there is no input left to read.
+ *
+ * @param reader pointer to the reader to read from
  * @return char* a pointer to the start of the dynamically allocated string
  */
-char *readLine(FILE *fp);
\ No newline at end of file
+char *readerLineCopy(LineReader *reader);
+
+/**
+ * Frees the reader and its buffer. Doesn't close the file it reads from.
+ *
+ * @param reader pointer to the reader to free
+ */
+void freeLineReader(LineReader *reader);
+
+#endif
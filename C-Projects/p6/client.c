@@ -0,0 +1,348 @@
+/**
+    @file client.c
+    @author Christopher Fields (cwfields)
+    Load generator for the map server. Opens a number of connections to
+    a server on this machine, each driven by its own thread, and sends a
+    mix of get and set commands on random integer keys. Each connection
+    sends a batch of commands at a time without waiting, then reads all
+    of their responses, so the depth of the batch sets how far requests
+    are pipelined. Reports throughput and the latency of a batch.
+
+    Usage: client [-c connections] [-n requests] [-p depth] [-k keys]
+                  [-r readPercent] [-P port]
+
+    The number of requests is for each connection.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/** Default port the server listens on. */
+#define DEFAULT_PORT 5151
+
+/** Default number of connections. */
+#define DEFAULT_CONNS 8
+
+/** Default number of requests sent on each connection. */
+#define DEFAULT_REQUESTS 100000
+
+/** Default number of requests in each batch. */
+#define DEFAULT_DEPTH 16
+
+/** Default number of different keys. */
+#define DEFAULT_KEYS 100000
+
+/** Default percentage of requests that are gets. */
+#define DEFAULT_READS 90
+
+/** Longest request or response line generated. */
+#define MAX_REQUEST 64
+
+/** Settings for a run, shared by every connection. */
+typedef struct {
+  /** Port to connect to. */
+  int port;
+
+  /** Number of requests sent on each connection. */
+  int requests;
+
+  /** Number of requests in each batch. */
+  int depth;
+
+  /** Number of different keys. */
+  int keys;
+
+  /** Percentage of requests that are gets. */
+  int reads;
+} Settings;
+
+/** Work and results for one connection. */
+typedef struct {
+  /** Settings for the run. */
+  Settings const *s;
+
+  /** Seed for the connection's random keys. */
+  unsigned int seed;
+
+  /** Latency of each batch, in nanoseconds. */
+  long *ns;
+
+  /** Number of batches completed. */
+  int batches;
+
+  /** Number of requests completed. */
+  long done;
+
+  /** True if the connection failed. */
+  bool failed;
+} Worker;
+
+/**
+   Get the current time in nanoseconds.
+   @return nanoseconds since some fixed point.
+ */
+static long nowNs( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+   Small, fast random number generator (xorshift).
+   @param state Generator state, updated on each call.
+   @return the next random value.
+ */
+static unsigned int nextRandom( unsigned int *state )
+{
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+   Connect to the server on this machine.
+   @param port Port the server listens on.
+   @return the connected socket, or -1 if it couldn't connect.
+ */
+static int connectServer( int port )
+{
+  int fd = socket( AF_INET, SOCK_STREAM, 0 );
+  if ( fd < 0 )
+    return -1;
+
+  struct sockaddr_in addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+  addr.sin_port = htons( port );
+  if ( connect( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ) {
+    close( fd );
+    return -1;
+  }
+  int on = 1;
+  setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+  return fd;
+}
+
+/**
+   Send all of a buffer.
+   @param fd Socket to send on.
+   @param buf Bytes to send.
+   @param len Number of bytes to send.
+   @return false if the connection failed.
+ */
+static bool sendAll( int fd, char const *buf, size_t len )
+{
+  while ( len > 0 ) {
+    ssize_t n = send( fd, buf, len, MSG_NOSIGNAL );
+    if ( n <= 0 )
+      return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+   Read until a number of response lines have arrived.
+   @param fd Socket to read from.
+   @param buf Buffer to read into.
+   @param cap Size of the buffer.
+   @param lines Number of lines to wait for.
+   @return false if the connection failed, or sent more than the lines.
+ */
+static bool readLines( int fd, char *buf, size_t cap, int lines )
+{
+  while ( lines > 0 ) {
+    ssize_t n = recv( fd, buf, cap, 0 );
+    if ( n <= 0 )
+      return false;
+    for ( char *p = buf; ( p = memchr( p, '\n', buf + n - p ) ); p++ )
+      lines--;
+  }
+  return lines == 0;
+}
+
+/**
+   Thread function that drives one connection.
+   @param arg The connection's Worker.
+   @return NULL
+ */
+static void *runWorker( void *arg )
+{
+  Worker *w = arg;
+  Settings const *s = w->s;
+  int fd = connectServer( s->port );
+  if ( fd < 0 ) {
+    w->failed = true;
+    return NULL;
+  }
+
+  size_t cap = (size_t) s->depth * MAX_REQUEST;
+  char *out = malloc( cap );
+  char *in = malloc( cap );
+  w->ns = malloc( ( s->requests / s->depth + 1 ) * sizeof( long ) );
+
+  while ( w->done < s->requests ) {
+    int count = s->requests - w->done < s->depth ? s->requests - w->done : s->depth;
+    size_t len = 0;
+    for ( int i = 0; i < count; i++ ) {
+      int key = nextRandom( &w->seed ) % s->keys;
+      if ( (int) ( nextRandom( &w->seed ) % 100 ) < s->reads )
+        len += sprintf( out + len, "get %d\n", key );
+      else
+        len += sprintf( out + len, "set %d %u\n", key, nextRandom( &w->seed ) % 1000 );
+    }
+
+    long start = nowNs();
+    if ( ! sendAll( fd, out, len ) || ! readLines( fd, in, cap, count ) ) {
+      w->failed = true;
+      break;
+    }
+    w->ns[ w->batches++ ] = nowNs() - start;
+    w->done += count;
+  }
+
+  close( fd );
+  free( out );
+  free( in );
+  return NULL;
+}
+
+/**
+   Compare two longs, for qsort.
+   @param a Pointer to the first long.
+   @param b Pointer to the second long.
+   @return negative, zero or positive as a is less, equal or greater.
+ */
+static int compareLong( void const *a, void const *b )
+{
+  long x = *(long const *) a;
+  long y = *(long const *) b;
+  return ( x > y ) - ( x < y );
+}
+
+/**
+   Get a percentile from a sorted array of latencies.
+   @param ns Sorted latencies.
+   @param count Number of latencies.
+   @param p Percentile, between 0 and 1.
+   @return the latency at that percentile.
+ */
+static long percentile( long const *ns, int count, double p )
+{
+  if ( count == 0 )
+    return 0;
+  return ns[ (int) ( p * ( count - 1 ) + 0.5 ) ];
+}
+
+/**
+   Print the usage message and exit.
+ */
+static void usage( void )
+{
+  fprintf( stderr, "usage: client [-c connections] [-n requests] [-p depth] [-k keys]\n"
+           "              [-r readPercent] [-P port]\n" );
+  exit( EXIT_FAILURE );
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  Settings s = { DEFAULT_PORT, DEFAULT_REQUESTS, DEFAULT_DEPTH, DEFAULT_KEYS,
+                 DEFAULT_READS };
+  int conns = DEFAULT_CONNS;
+
+  int opt;
+  while ( ( opt = getopt( argc, argv, "c:n:p:k:r:P:" ) ) != -1 ) {
+    switch ( opt ) {
+    case 'c':
+      conns = atoi( optarg );
+      break;
+    case 'n':
+      s.requests = atoi( optarg );
+      break;
+    case 'p':
+      s.depth = atoi( optarg );
+      break;
+    case 'k':
+      s.keys = atoi( optarg );
+      break;
+    case 'r':
+      s.reads = atoi( optarg );
+      break;
+    case 'P':
+      s.port = atoi( optarg );
+      break;
+    default:
+      usage();
+    }
+  }
+  if ( optind < argc || conns < 1 || s.requests < 1 || s.depth < 1 || s.keys < 1 ||
+       s.reads < 0 || s.reads > 100 || s.port <= 0 || s.port > 65535 )
+    usage();
+
+  Worker *workers = calloc( conns, sizeof( Worker ) );
+  pthread_t *threads = malloc( conns * sizeof( pthread_t ) );
+  long start = nowNs();
+  for ( int i = 0; i < conns; i++ ) {
+    workers[ i ].s = &s;
+    workers[ i ].seed = 2463534242u + i * 7919;
+    pthread_create( &threads[ i ], NULL, runWorker, &workers[ i ] );
+  }
+
+  // Gather every batch latency, to report percentiles for the whole run.
+  long done = 0;
+  int batches = 0;
+  bool failed = false;
+  for ( int i = 0; i < conns; i++ ) {
+    pthread_join( threads[ i ], NULL );
+    done += workers[ i ].done;
+    batches += workers[ i ].batches;
+    failed = failed || workers[ i ].failed;
+  }
+  double seconds = ( nowNs() - start ) / 1e9;
+
+  long *ns = malloc( ( batches + 1 ) * sizeof( long ) );
+  int count = 0;
+  for ( int i = 0; i < conns; i++ ) {
+    memcpy( ns + count, workers[ i ].ns, workers[ i ].batches * sizeof( long ) );
+    count += workers[ i ].batches;
+    free( workers[ i ].ns );
+  }
+  qsort( ns, count, sizeof( long ), compareLong );
+
+  printf( "%d connections, depth %d: %ld requests in %.3f s, %.0f requests/s\n",
+          conns, s.depth, done, seconds, done / seconds );
+  printf( "batch latency us p50/p99/p999: %.1f/%.1f/%.1f\n",
+          percentile( ns, count, 0.5 ) / 1e3, percentile( ns, count, 0.99 ) / 1e3,
+          percentile( ns, count, 0.999 ) / 1e3 );
+
+  free( ns );
+  free( threads );
+  free( workers );
+  if ( failed ) {
+    fprintf( stderr, "Some connections failed\n" );
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+/**
+    @file command.c
+    @author Christopher Fields (cwfields)
+    Implementation of the command component. Responses are formatted
+    straight into the output buffer, without going through stdio.
+*/
+
+#include "command.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "integer.h"
+#include "text.h"
+
+/** Smallest number of bytes allocated for a buffer. */
+#define MIN_BUFFER 256
+
+/** Size of the buffer a Text is decoded into before it's copied, big
+    enough for most keys and values. */
+#define TOKEN_BUFFER 256
+
+/** Longest formatted Integer, with its sign and terminator. */
+#define INT_CHARS 12
+
+/**
+   Helper function to decode a quoted Text the way parseText does,
+   skipping anything before the opening quote and replacing escape
+   sequences, in a single pass. The characters are decoded into a
+   buffer on the stack (or the heap, for a long string) and copied into
+   the Text once its length is known.
+
+   @param init start of the input
+   @param pos where to start looking for the opening quote
+   @param n optional return for the number of characters used from
+   init, or zero if there's no closing quote
+   @param intern true to share the interned copy of the string
+   @return the new Text, or NULL if there's no opening quote
+ */
+static VType *scanText( char const *init, char const *pos, int *n, bool intern )
+{
+  while ( *pos && *pos != '"' )
+    ++pos;
+  if ( ! *pos )
+    return NULL;
+
+  char small[ TOKEN_BUFFER ];
+  char *buf = small;
+  int cap = sizeof( small ), len = 0, end = 0;
+  for ( ++pos; *pos; ++pos ) {
+    char c = *pos;
+    if ( c == '"' ) {
+      end = pos + 1 - init;
+      break;
+    }
+
+    // A backslash before anything else is just a backslash.
+    if ( c == '\\' ) {
+      char e = pos[ 1 ];
+      if ( e == '"' || e == '\\' || e == 'n' || e == 't' ) {
+        c = e == 'n' ? '\n' : e == 't' ? '\t' : e;
+        ++pos;
+      }
+    }
+
+    if ( len == cap ) {
+      cap *= 2;
+      if ( buf == small )
+        buf = memcpy( malloc( cap ), small, len );
+      else
+        buf = realloc( buf, cap );
+    }
+    buf[ len++ ] = c;
+  }
+
+  if ( n )
+    *n = end;
+  VType *v = intern ? internText( buf, len ) : makeText( buf, len );
+  if ( buf != small )
+    free( buf );
+  return v;
+}
+
+/**
+   Helper function to read a run of decimal digits, clamping the value
+   at a limit instead of letting it overflow.
+
+   @param pos the first digit
+   @param limit largest value to return
+   @param mag returns the value of the digits, or limit if it's larger
+   @return pointer just past the last digit
+ */
+static char const *scanDigits( char const *pos, unsigned long limit, unsigned long *mag )
+{
+  unsigned long v = 0;
+  for ( ; isdigit( (unsigned char) *pos ); ++pos ) {
+    unsigned int d = *pos - '0';
+    v = v > ( limit - d ) / 10 ? limit : v * 10 + d;
+  }
+  *mag = v;
+  return pos;
+}
+
+/**
+   Helper function to parse a key or value in a single pass over the
+   input. After any whitespace, a sign or digit starts an Integer, which
+   is converted the way sscanf's %d would convert it: the value is
+   clamped to the range of a long, then truncated to an int. Anything
+   else is parsed as a quoted Text, by picking up the scan where the
+   number would have started.
+
+   @param init string containing the key or value
+   @param n optional return for the number of characters used from init
+   @param intern true to share the interned copy of a Text
+   @return the new VType, or NULL if there's no Integer or Text
+ */
+static VType *parseToken( char const *init, int *n, bool intern )
+{
+  char const *pos = init;
+  while ( isspace( (unsigned char) *pos ) )
+    ++pos;
+  bool neg = *pos == '-';
+  char const *digits = pos + ( *pos == '-' || *pos == '+' );
+  if ( ! isdigit( (unsigned char) *digits ) )
+    return scanText( init, pos, n, intern );
+
+  unsigned long mag;
+  pos = scanDigits( digits, neg ? (unsigned long) LONG_MAX + 1 : LONG_MAX, &mag );
+  if ( n )
+    *n = pos - init;
+  return makeInteger( (int) (long) ( neg ? 0UL - mag : mag ) );
+}
+
+VType *parseVType( char const *init, int *n )
+{
+  return parseToken( init, n, false );
+}
+
+VType *parseValue( char const *init, int *n )
+{
+  return parseToken( init, n, true );
+}
+
+bool parseMillis( char const *init, long *millis, int *n )
+{
+  char const *pos = init;
+  while ( isspace( (unsigned char) *pos ) )
+    ++pos;
+  if ( *pos == '+' )
+    ++pos;
+  if ( ! isdigit( (unsigned char) *pos ) )
+    return false;
+
+  // A time too big for a long is clamped to LONG_MAX + 1, and rejected.
+  unsigned long mag;
+  char const *end = scanDigits( pos, (unsigned long) LONG_MAX + 1, &mag );
+  if ( mag > LONG_MAX )
+    return false;
+
+  *millis = mag;
+  *n = end - init;
+  return true;
+}
+
+bool blankString( char const *str )
+{
+  // Skip spaces.
+  while ( isspace( *str ) )
+    ++str;
+
+  // Return false if we see non-whitespace before the end-of-string.
+  if ( *str )
+    return false;
+  return true;
+}
+
+char *commandWord( char *line, int *len )
+{
+  while ( isspace( *line ) )
+    ++line;
+
+  int n = 0;
+  while ( line[ n ] && ! isspace( line[ n ] ) )
+    ++n;
+
+  *len = n;
+  return line;
+}
+
+bool isCommand( char const *word, int len, char const *name )
+{
+  return len <= MAX_CMD && strncmp( word, name, len ) == 0 && name[ len ] == '\0';
+}
+
+void bufferAppend( Buffer *b, char const *str, size_t len )
+{
+  if ( b->len + len > b->cap ) {
+    size_t cap = b->cap ? b->cap : MIN_BUFFER;
+    while ( cap < b->len + len )
+      cap *= 2;
+    b->data = (char *) realloc( b->data, cap );
+    b->cap = cap;
+  }
+  memcpy( b->data + b->len, str, len );
+  b->len += len;
+}
+
+void bufferVType( Buffer *b, VType const *v )
+{
+  if ( isInteger( v ) ) {
+    char num[ INT_CHARS ];
+    int len = snprintf( num, sizeof( num ), "%d", ( (Integer const *) v )->val );
+    bufferAppend( b, num, len );
+  } else {
+    // Print stops at the first null, so this does too.
+    char const *str = textValue( v );
+    bufferAppend( b, "\"", 1 );
+    bufferAppend( b, str, strlen( str ) );
+    bufferAppend( b, "\"", 1 );
+  }
+}
+
+void bufferConsume( Buffer *b, size_t len )
+{
+  if ( len == 0 )
+    return;
+  memmove( b->data, b->data + len, b->len - len );
+  b->len -= len;
+}
+
+void freeBuffer( Buffer *b )
+{
+  free( b->data );
+  b->data = NULL;
+  b->len = b->cap = 0;
+}
+
+/**
+   Add a line of text to a buffer.
+   @param b Buffer to add to.
+   @param str String to add, followed by a newline.
+ */
+static void bufferLine( Buffer *b, char const *str )
+{
+  bufferAppend( b, str, strlen( str ) );
+  bufferAppend( b, "\n", 1 );
+}
+
+bool runMapCommand( Map *m, char *line, Buffer *out, CommandOptions const *opts )
+{
+  int n;
+  char *cmd = commandWord( line, &n );
+  char *pos = cmd + n;
+
+  if ( isCommand( cmd, n, "set" ) || isCommand( cmd, n, "setttl" ) ) {
+    bool ttl = n > 3;
+    VType *k = parseVType( pos, &n );
+    if ( k ) {
+      pos += n;
+      VType *v = parseValue( pos, &n );
+
+      // A setttl needs the time to live after the value.
+      long millis = 0;
+      bool valid = v != NULL;
+      if ( valid ) {
+        pos += n;
+        if ( ttl ) {
+          valid = parseMillis( pos, &millis, &n );
+          pos += valid ? n : 0;
+        }
+        valid = valid && blankString( pos );
+      }
+      if ( valid ) {
+        // Log the change before making it.
+        Wal *wal = opts->wal;
+        if ( wal && ! ( ttl ? walSetTTL( wal, k, v, millis ) : walSet( wal, k, v ) ) ) {
+          bufferLine( out, "Log failed" );
+          v->destroy( v );
+          k->destroy( k );
+          return true;
+        }
+        if ( ttl )
+          mapSetTTL( m, k, v, millis );
+        else
+          mapSet( m, k, v );
+        if ( opts->ack )
+          bufferLine( out, "OK" );
+        return true;
+      }
+      if ( v )
+        v->destroy( v );
+      k->destroy( k );
+    }
+  } else if ( isCommand( cmd, n, "get" ) || isCommand( cmd, n, "remove" ) ) {
+    bool get = cmd[ 0 ] == 'g';
+    VType *k = parseVType( pos, &n );
+    if ( k ) {
+      bool valid = blankString( pos + n );
+      if ( valid && get ) {
+        VType *v = mapGet( m, k );
+        if ( v ) {
+          bufferVType( out, v );
+          bufferAppend( out, "\n", 1 );
+        } else
+          bufferLine( out, "Undefined" );
+      } else if ( valid ) {
+        // Log the change before making it.
+        if ( opts->wal && ! walRemove( opts->wal, k ) )
+          bufferLine( out, "Log failed" );
+        else if ( ! mapRemove( m, k ) )
+          bufferLine( out, "Not in map" );
+        else if ( opts->ack )
+          bufferLine( out, "OK" );
+      }
+      k->destroy( k );
+      if ( valid )
+        return true;
+    }
+  } else if ( isCommand( cmd, n, "size" ) ) {
+    if ( blankString( pos ) ) {
+      // Pairs past their deadline don't count.
+      mapExpire( m );
+      char num[ INT_CHARS ];
+      bufferAppend( out, num, snprintf( num, sizeof( num ), "%d\n", mapSize( m ) ) );
+      return true;
+    }
+  } else if ( isCommand( cmd, n, "quit" ) )
+    return false;
+
+  bufferLine( out, "Invalid command" );
+  return true;
+}
@@ -0,0 +1,142 @@
+/**
+    @file command.h
+    @author Christopher Fields (cwfields)
+    Header for the command component, which parses the command language
+    of the map program and performs the commands the driver and the
+    server have in common. Provides the parsing helpers shared by the
+    driver and the server, a growable output buffer, and runMapCommand,
+    the one place a set, setttl, get, remove, size or quit command is
+    performed, which writes its response into a buffer.
+*/
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "vtype.h"
+#include "map.h"
+#include "wal.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Maximum length for a command name. */
+#define MAX_CMD 10
+
+/** A growable buffer of output. */
+typedef struct {
+  /** Bytes in the buffer, or NULL if nothing has been added yet. */
+  char *data;
+
+  /** Number of bytes in the buffer. */
+  size_t len;
+
+  /** Number of bytes allocated for data. */
+  size_t cap;
+} Buffer;
+
+/** How runMapCommand responds to and records the commands it performs,
+    so each front end gets the responses its users expect. */
+typedef struct {
+  /** True to respond OK to a set, setttl or remove that succeeds, or
+      false to give them no response. */
+  bool ack;
+
+  /** Log each change is recorded in before it's made, or NULL. */
+  Wal *wal;
+} CommandOptions;
+
+/** Parse an Integer or, failing that, a Text from the given string,
+    accepting exactly what parseInteger and parseText accept, but in a
+    single pass over the input that, unless a Text is very long,
+    allocates nothing but the result.
+    @param init String containing the initializaiton text.
+    @param n Optional return for the number of characters used from init.
+    @return pointer to the new VType instance.
+*/
+VType *parseVType( char const *init, int *n );
+
+/** Parse a value for a set command, like parseVType, but intern a
+    Text, since the same values tend to be stored over and over.
+    @param init String containing the initializaiton text.
+    @param n Optional return for the number of characters used from init.
+    @return pointer to the new VType instance.
+*/
+VType *parseValue( char const *init, int *n );
+
+/** Parse a time to live, a count of milliseconds that can't be
+    negative, written as decimal digits with an optional plus sign.
+    Leading whitespace is skipped.
+    @param init String containing the time.
+    @param millis Returns the number of milliseconds.
+    @param n Returns the number of characters used from init.
+    @return true if a time to live was parsed, or false if there isn't
+    one or it's too big for a long.
+*/
+bool parseMillis( char const *init, long *millis, int *n );
+
+/** Return true if the given string contains only whitespace. This
+    is useful for making sure there's nothing extra at the end of a line
+    of user input.
+    @param str String to check for blanks.
+    @return True if the string contains only blanks.
+*/
+bool blankString( char const *str );
+
+/** Find the command word at the start of a line, skipping leading
+    whitespace. Scans the line directly rather than copying the word
+    out with sscanf.
+    @param line Line of user input.
+    @param len Returns the length of the command word.
+    @return pointer to the start of the command word.
+*/
+char *commandWord( char *line, int *len );
+
+/** Return true if the command word matches the given command name.
+    @param word Start of the command word.
+    @param len Length of the command word.
+    @param name Name of the command.
+    @return True if they're the same.
+*/
+bool isCommand( char const *word, int len, char const *name );
+
+/** Add bytes to the end of a buffer, growing it if needed.
+    @param b Buffer to add to.
+    @param str Bytes to add.
+    @param len Number of bytes to add.
+*/
+void bufferAppend( Buffer *b, char const *str, size_t len );
+
+/** Add a value to the end of a buffer, formatted the way its print
+    function would print it.
+    @param b Buffer to add to.
+    @param v Value to add, which must be an Integer or a Text.
+*/
+void bufferVType( Buffer *b, VType const *v );
+
+/** Remove bytes from the front of a buffer.
+    @param b Buffer to remove from.
+    @param len Number of bytes to remove.
+*/
+void bufferConsume( Buffer *b, size_t len );
+
+/** Free the memory used by a buffer, leaving it empty.
+    @param b Buffer to free.
+*/
+void freeBuffer( Buffer *b );
+
+/** Perform a single set, setttl, get, remove, size or quit command on
+    the map, adding a one-line response to the output buffer: the value
+    (or Undefined) for a get, the number of unexpired pairs for size,
+    Not in map for a remove of a missing key, and Invalid command for
+    anything else. A set, setttl or remove that succeeds gets OK only if
+    the options ask for it. With a log, each change is logged before
+    it's made, and one that can't be logged isn't made and gets Log
+    failed. Quit adds no response.
+    @param m Map the command works on.
+    @param line Line containing the command.
+    @param out Buffer the response is added to.
+    @param opts How the command is acknowledged and logged.
+    @return false if the command was quit.
+*/
+bool runMapCommand( Map *m, char *line, Buffer *out, CommandOptions const *opts );
+
+#endif
@@ -0,0 +1,134 @@
+/**
+    @file concurrentMap.c
+    @author Christopher Fields (cwfields)
+    Lock-striped implementation of the concurrent map. Each shard
+    pairs an ordinary Map with a mutex. A key's shard is picked from
+    the high bits of its mixed hash, so the shard's own table, which
+    uses the low bits, still sees well spread keys.
+*/
+
+#include "concurrentMap.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/** Size of a cache line, used to keep shard locks apart in memory. */
+#define CACHE_LINE 64
+
+/** One independently locked part of the map. */
+typedef struct {
+  /** Lock held for every operation on this shard. */
+  pthread_mutex_t lock;
+
+  /** Map holding this shard's key / value pairs. */
+  Map *map;
+
+  /** Padding so neighbouring shards' locks don't share a cache line. */
+  char pad[ CACHE_LINE ];
+} Shard;
+
+/** Representation of a concurrent map. */
+struct ConcurrentMapStruct {
+  /** Array of shards. */
+  Shard *shards;
+
+  /** Number of shards, a power of two. */
+  int count;
+
+  /** Number of bits used to choose a shard. */
+  int bits;
+};
+
+/**
+   Helper function to pick the shard for a key. Mixes the bits of the
+   key's hash (with the finalizer from MurmurHash3) and uses the top
+   bits as the shard index.
+
+   @param m the map to pick a shard from
+   @param key the key to find the shard for
+   @return pointer to the key's shard
+ */
+static Shard *shardFor( ConcurrentMap *m, VType *key )
+{
+  if ( m->bits == 0 )
+    return m->shards;
+
+  unsigned int h = key->hash( key );
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return &m->shards[ h >> ( 32 - m->bits ) ];
+}
+
+ConcurrentMap *makeConcurrentMap( int len, int shards, MapOptions const *opts )
+{
+  ConcurrentMap *m = (ConcurrentMap *) malloc( sizeof( ConcurrentMap ) );
+
+  // Round the number of shards up to a power of two.
+  m->count = 1;
+  m->bits = 0;
+  while ( m->count < shards ) {
+    m->count *= 2;
+    m->bits++;
+  }
+
+  m->shards = (Shard *) malloc( m->count * sizeof( Shard ) );
+  for ( int i = 0; i < m->count; i++ ) {
+    pthread_mutex_init( &m->shards[ i ].lock, NULL );
+    m->shards[ i ].map = makeMapWith( len / m->count + 1, opts );
+  }
+
+  return m;
+}
+
+int cmapSize( ConcurrentMap *m )
+{
+  int size = 0;
+  for ( int i = 0; i < m->count; i++ ) {
+    pthread_mutex_lock( &m->shards[ i ].lock );
+    size += mapSize( m->shards[ i ].map );
+    pthread_mutex_unlock( &m->shards[ i ].lock );
+  }
+  return size;
+}
+
+void cmapSet( ConcurrentMap *m, VType *key, VType *val )
+{
+  Shard *s = shardFor( m, key );
+  pthread_mutex_lock( &s->lock );
+  mapSet( s->map, key, val );
+  pthread_mutex_unlock( &s->lock );
+}
+
+bool cmapGet( ConcurrentMap *m, VType *key,
+              void (*visit)( VType const *val, void *arg ), void *arg )
+{
+  Shard *s = shardFor( m, key );
+  pthread_mutex_lock( &s->lock );
+  VType *val = mapGet( s->map, key );
+  if ( val && visit )
+    visit( val, arg );
+  pthread_mutex_unlock( &s->lock );
+  return val != NULL;
+}
+
+bool cmapRemove( ConcurrentMap *m, VType *key )
+{
+  Shard *s = shardFor( m, key );
+  pthread_mutex_lock( &s->lock );
+  bool removed = mapRemove( s->map, key );
+  pthread_mutex_unlock( &s->lock );
+  return removed;
+}
+
+void freeConcurrentMap( ConcurrentMap *m )
+{
+  for ( int i = 0; i < m->count; i++ ) {
+    freeMap( m->shards[ i ].map );
+    pthread_mutex_destroy( &m->shards[ i ].lock );
+  }
+  free( m->shards );
+  free( m );
+}
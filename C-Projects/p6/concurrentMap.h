@@ -0,0 +1,72 @@
+/**
+    @file concurrentMap.h
+    @author Christopher Fields (cwfields)
+    Header for the concurrent map component, a thread-safe version of
+    the map. Keys are spread over a number of shards, each a separate
+    Map with its own lock and its own table growth, so threads working
+    on different shards never wait for each other.
+*/
+
+#ifndef CONCURRENTMAP_H
+#define CONCURRENTMAP_H
+
+#include "vtype.h"
+#include "map.h"
+#include <stdbool.h>
+
+/** Incomplete type for the ConcurrentMap representation. */
+typedef struct ConcurrentMapStruct ConcurrentMap;
+
+/** Make an empty concurrent map.
+    @param len Initial length of the hash table, divided among the shards.
+    @param shards Number of shards, rounded up to a power of two.
+    @param opts Options used to make each shard's map, or NULL for the
+    defaults.
+    @return pointer to a new concurrent map.
+*/
+ConcurrentMap *makeConcurrentMap( int len, int shards, MapOptions const *opts );
+
+/** Get the size of the given map.
+    @param m Pointer to the map.
+    @return Number of key/value pairs in the map. */
+int cmapSize( ConcurrentMap *m );
+
+/**
+   Adds the given key/value pair to the given map, replacing the value
+   if the key is already in the map. The map takes ownership of both
+   key and val, as for mapSet.
+   @param m Pointer to the map to add to.
+   @param key Key of the value to add to Map.
+   @param val Value to add to the Map.
+ */
+void cmapSet( ConcurrentMap *m, VType *key, VType *val );
+
+/** Look up the value associated with the given key. Another thread
+    could replace or remove the value as soon as the shard is unlocked,
+    so instead of returning it, the value is passed to the given
+    function while the shard is still locked.
+    @param m Map to query.
+    @param key Key to look for in the map.
+    @param visit Function called with the value if the key is found. May
+    be NULL to just check if the key is there.
+    @param arg Extra argument passed to visit.
+    @return true if the key was in the map.
+*/
+bool cmapGet( ConcurrentMap *m, VType *key,
+              void (*visit)( VType const *val, void *arg ), void *arg );
+
+/**
+   Removes the key/value pair associated with the given key.
+   @param m Map to remove from.
+   @param key Key to remove.
+   @return true if the key was in the map.
+ */
+bool cmapRemove( ConcurrentMap *m, VType *key );
+
+/** Free all the memory used to store a map, including all the
+    memory in its key/value pairs. No other thread may be using the map.
+    @param m The map to free.
+*/
+void freeConcurrentMap( ConcurrentMap *m );
+
+#endif
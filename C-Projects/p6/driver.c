@@ -4,169 +4,346 @@
     Main program for the hash map program. Provides the top-level
     main compoent. Using the other components, it reads and processes
     commands from standard input, updates the map as needed, and prints
-    the repsponses to user commands.
+    the repsponses to user commands. In batch mode, it reads commands
+    from a file instead, producing the same output much faster. With a
+    log file, every change is recorded in a write-ahead log, and the map
+    is recovered from the log when the program starts. Changes are
+    forced to disk in groups, so a crash can lose up to the last
+    WAL_GROUP - 1 changes, made in the last WAL_MILLIS milliseconds. Pairs set with
+    setttl expire once their time to live runs out.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
+#include <unistd.h>
 
 #include "map.h"
 #include "vtype.h"
 #include "integer.h"
 #include "text.h"
 #include "input.h"
+#include "pool.h"
+#include "wal.h"
+#include "command.h"
 
-/** Maximum length for a command name. */
-#define MAX_CMD 10
 /** The initial capacity of the Map */
 #define MAP_CAPACITY 100
+/** Size of the output buffer used in batch mode. */
+#define BATCH_OUTPUT ( 1 << 20 )
 
-/** 
-    Front-end for the Integer and Text parsing functions.  This tries
-    to make an integer from the given string, and, failing that, tries
-    to make a Text object.
-    @param init String containing the initializaiton text.
-    @param n Optional return for the number of characters used from init.
-    @return pointer to the new VType instance.
-    
+/** Number of log records forced to disk together. */
+#define WAL_GROUP 64
+
+/** Most time, in milliseconds, a log record waits to be forced to disk. */
+#define WAL_MILLIS 10
+
+/** Options for the map: a chained table whose pairs can be given a time
+    to live. Its ordered index is only built if range or list is used. */
+static MapOptions const mapOptions = { MAP_CHAINED, MAP_HASH_VTYPE, 0, false,
+                                       0, 0, true };
+
+/** Write-ahead log that every change to the map is recorded in, or NULL
+    if the map isn't being logged. */
+static Wal *wal = NULL;
+
+/** Buffer the response to a set, setttl, get, remove or size command
+    is formatted in before it's printed. */
+static Buffer output = { NULL, 0, 0 };
+
+/**
+   Parse a quoted file name that should be the last thing on a command
+   line.
+   @param pos Input following the command word.
+   @return the file name as a Text, or NULL if the rest of the command
+   isn't a single Text.
  */
-static VType *parseVType( char const *init, int *n )
+static VType *parseFileName( char const *pos )
 {
-  VType *val = parseInteger( init, n );
-
-  if ( ! val )
-    val = parseText( init, n );
-  
-  return val;
+  int n;
+  VType *name = parseText( pos, &n );
+  if ( name && ( n == 0 || ! blankString( pos + n ) ) ) {
+    name->destroy( name );
+    name = NULL;
+  }
+  return name;
 }
 
-/** Return true if the given string contains only whitespace.  This
-    is useful for making sure there's nothing extra at the end of a line
-    of user input.
-    @paam str String to check for blanks.
-    @return True if the string contains only blanks.
-*/
-static bool blankString( char *str )
+/**
+   Print a key and its value on one line, for the range and list commands.
+   @param key Key to print.
+   @param val Value to print.
+   @param arg Unused.
+ */
+static void printEntry( VType const *key, VType const *val, void *arg )
 {
-  // Skip spaces.
-  while ( isspace( *str ) )
-    ++str;
-
-  // Return false if we see non-whitespace before the end-of-string.
-  if ( *str )
-    return false;
-  return true;
+  key->print( key );
+  putchar( ' ' );
+  val->print( val );
+  putchar( '\n' );
 }
 
 /**
-   Starting point for the program.
-   @return exit status for the program.
+   Print statistics about the map, one per line. The operation counts
+   are only printed if the map component was built with MAP_STATS.
+   @param map Map to report on.
  */
-int main()
+static void printStats( Map *map )
 {
-  // Make our map, with a 100-element table.
-  Map *map = makeMap( MAP_CAPACITY );
+  MapStats st;
+  mapStats( map, &st );
+  printf( "size %d\ncapacity %d\nload %.3f\nbytes %ld\nchains", st.size,
+          st.capacity, st.loadFactor, st.bytes );
+  for ( int i = 0; i < MAP_STATS_CHAINS; i++ )
+    printf( " %d", st.chains[ i ] );
+  putchar( '\n' );
 
-  // Keep reading input from the user.
-  char *line;
-  printf( "cmd> " );
-  while ( ( line = readLine( stdin ) ) ) {
-    // Echo the command back to the user.
-    printf( "%s\n", line );
-
-    // Extract the first word from the command.
-    bool valid = false;
-    char cmd[ MAX_CMD + 1 ];
-    int n;
-    if ( sscanf( line, "%10s%n", cmd, &n ) == 1 ) {
-      // Pos keeps up with where we are in parsing the command.
-      char *pos = line + n;
-      if ( strcmp(cmd, "set" ) == 0 ) {
-        // Parse the key from the command.
-        VType *k = parseVType( pos, &n );
-        if ( k ) {
-          pos += n;
+  if ( st.counted ) {
+    printf( "probes get %.2f set %.2f remove %.2f\n",
+            st.gets ? (double) st.getProbes / st.gets : 0.0,
+            st.sets ? (double) st.setProbes / st.sets : 0.0,
+            st.removes ? (double) st.removeProbes / st.removes : 0.0 );
+    printf( "expansions %ld in %.6f s\n", st.expansions, st.expandSeconds );
+  }
+}
 
-          // Parse the value from the command.
-          VType *v = parseVType( pos, &n );
-          if ( v ) {
-            pos += n;
+/**
+   Perform a single command on the map, printing its response. The
+   commands that only make sense here are performed directly, and the
+   rest by runMapCommand, which doesn't acknowledge changes.
+   @param mp Map the command works on, which is replaced by the load
+   command.
+   @param line Line of user input containing the command.
+   @return false if the command was quit.
+ */
+static bool runCommand( Map **mp, char *line )
+{
+  Map *map = *mp;
 
-            // Make sure we got a key and there's nothing extra in the command.
-            if ( blankString( pos ) ) {
-              valid = true;
-              mapSet(map, k, v);
-            }
-          }
-        }
-      } else if ( strcmp( cmd, "get" ) == 0 ) {
-        // Parse the key from the command.
-        VType *k = parseVType( pos, &n );
-        if ( k ) {
+  // Extract the first word from the command.
+  bool valid = false;
+  int n;
+  char *cmd = commandWord( line, &n );
+  if ( n > 0 ) {
+    // Pos keeps up with where we are in parsing the command.
+    char *pos = cmd + n;
+    if ( isCommand( cmd, n, "range" ) ) {
+      // Parse the smallest and largest keys to report.
+      VType *lo = parseVType( pos, &n );
+      if ( lo ) {
+        pos += n;
+        VType *hi = parseVType( pos, &n );
+        if ( hi ) {
           pos += n;
 
-          // Make sure we got a key and there's nothing extra in the command.
+          // Report every key in the range, in order.
           if ( blankString( pos ) ) {
             valid = true;
-            VType *v = mapGet( map, k );
-            // Report the value for this key, or undefined.
-            if ( v ) {
-              v->print( v );
-              printf( "\n" );
-            } else
-              printf( "Undefined\n" );
+            mapExpire( map );
+            mapRange( map, lo, hi, printEntry, NULL );
           }
-
-          // Free the key we parsed from the input.
-          k->destroy( k );
+          hi->destroy( hi );
         }
-      } else if ( strcmp( cmd, "remove" ) == 0 ) {
-        // Parse the key from the command.
-        VType *k = parseVType( pos, &n );
-        if ( k ) {
-          pos += n;
-
-          // Make sure we got a key and there's nothing extra in the command.
-          if ( blankString( pos ) ) {
-            valid = true;
-            bool removed = mapRemove(map, k);
-            // Report the value for this key, or undefined.
-            if ( !removed ) {
-              printf( "Not in map\n" );
-            }
-          }
+        lo->destroy( lo );
+      }
+    } else if ( isCommand( cmd, n, "list" ) ) {
+      // Report every key in the map, in order.
+      if ( blankString( pos ) ) {
+        valid = true;
+        mapExpire( map );
+        mapRange( map, NULL, NULL, printEntry, NULL );
+      }
+    } else if ( isCommand( cmd, n, "stats" ) ) {
+      if ( blankString( pos ) ) {
+        valid = true;
+        printStats( map );
+      }
+    } else if ( isCommand( cmd, n, "save" ) ) {
+      // Write the map to the named snapshot file.
+      VType *name = parseFileName( pos );
+      if ( name ) {
+        valid = true;
+        if ( ! mapSave( map, textValue( name ) ) )
+          fputs( "Save failed\n", stdout );
+        name->destroy( name );
+      }
+    } else if ( isCommand( cmd, n, "load" ) ) {
+      // Replace the map with the contents of the named snapshot file.
+      VType *name = parseFileName( pos );
+      if ( name ) {
+        valid = true;
+        Map *loaded = mapLoad( textValue( name ), &mapOptions );
 
-          // Free the key we parsed from the input.
-          k->destroy( k );
+        // The loaded map replaces the old one in the log too, as its
+        // snapshot. If that fails, keep the map the log still records.
+        if ( loaded && wal && ! walCompact( wal, loaded ) ) {
+          freeMap( loaded );
+          loaded = NULL;
         }
-      } else if ( strcmp( cmd, "size" ) == 0 ) {
-        // Any extra input after the command?
-        if ( blankString( pos ) ) {
-          // Report the size of the map.
-          valid = true;
-          printf( "%d\n", mapSize( map ) );
-        }
-      } else if ( strcmp( cmd, "quit" ) == 0 ) {
-        // Free the current command and the map before exiting.
-        free( line );
-        freeMap( map );
-        exit( EXIT_SUCCESS );
+        if ( loaded ) {
+          freeMap( map );
+          *mp = loaded;
+        } else
+          fputs( "Load failed\n", stdout );
+        name->destroy( name );
+      }
+    } else if ( isCommand( cmd, n, "compact" ) ) {
+      // Snapshot the map and empty the log.
+      if ( wal && blankString( pos ) ) {
+        valid = true;
+        if ( ! walCompact( wal, map ) )
+          fputs( "Compact failed\n", stdout );
+      }
+    } else {
+      // The commands the server has too are performed the same way.
+      CommandOptions opts = { false, wal };
+      bool more = runMapCommand( map, line, &output, &opts );
+      if ( output.len ) {
+        fwrite( output.data, 1, output.len, stdout );
+        output.len = 0;
       }
+      return more;
     }
+  }
+
+  // Print a message if we didn't get a valid command.
+  if ( ! valid )
+    fputs( "Invalid command\n", stdout );
+  return true;
+}
+
+/**
+   Perform a single command, echoing it and prompting for the next one
+   the way the interactive interface does.
+   @param map Map the command works on, which the load command can replace.
+   @param line Line of user input containing the command.
+   @param len Length of the line.
+   @return false if the command was quit.
+ */
+static bool echoCommand( Map **map, char *line, size_t len )
+{
+  // Echo the command back to the user.
+  fwrite( line, 1, len, stdout );
+  putchar( '\n' );
+
+  if ( ! runCommand( map, line ) )
+    return false;
+
+  fputs( "\ncmd> ", stdout );
+  return true;
+}
+
+/**
+   Read every command from the given reader and perform them, until
+   the input runs out or a quit command.
+   @param map Map the commands work on, which the load command can replace.
+   @param reader Reader to get commands from.
+   @return exit status for the program, which is a failure if the
+   input ended because it couldn't be read.
+ */
+static int runCommands( Map **map, LineReader *reader )
+{
+  fputs( "cmd> ", stdout );
+
+  // Each line is a view into the reader's buffer, so nothing is copied.
+  char *line;
+  size_t len;
+  while ( ( line = readerLine( reader, &len ) ) )
+    if ( ! echoCommand( map, line, len ) )
+      return EXIT_SUCCESS;
+
+  // A read error isn't the end of the input.
+  if ( readerFailed( reader ) ) {
+    fflush( stdout );
+    fprintf( stderr, "Can't read commands\n" );
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-    // Print a message if we didn't get a valid command.
-    if ( ! valid )
-      printf( "Invalid command\n" );
+/**
+   Read every command from the given file and perform them, producing
+   exactly the output the interactive interface would. All output goes
+   through one large buffer.
+   @param map Map the commands work on, which the load command can replace.
+   @param fname Name of the command file.
+   @return exit status for the program.
+ */
+static int runBatch( Map **map, char const *fname )
+{
+  FILE *fp = fopen( fname, "r" );
+  if ( ! fp ) {
+    perror( fname );
+    return EXIT_FAILURE;
+  }
 
-    // Free the last command and prompt for another one.
-    free( line );
-    printf( "\ncmd> " );
+  setvbuf( stdout, NULL, _IOFBF, BATCH_OUTPUT );
+  LineReader *reader = makeLineReader( fp );
+  int status = runCommands( map, reader );
+  freeLineReader( reader );
+  fclose( fp );
+  return status;
+}
+
+/**
+   Starting point for the program. With no arguments, reads commands
+   from standard input. With -b and a file name, runs the commands in
+   the file in batch mode.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  char const *batch = NULL, *log = NULL;
+  int opt;
+  while ( ( opt = getopt( argc, argv, "b:w:" ) ) != -1 ) {
+    if ( opt == 'b' )
+      batch = optarg;
+    else if ( opt == 'w' )
+      log = optarg;
+    else
+      break;
+  }
+  if ( opt != -1 || optind != argc ) {
+    fprintf( stderr, "usage: driver [-b <command-file>] [-w <log-file>]\n"
+             "With -w, a crash can lose up to %d changes made in the last %d ms.\n",
+             WAL_GROUP - 1, WAL_MILLIS );
+    return EXIT_FAILURE;
+  }
+
+  // Make our map, with a 100-element table.
+  Map *map = makeMapWith( MAP_CAPACITY, &mapOptions );
+
+  // Recover the map from its log, if it has one.
+  if ( log && ! ( wal = walOpen( log, &map, &mapOptions, WAL_GROUP, WAL_MILLIS ) ) ) {
+    fprintf( stderr, "Can't open log: %s\n", log );
+    freeMap( map );
+    return EXIT_FAILURE;
   }
 
-  // Free the map before exiting.
+  int status = EXIT_SUCCESS;
+  if ( batch )
+    status = runBatch( &map, batch );
+  else {
+    // Keep reading input from the user.
+    LineReader *reader = makeLineReader( stdin );
+    status = runCommands( &map, reader );
+    freeLineReader( reader );
+  }
+
+  // Make sure everything logged is on disk.
+  if ( wal && ! walClose( wal ) ) {
+    fprintf( stderr, "Can't write log: %s\n", log );
+    status = EXIT_FAILURE;
+  }
+
+  // Free the map and the memory pooled for values before exiting.
+  freeBuffer( &output );
   freeMap( map );
-  return EXIT_SUCCESS;
+  freePool();
+  return status;
 }
@@ -0,0 +1,186 @@
+/**
+    @file epoch.c
+    @author Christopher Fields (cwfields)
+    Implementation of the epoch component. There's a global epoch
+    number, and each reader record holds the epoch it saw when it
+    entered its critical section. Retired objects are kept in one of
+    three limbo lists, by the epoch they were retired in. The global
+    epoch only advances once every active reader has seen the current
+    one, so after two advances nobody can still be looking at objects
+    retired in the old epoch, and that list is released.
+*/
+
+#include "epoch.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/** Number of limbo lists, one each for the current epoch and the two
+    before it. */
+#define LIMBO_LISTS 3
+
+/** Number of objects retired between attempts to advance the epoch. */
+#define RETIRE_BATCH 32
+
+/** An object waiting to be freed. */
+typedef struct RetiredStruct {
+  /** The object itself. */
+  void *obj;
+
+  /** Function that frees it. */
+  void (*release)( void *obj );
+
+  /** Next object in the same limbo list. */
+  struct RetiredStruct *next;
+} Retired;
+
+/** Record of one reader thread. */
+struct EpochReaderStruct {
+  /** Epoch the reader entered in, shifted left one bit, with the low
+      bit set while the reader is in a critical section. */
+  unsigned long state;
+
+  /** True while a thread owns this record. */
+  bool inUse;
+
+  /** Domain the reader belongs to. */
+  Epoch *epoch;
+
+  /** Next record in the domain. Records are never removed. */
+  struct EpochReaderStruct *next;
+};
+
+/** Representation of an epoch domain. */
+struct EpochStruct {
+  /** Current global epoch. */
+  unsigned long global;
+
+  /** List of all reader records. */
+  EpochReader *readers;
+
+  /** Objects retired in each of the last three epochs. */
+  Retired *limbo[ LIMBO_LISTS ];
+
+  /** Objects retired since the last attempt to advance the epoch. */
+  int pending;
+};
+
+Epoch *makeEpoch( void )
+{
+  Epoch *e = (Epoch *) malloc( sizeof( Epoch ) );
+  e->global = 0;
+  e->readers = NULL;
+  for ( int i = 0; i < LIMBO_LISTS; i++ )
+    e->limbo[ i ] = NULL;
+  e->pending = 0;
+  return e;
+}
+
+EpochReader *epochRegister( Epoch *e )
+{
+  // Reuse a record some other thread gave back, if there is one.
+  EpochReader *r = __atomic_load_n( &e->readers, __ATOMIC_ACQUIRE );
+  for ( ; r; r = r->next ) {
+    bool expected = false;
+    if ( __atomic_compare_exchange_n( &r->inUse, &expected, true, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+      return r;
+  }
+
+  // Otherwise, push a new record on the front of the list.
+  r = (EpochReader *) malloc( sizeof( EpochReader ) );
+  r->state = 0;
+  r->inUse = true;
+  r->epoch = e;
+  r->next = __atomic_load_n( &e->readers, __ATOMIC_RELAXED );
+  while ( ! __atomic_compare_exchange_n( &e->readers, &r->next, r, true,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+    ;
+  return r;
+}
+
+void epochUnregister( EpochReader *r )
+{
+  __atomic_store_n( &r->inUse, false, __ATOMIC_RELEASE );
+}
+
+void epochEnter( EpochReader *r )
+{
+  unsigned long g = __atomic_load_n( &r->epoch->global, __ATOMIC_ACQUIRE );
+  // Sequentially consistent, so it's visible before anything is read.
+  __atomic_store_n( &r->state, ( g << 1 ) | 1, __ATOMIC_SEQ_CST );
+}
+
+void epochExit( EpochReader *r )
+{
+  __atomic_store_n( &r->state, 0, __ATOMIC_RELEASE );
+}
+
+/**
+   Helper function to free every object in a list of retired objects.
+
+   @param list the list to free
+ */
+static void releaseAll( Retired *list )
+{
+  while ( list ) {
+    Retired *next = list->next;
+    list->release( list->obj );
+    free( list );
+    list = next;
+  }
+}
+
+/**
+   Helper function to move the global epoch forward if every active
+   reader has seen the current epoch, releasing objects retired two
+   epochs ago.
+
+   @param e the domain to advance
+ */
+static void tryAdvance( Epoch *e )
+{
+  unsigned long g = e->global;
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  for ( EpochReader *r = __atomic_load_n( &e->readers, __ATOMIC_ACQUIRE );
+        r; r = r->next ) {
+    unsigned long state = __atomic_load_n( &r->state, __ATOMIC_SEQ_CST );
+    if ( ( state & 1 ) && ( state >> 1 ) != g )
+      return;
+  }
+
+  // Objects retired in epoch g - 2 share a list with the new epoch.
+  __atomic_store_n( &e->global, g + 1, __ATOMIC_RELEASE );
+  int old = ( g + 1 ) % LIMBO_LISTS;
+  releaseAll( e->limbo[ old ] );
+  e->limbo[ old ] = NULL;
+}
+
+void epochRetire( Epoch *e, void *obj, void (*release)( void *obj ) )
+{
+  Retired *item = (Retired *) malloc( sizeof( Retired ) );
+  item->obj = obj;
+  item->release = release;
+
+  int cur = e->global % LIMBO_LISTS;
+  item->next = e->limbo[ cur ];
+  e->limbo[ cur ] = item;
+
+  if ( ++e->pending >= RETIRE_BATCH ) {
+    e->pending = 0;
+    tryAdvance( e );
+  }
+}
+
+void freeEpoch( Epoch *e )
+{
+  for ( int i = 0; i < LIMBO_LISTS; i++ )
+    releaseAll( e->limbo[ i ] );
+
+  while ( e->readers ) {
+    EpochReader *r = e->readers;
+    e->readers = r->next;
+    free( r );
+  }
+  free( e );
+}
@@ -0,0 +1,65 @@
+/**
+    @file epoch.h
+    @author Christopher Fields (cwfields)
+    Header for the epoch component, which provides epoch-based memory
+    reclamation. Readers announce when they're inside a read-side
+    critical section, and objects unlinked from a shared structure are
+    retired instead of freed. A retired object is freed only once every
+    reader that might still be looking at it has left its critical
+    section.
+*/
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/** Incomplete type for an epoch domain. */
+typedef struct EpochStruct Epoch;
+
+/** Incomplete type for a reader registered with an epoch domain. */
+typedef struct EpochReaderStruct EpochReader;
+
+/** Make a new epoch domain with no readers.
+    @return pointer to the new domain.
+*/
+Epoch *makeEpoch( void );
+
+/** Register a reader thread with the domain. Safe to call from any
+    thread at any time.
+    @param e Domain to register with.
+    @return the reader's record, used for entering and exiting.
+*/
+EpochReader *epochRegister( Epoch *e );
+
+/** Give a reader's record back to the domain so another thread can
+    reuse it. The reader must not be inside a critical section.
+    @param r Record returned by epochRegister.
+*/
+void epochUnregister( EpochReader *r );
+
+/** Start a read-side critical section. Objects the reader finds from
+    here on stay valid until epochExit.
+    @param r The reader's record.
+*/
+void epochEnter( EpochReader *r );
+
+/** End a read-side critical section.
+    @param r The reader's record.
+*/
+void epochExit( EpochReader *r );
+
+/** Retire an object that's no longer reachable by new readers. It will
+    be freed by calling release once no reader can still see it. Only
+    one thread at a time may retire objects in a domain.
+    @param e The domain.
+    @param obj Object to retire.
+    @param release Function that frees the object.
+*/
+void epochRetire( Epoch *e, void *obj, void (*release)( void *obj ) );
+
+/** Free the domain, releasing every object still waiting to be freed.
+    No reader may be using the domain.
+    @param e The domain to free.
+*/
+void freeEpoch( Epoch *e );
+
+#endif
@@ -0,0 +1,644 @@
+/**
+    @file hamt.c
+    @author Christopher Fields (cwfields)
+    Hash array mapped trie implementation of a persistent hash table,
+    used as a backend for the map component. Each branch node uses five
+    bits of the key's hash to pick one of 32 children, but only stores
+    the children that are there, with a bit map saying which ones. Keys
+    whose hashes are entirely equal share a collision node.
+
+    Every node has a reference count, one for each branch (or trie)
+    that points to it. A node with a single reference belongs to one
+    trie, so it's changed in place. A node with more than one is shared
+    with a copy, so it's copied first, and the copy takes a reference to
+    each of its children. Since every change starts at the root, only
+    the nodes on the path to the key are ever copied. Reference counts
+    are changed atomically, so copies can be used by different threads.
+*/
+
+#include "hamt.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of bits of the hash used at each level of the trie. */
+#define LEVEL_BITS 5
+
+/** Mask for the part of the hash used at each level. */
+#define LEVEL_MASK ( ( 1u << LEVEL_BITS ) - 1 )
+
+/** Kinds of node in the trie. */
+typedef enum { LEAF, BRANCH, COLLISION } NodeKind;
+
+/** Fields at the start of every kind of node. */
+typedef struct {
+  /** Number of branches and tries pointing to this node. */
+  int refs;
+
+  /** Which kind of node this is. */
+  NodeKind kind;
+} Trie;
+
+/** A node holding one key/value pair. */
+typedef struct {
+  /** Common node fields. */
+  Trie head;
+
+  /** Mixed hash of the key. */
+  unsigned int hash;
+
+  /** Pointer to the key part of the key / value pair. */
+  VType *key;
+
+  /** Pointer to the value part of the key / value pair. */
+  VType *val;
+} Leaf;
+
+/** A node with a child for each value of a few bits of the hash. */
+typedef struct {
+  /** Common node fields. */
+  Trie head;
+
+  /** Bit i is set if there's a child for value i of this level's bits. */
+  uint32_t bitmap;
+
+  /** The children that are present, in order of their bits. */
+  Trie *child[];
+} Branch;
+
+/** A node holding pairs whose keys all have the same hash. */
+typedef struct {
+  /** Common node fields. */
+  Trie head;
+
+  /** Mixed hash shared by all the keys. */
+  unsigned int hash;
+
+  /** Number of pairs, always at least two. */
+  int count;
+
+  /** Leaves holding the pairs. */
+  Leaf *leaf[];
+} Collision;
+
+/** Representation of a trie. */
+struct HamtStruct {
+  /** Root node, or NULL if the trie is empty. */
+  Trie *root;
+
+  /** Number of key / value pairs in the trie. */
+  int size;
+};
+
+/**
+   Scrambles the bits of a key's hash, since the trie uses the low bits
+   first and an Integer hashes to its own value. This is the finalizer
+   from MurmurHash3, as in the open addressing table.
+
+   @param h hash value returned by the key
+   @return the mixed hash value
+ */
+static unsigned int mix(unsigned int h)
+{
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+   Helper method to get the number of bytes in a branch.
+
+   @param count number of children in the branch
+   @return size of the branch
+ */
+static size_t branchSize(int count)
+{
+  return sizeof(Branch) + count * sizeof(Trie *);
+}
+
+/**
+   Helper method to get the number of bytes in a collision node.
+
+   @param count number of pairs in the node
+   @return size of the node
+ */
+static size_t collisionSize(int count)
+{
+  return sizeof(Collision) + count * sizeof(Leaf *);
+}
+
+/**
+   Helper method to get the position of a child in a branch's array.
+
+   @param b the branch
+   @param bit the child's bit in the bit map
+   @return index of the child in b->child
+ */
+static int childPos(Branch const *b, uint32_t bit)
+{
+  return __builtin_popcount(b->bitmap & (bit - 1));
+}
+
+/**
+   Helper method to take another reference to a node.
+
+   @param n the node
+   @return n
+ */
+static Trie *ref(Trie *n)
+{
+  __atomic_fetch_add(&n->refs, 1, __ATOMIC_RELAXED);
+  return n;
+}
+
+/**
+   Helper method to check whether a node belongs to just one trie, so
+   it can be changed in place.
+
+   @param n the node
+   @return true if nothing else refers to it
+ */
+static bool owned(Trie *n)
+{
+  return __atomic_load_n(&n->refs, __ATOMIC_ACQUIRE) == 1;
+}
+
+/**
+   Helper method to drop a reference to a node, freeing it, along with
+   its pair or its references to other nodes, when it was the last one.
+
+   @param n the node
+ */
+static void release(Trie *n)
+{
+  if (__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+
+  if (n->kind == LEAF) {
+    Leaf *l = (Leaf *) n;
+    l->key->destroy(l->key);
+    l->val->destroy(l->val);
+    poolFree(l, sizeof(Leaf));
+  } else if (n->kind == BRANCH) {
+    Branch *b = (Branch *) n;
+    int count = __builtin_popcount(b->bitmap);
+    for (int i = 0; i < count; i++) {
+      release(b->child[i]);
+    }
+    poolFree(b, branchSize(count));
+  } else {
+    Collision *c = (Collision *) n;
+    for (int i = 0; i < c->count; i++) {
+      release(&c->leaf[i]->head);
+    }
+    poolFree(c, collisionSize(c->count));
+  }
+}
+
+/**
+   Helper method to make a leaf for a pair.
+
+   @param h mixed hash of the key
+   @param key the key
+   @param val the value
+   @return the new leaf, with one reference
+ */
+static Leaf *makeLeaf(unsigned int h, VType *key, VType *val)
+{
+  Leaf *l = poolAlloc(sizeof(Leaf));
+  l->head = (Trie) { 1, LEAF };
+  l->hash = h;
+  l->key = key;
+  l->val = val;
+  return l;
+}
+
+/**
+   Helper method to make a branch with room for the given children,
+   which the caller fills in.
+
+   @param bitmap bits of the children the branch will have
+   @return the new branch, with one reference
+ */
+static Branch *makeBranch(uint32_t bitmap)
+{
+  Branch *b = poolAlloc(branchSize(__builtin_popcount(bitmap)));
+  b->head = (Trie) { 1, BRANCH };
+  b->bitmap = bitmap;
+  return b;
+}
+
+/**
+   Helper method to make a collision node with room for the given
+   number of leaves, which the caller fills in.
+
+   @param h hash shared by the leaves
+   @param count number of leaves
+   @return the new node, with one reference
+ */
+static Collision *makeCollision(unsigned int h, int count)
+{
+  Collision *c = poolAlloc(collisionSize(count));
+  c->head = (Trie) { 1, COLLISION };
+  c->hash = h;
+  c->count = count;
+  return c;
+}
+
+/**
+   Helper method to get the hash of a leaf or collision node.
+
+   @param n the node, which must not be a branch
+   @return the hash of its keys
+ */
+static unsigned int nodeHash(Trie *n)
+{
+  return n->kind == LEAF ? ((Leaf *) n)->hash : ((Collision *) n)->hash;
+}
+
+/**
+   Helper method to make a branch holding two leaf or collision nodes
+   with different hashes, adding more branches below it for as many
+   levels as their hashes agree.
+
+   @param a the first node
+   @param b the second node
+   @param shift position of the bits the new branch uses
+   @return the new branch, which takes over the references to a and b
+ */
+static Trie *join(Trie *a, Trie *b, int shift)
+{
+  unsigned int ia = (nodeHash(a) >> shift) & LEVEL_MASK;
+  unsigned int ib = (nodeHash(b) >> shift) & LEVEL_MASK;
+  if (ia == ib) {
+    Branch *br = makeBranch(1u << ia);
+    br->child[0] = join(a, b, shift + LEVEL_BITS);
+    return &br->head;
+  }
+
+  Branch *br = makeBranch((1u << ia) | (1u << ib));
+  br->child[ia < ib ? 0 : 1] = a;
+  br->child[ia < ib ? 1 : 0] = b;
+  return &br->head;
+}
+
+/**
+   Helper method to get a branch that can be changed in place: the
+   branch itself if nothing else refers to it, or else a copy.
+
+   @param b the branch, whose reference is taken over
+   @return a branch with one reference
+ */
+static Branch *ownBranch(Branch *b)
+{
+  if (owned(&b->head)) {
+    return b;
+  }
+  Branch *copy = makeBranch(b->bitmap);
+  int count = __builtin_popcount(b->bitmap);
+  for (int i = 0; i < count; i++) {
+    copy->child[i] = ref(b->child[i]);
+  }
+  release(&b->head);
+  return copy;
+}
+
+/**
+   Helper method to make a copy of a collision node with one leaf
+   replaced, added or left out.
+
+   @param c the node, whose reference is taken over
+   @param skip index of the leaf to replace or leave out, or c->count
+   to add one
+   @param leaf leaf to put in its place, or NULL to leave it out
+   @return the new node
+ */
+static Collision *editCollision(Collision *c, int skip, Leaf *leaf)
+{
+  int count = c->count + (skip == c->count) - (leaf == NULL);
+  Collision *copy = makeCollision(c->hash, count);
+  int j = 0;
+  for (int i = 0; i < c->count; i++) {
+    if (i != skip) {
+      copy->leaf[j++] = (Leaf *) ref(&c->leaf[i]->head);
+    }
+  }
+  if (leaf) {
+    copy->leaf[j] = leaf;
+  }
+  release(&c->head);
+  return copy;
+}
+
+/**
+   Helper method to add a leaf to the part of the trie below a node.
+
+   @param n the node, or NULL for an empty spot; its reference is taken over
+   @param shift position of the bits used at this level
+   @param leaf the leaf to add, whose reference is taken over
+   @param added returns whether the key wasn't there already
+   @return the node to put in n's place
+ */
+static Trie *insert(Trie *n, int shift, Leaf *leaf, bool *added)
+{
+  *added = true;
+  if (!n) {
+    return &leaf->head;
+  }
+
+  if (n->kind == LEAF) {
+    Leaf *old = (Leaf *) n;
+    if (old->hash != leaf->hash) {
+      return join(n, &leaf->head, shift);
+    }
+    if (!old->key->equals(old->key, leaf->key)) {
+      Collision *c = makeCollision(leaf->hash, 2);
+      c->leaf[0] = old;
+      c->leaf[1] = leaf;
+      return &c->head;
+    }
+
+    // A leaf that's only in this trie keeps its key, like the other
+    // backends. A shared one is left alone for the other tries.
+    *added = false;
+    if (owned(n)) {
+      old->val->destroy(old->val);
+      old->val = leaf->val;
+      leaf->key->destroy(leaf->key);
+      poolFree(leaf, sizeof(Leaf));
+      return n;
+    }
+    release(n);
+    return &leaf->head;
+  }
+
+  if (n->kind == COLLISION) {
+    Collision *c = (Collision *) n;
+    if (c->hash != leaf->hash) {
+      return join(n, &leaf->head, shift);
+    }
+    int i = 0;
+    while (i < c->count && !c->leaf[i]->key->equals(c->leaf[i]->key, leaf->key)) {
+      i++;
+    }
+    *added = i == c->count;
+    return &editCollision(c, i, leaf)->head;
+  }
+
+  Branch *b = ownBranch((Branch *) n);
+  uint32_t bit = 1u << ((leaf->hash >> shift) & LEVEL_MASK);
+  int pos = childPos(b, bit);
+  if (b->bitmap & bit) {
+    b->child[pos] = insert(b->child[pos], shift + LEVEL_BITS, leaf, added);
+    return &b->head;
+  }
+
+  // Make a larger branch, moving the children over.
+  int count = __builtin_popcount(b->bitmap);
+  Branch *grown = makeBranch(b->bitmap | bit);
+  for (int i = 0; i < pos; i++) {
+    grown->child[i] = b->child[i];
+  }
+  grown->child[pos] = &leaf->head;
+  for (int i = pos; i < count; i++) {
+    grown->child[i + 1] = b->child[i];
+  }
+  poolFree(b, branchSize(count));
+  return &grown->head;
+}
+
+/**
+   Helper method to remove a key from the part of the trie below a
+   node. The key must be there.
+
+   @param n the node, whose reference is taken over
+   @param shift position of the bits used at this level
+   @param key the key to remove
+   @param h mixed hash of the key
+   @return the node to put in n's place, or NULL if nothing is left
+ */
+static Trie *erase(Trie *n, int shift, VType *key, unsigned int h)
+{
+  if (n->kind == LEAF) {
+    release(n);
+    return NULL;
+  }
+
+  if (n->kind == COLLISION) {
+    Collision *c = (Collision *) n;
+    int i = 0;
+    while (!c->leaf[i]->key->equals(c->leaf[i]->key, key)) {
+      i++;
+    }
+
+    // The last leaf left takes the collision node's place.
+    if (c->count == 2) {
+      Trie *rest = ref(&c->leaf[1 - i]->head);
+      release(n);
+      return rest;
+    }
+    return &editCollision(c, i, NULL)->head;
+  }
+
+  Branch *b = ownBranch((Branch *) n);
+  uint32_t bit = 1u << ((h >> shift) & LEVEL_MASK);
+  int pos = childPos(b, bit);
+  int count = __builtin_popcount(b->bitmap);
+  Trie *child = erase(b->child[pos], shift + LEVEL_BITS, key, h);
+  if (child) {
+    b->child[pos] = child;
+  } else {
+    // Make a smaller branch, moving the other children over.
+    Branch *shrunk = count > 1 ? makeBranch(b->bitmap & ~bit) : NULL;
+    for (int i = 0, j = 0; i < count; i++) {
+      if (i != pos) {
+        shrunk->child[j++] = b->child[i];
+      }
+    }
+    poolFree(b, branchSize(count));
+    if (!shrunk) {
+      return NULL;
+    }
+    b = shrunk;
+    count--;
+  }
+
+  // A branch left with a single leaf or collision node isn't needed,
+  // since those can sit at any level.
+  if (count == 1 && b->child[0]->kind != BRANCH) {
+    Trie *only = b->child[0];
+    poolFree(b, branchSize(1));
+    return only;
+  }
+  return &b->head;
+}
+
+/**
+   Helper method to find the leaf holding a key.
+
+   @param n the root of the trie
+   @param key the key to look for
+   @param h mixed hash of the key
+   @return the key's leaf, or NULL if it isn't in the trie
+ */
+static Leaf *find(Trie *n, VType *key, unsigned int h)
+{
+  for (int shift = 0; n; shift += LEVEL_BITS) {
+    if (n->kind == LEAF) {
+      Leaf *l = (Leaf *) n;
+      return l->hash == h && l->key->equals(l->key, key) ? l : NULL;
+    }
+    if (n->kind == COLLISION) {
+      Collision *c = (Collision *) n;
+      for (int i = 0; c->hash == h && i < c->count; i++) {
+        if (c->leaf[i]->key->equals(c->leaf[i]->key, key)) {
+          return c->leaf[i];
+        }
+      }
+      return NULL;
+    }
+
+    Branch *b = (Branch *) n;
+    uint32_t bit = 1u << ((h >> shift) & LEVEL_MASK);
+    if (!(b->bitmap & bit)) {
+      return NULL;
+    }
+    n = b->child[childPos(b, bit)];
+  }
+  return NULL;
+}
+
+Hamt *makeHamt( void )
+{
+  Hamt *t = (Hamt *) malloc( sizeof( Hamt ) );
+  t->root = NULL;
+  t->size = 0;
+  return t;
+}
+
+Hamt *copyHamt( Hamt *t )
+{
+  Hamt *copy = makeHamt();
+  copy->root = t->root ? ref( t->root ) : NULL;
+  copy->size = t->size;
+  return copy;
+}
+
+int hamtSize( Hamt *t )
+{
+  return t->size;
+}
+
+/**
+   Helper method to count the pairs at each depth below a node and the
+   bytes its nodes take up.
+
+   @param n the node
+   @param depth depth of the node
+   @param hist histogram of pairs by depth
+   @param len length of hist
+   @return number of bytes in n and the nodes below it
+ */
+static long histogram(Trie *n, int depth, int *hist, int len)
+{
+  int slot = depth < len ? depth : len - 1;
+  if (n->kind == LEAF) {
+    hist[slot]++;
+    return sizeof(Leaf);
+  }
+  if (n->kind == COLLISION) {
+    Collision *c = (Collision *) n;
+    hist[slot] += c->count;
+    return collisionSize(c->count) + c->count * sizeof(Leaf);
+  }
+
+  Branch *b = (Branch *) n;
+  int count = __builtin_popcount(b->bitmap);
+  long bytes = branchSize(count);
+  for (int i = 0; i < count; i++) {
+    bytes += histogram(b->child[i], depth + 1, hist, len);
+  }
+  return bytes;
+}
+
+long hamtHistogram( Hamt *t, int *hist, int len )
+{
+  for ( int i = 0; i < len; i++ )
+    hist[ i ] = 0;
+  long bytes = sizeof( Hamt );
+  if ( t->root )
+    bytes += histogram( t->root, 0, hist, len );
+  return bytes;
+}
+
+void hamtSet( Hamt *t, VType *key, VType *val, unsigned int h )
+{
+  h = mix( h );
+  bool added;
+  t->root = insert( t->root, 0, makeLeaf( h, key, val ), &added );
+  if ( added )
+    t->size++;
+}
+
+VType *hamtGet( Hamt *t, VType *key, unsigned int h )
+{
+  Leaf *l = find( t->root, key, mix( h ) );
+  return l ? l->val : NULL;
+}
+
+bool hamtRemove( Hamt *t, VType *key, unsigned int h )
+{
+  // Look first, so a missing key doesn't copy any shared nodes.
+  h = mix( h );
+  if ( ! find( t->root, key, h ) )
+    return false;
+
+  t->root = erase( t->root, 0, key, h );
+  t->size--;
+  return true;
+}
+
+/**
+   Helper method to visit every pair below a node.
+
+   @param n the node
+   @param visit function called with each key, its value and arg
+   @param arg extra argument passed to visit
+ */
+static void forEach(Trie *n, void (*visit)(VType const *key, VType const *val, void *arg),
+                    void *arg)
+{
+  if (n->kind == LEAF) {
+    visit(((Leaf *) n)->key, ((Leaf *) n)->val, arg);
+  } else if (n->kind == COLLISION) {
+    Collision *c = (Collision *) n;
+    for (int i = 0; i < c->count; i++) {
+      visit(c->leaf[i]->key, c->leaf[i]->val, arg);
+    }
+  } else {
+    Branch *b = (Branch *) n;
+    int count = __builtin_popcount(b->bitmap);
+    for (int i = 0; i < count; i++) {
+      forEach(b->child[i], visit, arg);
+    }
+  }
+}
+
+void hamtForEach( Hamt *t,
+                  void (*visit)( VType const *key, VType const *val, void *arg ),
+                  void *arg )
+{
+  if ( t->root )
+    forEach( t->root, visit, arg );
+}
+
+void freeHamt( Hamt *t )
+{
+  if ( t->root )
+    release( t->root );
+  free( t );
+}
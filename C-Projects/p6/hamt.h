@@ -0,0 +1,92 @@
+/**
+    @file hamt.h
+    @author Christopher Fields (cwfields)
+    Header for the hash array mapped trie used as the persistent backend
+    of the map component. The trie is built from reference counted,
+    immutable nodes, so a copy of the whole trie shares every node with
+    the original and takes constant time to make. Changing either copy
+    afterward copies just the nodes on the path to the changed key.
+*/
+
+#ifndef HAMT_H
+#define HAMT_H
+
+#include "vtype.h"
+#include <stdbool.h>
+
+/** Incomplete type for the trie representation. */
+typedef struct HamtStruct Hamt;
+
+/** Make an empty trie.
+    @return pointer to a new trie.
+*/
+Hamt *makeHamt( void );
+
+/** Make a copy of a trie that shares all of its nodes. The copy and
+    the original can be changed and freed independently, and each can
+    be used by a different thread at the same time.
+    @param t Trie to copy.
+    @return pointer to the new trie.
+*/
+Hamt *copyHamt( Hamt *t );
+
+/** Get the number of key/value pairs in the given trie.
+    @param t Pointer to the trie.
+    @return Number of key/value pairs in the trie. */
+int hamtSize( Hamt *t );
+
+/** Count the pairs at each depth of the trie.
+    @param t Pointer to the trie.
+    @param hist Array where hist[ i ] receives the number of pairs i
+    levels below the root. The last element counts everything deeper.
+    @param len Length of hist.
+    @return Number of bytes allocated for the trie's nodes, including
+    any it shares with copies.
+*/
+long hamtHistogram( Hamt *t, int *hist, int len );
+
+/** Adds the given key/value pair to the trie, replacing the old value
+    if the key is already present. The trie takes ownership of both key
+    and val, and the old value is destroyed once no copy of the trie
+    refers to it.
+    @param t Pointer to the trie to add to.
+    @param key Key of the value to add.
+    @param val Value to add.
+    @param h Hash of the key.
+*/
+void hamtSet( Hamt *t, VType *key, VType *val, unsigned int h );
+
+/** Return the value associated with the given key. The returned VType
+    is still owned by the trie.
+    @param t Trie to query.
+    @param key Key to look for.
+    @param h Hash of the key.
+    @return Value associated with the key, or NULL if it isn't present.
+*/
+VType *hamtGet( Hamt *t, VType *key, unsigned int h );
+
+/** Removes the key/value pair associated with the given key. The pair
+    is destroyed once no copy of the trie refers to it.
+    @param t Trie to remove from.
+    @param key Key to remove.
+    @param h Hash of the key.
+    @return true if the key was in the trie.
+*/
+bool hamtRemove( Hamt *t, VType *key, unsigned int h );
+
+/** Call the given function for each key/value pair in the trie.
+    @param t Trie to visit.
+    @param visit Function called with each key, its value and arg.
+    @param arg Extra argument passed to visit.
+*/
+void hamtForEach( Hamt *t,
+                  void (*visit)( VType const *key, VType const *val, void *arg ),
+                  void *arg );
+
+/** Free the trie, along with every node and key/value pair that no
+    other copy refers to.
+    @param t The trie to free.
+*/
+void freeHamt( Hamt *t );
+
+#endif
@@ -0,0 +1,173 @@
+/**
+    @file hash.c
+    @author Christopher Fields (cwfields)
+    Implementation of the hash component. The string hash mixes each
+    64-bit word with the multiply-rotate-multiply step from MurmurHash3
+    and finishes with its 64-bit finalizer. The integer hash is the
+    SplitMix64 mixing function applied to the value plus the seed.
+*/
+
+#include "hash.h"
+#include "integer.h"
+#include "text.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/** First multiplier for mixing in a word. */
+#define K1 0x87C37B91114253D5ULL
+
+/** Second multiplier for mixing in a word. */
+#define K2 0x4CF5AD432745937FULL
+
+/** Number of keys hashVTypes sorts by type at a time. */
+#define BATCH 64
+
+/** How many keys ahead hashVTypes prefetches. */
+#define PREFETCH 8
+
+/**
+   Helper function to rotate a 64-bit number left.
+
+   @param x number to rotate
+   @param r number of bits to rotate by
+   @return the rotated number
+ */
+static inline uint64_t rotl( uint64_t x, int r )
+{
+  return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+/**
+   Helper function to scramble all the bits of a 64-bit number
+   (the MurmurHash3 finalizer).
+
+   @param h number to scramble
+   @return the scrambled number
+ */
+static inline uint64_t fmix64( uint64_t h )
+{
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+   Helper function to mix one word into the hash state.
+
+   @param h hash state
+   @param w word to mix in
+   @return the new hash state
+ */
+static inline uint64_t mixWord( uint64_t h, uint64_t w )
+{
+  w *= K1;
+  w = rotl( w, 31 );
+  w *= K2;
+  h ^= w;
+  h = rotl( h, 27 );
+  return h * 5 + 0x52DCE729;
+}
+
+unsigned int hashBytes( void const *data, size_t len, uint64_t seed )
+{
+  unsigned char const *p = (unsigned char const *) data;
+  uint64_t h = seed ^ ( len * K2 );
+
+  // Whole words, loaded with memcpy so unaligned strings are fine.
+  size_t words = len / sizeof( uint64_t );
+  for ( size_t i = 0; i < words; i++ ) {
+    uint64_t w;
+    memcpy( &w, p, sizeof( w ) );
+    h = mixWord( h, w );
+    p += sizeof( w );
+  }
+
+  // The last few bytes, padded with zeros.
+  size_t rest = len % sizeof( uint64_t );
+  if ( rest ) {
+    uint64_t w = 0;
+    memcpy( &w, p, rest );
+    h = mixWord( h, w );
+  }
+
+  h = fmix64( h );
+  return (unsigned int) ( h ^ ( h >> 32 ) );
+}
+
+unsigned int hashInt( int x, uint64_t seed )
+{
+  uint64_t z = (uint64_t) (unsigned int) x + seed + 0x9E3779B97F4A7C15ULL;
+  z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return (unsigned int) ( z ^ ( z >> 32 ) );
+}
+
+unsigned int hashVType( VType const *v, uint64_t seed )
+{
+  if ( isInteger( v ) )
+    return hashInt( ( (Integer const *) v )->val, seed );
+  if ( isText( v ) )
+    return hashBytes( textValue( v ), textLength( v ), seed );
+  return (unsigned int) fmix64( v->hash( v ) ^ seed );
+}
+
+void hashVTypes( VType *const *keys, int n, uint64_t seed, unsigned int *out )
+{
+  int ints[ BATCH ], vals[ BATCH ], texts[ BATCH ], lens[ BATCH ];
+  char const *strs[ BATCH ];
+  for ( int base = 0; base < n; base += BATCH ) {
+    int len = n - base < BATCH ? n - base : BATCH;
+    VType *const *block = keys + base;
+    unsigned int *hashes = out + base;
+
+    // Sort the block by type, prefetching the keys ahead of the one
+    // being looked at, since each is a separate allocation.
+    int nints = 0, ntexts = 0;
+    for ( int i = 0; i < len; i++ ) {
+      if ( base + i + PREFETCH < n )
+        __builtin_prefetch( block[ i + PREFETCH ] );
+      VType const *v = block[ i ];
+      if ( isInteger( v ) ) {
+        vals[ nints ] = ( (Integer const *) v )->val;
+        ints[ nints++ ] = i;
+      } else if ( isText( v ) ) {
+        strs[ ntexts ] = textValue( v );
+        lens[ ntexts ] = textLength( v );
+        __builtin_prefetch( strs[ ntexts ] );
+        texts[ ntexts++ ] = i;
+      } else
+        hashes[ i ] = hashVType( v, seed );
+    }
+
+    // The Integers are mixed in a loop with no calls or branches, so
+    // the multiplies for different keys can overlap.
+    for ( int j = 0; j < nints; j++ )
+      hashes[ ints[ j ] ] = hashInt( vals[ j ], seed );
+
+    // By now, the characters of each Text have had time to arrive.
+    for ( int j = 0; j < ntexts; j++ )
+      hashes[ texts[ j ] ] = hashBytes( strs[ j ], lens[ j ], seed );
+  }
+}
+
+uint64_t hashRandomSeed( void )
+{
+  uint64_t seed = 0;
+  FILE *fp = fopen( "/dev/urandom", "rb" );
+  if ( fp ) {
+    if ( fread( &seed, sizeof( seed ), 1, fp ) != 1 )
+      seed = 0;
+    fclose( fp );
+  }
+
+  // Fall back on the time and an address if there's no random source.
+  if ( seed == 0 )
+    seed = fmix64( (uint64_t) time( NULL ) ^ (uint64_t) (size_t) &seed );
+  return seed ? seed : K1;
+}
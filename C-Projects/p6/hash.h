@@ -0,0 +1,60 @@
+/**
+    @file hash.h
+    @author Christopher Fields (cwfields)
+    Header for the hash component, which provides seeded hash functions
+    for map keys. Strings are hashed a 64-bit word at a time instead of
+    a byte at a time, and integers are run through a mixing function so
+    sequential or evenly spaced values don't pile into the same buckets.
+    Each map can use its own random seed, so an attacker can't choose
+    keys that collide.
+*/
+
+#ifndef HASH_H
+#define HASH_H
+
+#include "vtype.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/** Hash a block of bytes with the given seed.
+    @param data Bytes to hash.
+    @param len Number of bytes.
+    @param seed Seed for the hash.
+    @return hash of the bytes.
+*/
+unsigned int hashBytes( void const *data, size_t len, uint64_t seed );
+
+/** Hash an integer with the given seed.
+    @param x Integer to hash.
+    @param seed Seed for the hash.
+    @return hash of the integer.
+*/
+unsigned int hashInt( int x, uint64_t seed );
+
+/** Hash a VType with the given seed, using hashInt for an Integer and
+    hashBytes for a Text. Any other VType's own hash is mixed with the
+    seed.
+    @param v Value to hash.
+    @param seed Seed for the hash.
+    @return hash of the value.
+*/
+unsigned int hashVType( VType const *v, uint64_t seed );
+
+/** Hash many VTypes at once, giving the hashes hashVType would. Works
+    through the keys a block at a time, prefetching each key and the
+    characters of each Text before they're hashed, and mixing all of a
+    block's Integers in one loop, so a large batch spends less time
+    waiting on memory than hashing the keys one by one.
+    @param keys Array of values to hash.
+    @param n Number of values.
+    @param seed Seed for the hash.
+    @param out Array that receives the n hashes.
+*/
+void hashVTypes( VType *const *keys, int n, uint64_t seed, unsigned int *out );
+
+/** Make a random seed, read from the system's random source if possible.
+    @return a new seed, never zero.
+*/
+uint64_t hashRandomSeed( void );
+
+#endif
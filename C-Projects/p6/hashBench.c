@@ -0,0 +1,202 @@
+/**
+    @file hashBench.c
+    @author Christopher Fields (cwfields)
+    Benchmark comparing the VTypes' own hash functions with the seeded
+    hash functions from the hash component. For several sets of keys,
+    reports how evenly each function spreads the keys over a table
+    (empty buckets, longest chain, average chain steps for a lookup),
+    how fast it hashes one key at a time and, for the seeded hash, in
+    bulk with hashVTypes, and how fast a chained Map using it runs.
+
+    Usage: hashBench [keys]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "vtype.h"
+#include "integer.h"
+#include "text.h"
+#include "map.h"
+#include "hash.h"
+
+/** Default number of keys in each set. */
+#define DEFAULT_KEYS 1000000
+
+/** Number of times each set of keys is hashed when timing. */
+#define REPEAT 5
+
+/** Seed used for the seeded hash functions. */
+#define SEED 0x123456789ABCDEFULL
+
+/** Where hash results are stored so the timing loops aren't optimized away. */
+static volatile unsigned int hashSink;
+
+/**
+   Get the current time in seconds.
+   @return seconds since some fixed point.
+ */
+static double now( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+   Hash a key with either its own hash function or the seeded one.
+   @param key Key to hash.
+   @param seeded True for the seeded hash.
+   @return hash of the key.
+ */
+static unsigned int hashWith( VType *key, bool seeded )
+{
+  return seeded ? hashVType( key, SEED ) : key->hash( key );
+}
+
+/**
+   Make one of the sets of keys.
+   @param set Which set to make (0 to 4).
+   @param n Number of keys.
+   @return array of n new keys.
+ */
+static VType **makeKeys( int set, int n )
+{
+  VType **keys = (VType **) malloc( n * sizeof( VType * ) );
+  char buf[ 100 ];
+  unsigned int state = 2463534242u;
+  for ( int i = 0; i < n; i++ ) {
+    switch ( set ) {
+    case 0:
+      keys[ i ] = makeInteger( i );
+      break;
+    case 1:
+      keys[ i ] = makeInteger( i * 1024 );
+      break;
+    case 2:
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      keys[ i ] = makeInteger( state );
+      break;
+    case 3:
+      sprintf( buf, "user%07d", i );
+      keys[ i ] = makeText( buf, strlen( buf ) );
+      break;
+    default:
+      sprintf( buf, "/home/projects/reports/2024/quarterly/region-%07d/summary.csv", i );
+      keys[ i ] = makeText( buf, strlen( buf ) );
+      break;
+    }
+  }
+  return keys;
+}
+
+/** Names of the sets of keys. */
+static char const *setNames[] = {
+  "sequential ints", "ints * 1024", "random ints", "short strings", "long strings"
+};
+
+/**
+   Report how one hash function spreads a set of keys over a table with
+   one bucket per key, and how fast it is.
+   @param keys Array of keys.
+   @param n Number of keys.
+   @param seeded True for the seeded hash.
+ */
+static void measure( VType **keys, int n, bool seeded )
+{
+  int *count = (int *) calloc( n, sizeof( int ) );
+  for ( int i = 0; i < n; i++ )
+    count[ hashWith( keys[ i ], seeded ) % n ]++;
+
+  int empty = 0, longest = 0;
+  double steps = 0;
+  for ( int i = 0; i < n; i++ ) {
+    if ( count[ i ] == 0 )
+      empty++;
+    if ( count[ i ] > longest )
+      longest = count[ i ];
+    steps += count[ i ] * ( count[ i ] + 1.0 ) / 2;
+  }
+  free( count );
+
+  // Time hashing every key a few times.
+  unsigned int sink = 0;
+  double start = now();
+  for ( int r = 0; r < REPEAT; r++ )
+    for ( int i = 0; i < n; i++ )
+      sink += hashWith( keys[ i ], seeded );
+  double hashRate = (double) REPEAT * n / ( now() - start );
+
+  // The seeded hash can also do the keys in bulk.
+  double bulkRate = 0;
+  if ( seeded ) {
+    unsigned int *out = (unsigned int *) malloc( n * sizeof( unsigned int ) );
+    start = now();
+    for ( int r = 0; r < REPEAT; r++ ) {
+      hashVTypes( keys, n, SEED, out );
+      sink += out[ r % n ];
+    }
+    bulkRate = (double) REPEAT * n / ( now() - start );
+    for ( int i = 0; i < n; i++ )
+      if ( out[ i ] != hashVType( keys[ i ], SEED ) ) {
+        fprintf( stderr, "hashVTypes disagrees with hashVType\n" );
+        exit( EXIT_FAILURE );
+      }
+    free( out );
+  }
+
+  // Time filling and searching a chained map that uses the function.
+  MapOptions opts = { MAP_CHAINED, seeded ? MAP_HASH_SEEDED : MAP_HASH_VTYPE, SEED };
+  Map *map = makeMapWith( n, &opts );
+  start = now();
+  for ( int i = 0; i < n; i++ ) {
+    // The map takes ownership of its keys, so give it copies.
+    VType *k = isText( keys[ i ] ) ? makeText( textValue( keys[ i ] ), textLength( keys[ i ] ) )
+      : makeInteger( ( (Integer *) keys[ i ] )->val );
+    mapSet( map, k, makeInteger( i ) );
+  }
+  for ( int i = 0; i < n; i++ )
+    sink += mapGet( map, keys[ i ] ) != NULL;
+  double mapRate = 2.0 * n / ( now() - start );
+  freeMap( map );
+
+  printf( "  %-8s %7.1f%% %8d %8.2f %14.0f %14.0f %14.0f\n", seeded ? "seeded" : "vtype",
+          100.0 * empty / n, longest, steps / n, hashRate, bulkRate, mapRate );
+  hashSink = sink;
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  int n = argc > 1 ? atoi( argv[ 1 ] ) : DEFAULT_KEYS;
+  if ( n < 1 ) {
+    fprintf( stderr, "usage: hashBench [keys]\n" );
+    return EXIT_FAILURE;
+  }
+
+  printf( "%d keys, %d buckets\n", n, n );
+  printf( "  %-8s %8s %8s %8s %14s %14s %14s\n", "hash", "empty", "longest",
+          "steps", "hashes/sec", "bulk/sec", "map ops/sec" );
+  for ( int set = 0; set < 5; set++ ) {
+    printf( "%s\n", setNames[ set ] );
+    VType **keys = makeKeys( set, n );
+    measure( keys, n, false );
+    measure( keys, n, true );
+    for ( int i = 0; i < n; i++ )
+      keys[ i ]->destroy( keys[ i ] );
+    free( keys );
+  }
+
+  return EXIT_SUCCESS;
+}
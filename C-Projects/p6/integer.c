@@ -8,6 +8,7 @@
 */
 
 #include "integer.h"
+#include "pool.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -48,8 +49,8 @@ static unsigned int hash( VType const *v )
 // destroy method for Integer.
 static void destroy( VType *v )
 {
-  // Integer is just one block of heap memory.
-  free( v );
+  // Integer is just one block of pooled memory.
+  poolFree( v, sizeof( Integer ) );
 }
 
 VType *parseInteger( char const *init, int *n )
@@ -63,9 +64,14 @@ VType *parseInteger( char const *init, int *n )
   // Fill in the end pointer, if the caller asked for it.
   if ( n )
     *n = len;
-  
-  // Allocate an Integer on the heap and fill in its fields.
-  Integer *this = (Integer *) malloc( sizeof( Integer ) );
+
+  return makeInteger( val );
+}
+
+VType *makeInteger( int val )
+{
+  // Allocate an Integer from the value pool and fill in its fields.
+  Integer *this = (Integer *) poolAlloc( sizeof( Integer ) );
   this->val = val;
   this->print = print;
   this->equals = equals;
@@ -75,3 +81,8 @@ VType *parseInteger( char const *init, int *n )
   // Return it as a poitner to the superclass.
   return (VType *) this;
 }
+
+bool isInteger( VType const *v )
+{
+  return v->print == print;
+}
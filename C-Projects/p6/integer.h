@@ -39,4 +39,16 @@ typedef struct {
 */
 VType *parseInteger( char const *init, int *n );
 
+/** Make an instance of Integer holding the given value.
+    @param val Value for the new Integer.
+    @return pointer to the new VType instance.
+*/
+VType *makeInteger( int val );
+
+/** Return true if the given VType is an Integer.
+    @param v VType to check.
+    @return True if v is an Integer.
+*/
+bool isInteger( VType const *v );
+
 #endif
@@ -0,0 +1,194 @@
+/**
+    @file intern.c
+    @author Christopher Fields (cwfields)
+    Implementation of the intern component. Interned strings live in a
+    chained hash set, each stored right after a small header holding its
+    hash code, reference count, length and shared object, so the
+    string's address is enough to find its header. Strings are hashed with hashBytes, which
+    works a word at a time. The table grows as strings are added and is
+    freed whenever its last string is released.
+*/
+
+#include "intern.h"
+#include "pool.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+/** Length of the table when it's first made. */
+#define INITIAL_LEN 64
+
+/** The table doubles once it holds this many strings per bucket. */
+#define MAX_LOAD 1
+
+/** Header for an interned string, which is stored right after it. */
+typedef struct InternedStruct {
+  /** Next string in the same bucket. */
+  struct InternedStruct *next;
+
+  /** Hash code for the string. */
+  unsigned int hash;
+
+  /** Number of references to the string. */
+  int refs;
+
+  /** Number of characters in the string. */
+  int len;
+
+  /** Object made for the string by internShared, or NULL. */
+  void *shared;
+
+  /** Function that frees shared along with the string. */
+  void (*drop)( void *obj );
+
+  /** Characters of the string, with a null terminator. */
+  char str[];
+} Interned;
+
+/** Buckets of the table, or NULL if nothing is interned. */
+static Interned **table;
+
+/** Number of buckets in the table. */
+static int tableLen;
+
+/** Number of strings in the table. */
+static int count;
+
+/** Lock protecting the table and every reference count. */
+static pthread_mutex_t internLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+   Helper function to find the header of an interned string.
+
+   @param str the interned string
+   @return pointer to its header
+ */
+static Interned *header( char const *str )
+{
+  return (Interned *) ( str - offsetof( Interned, str ) );
+}
+
+/**
+   Helper function to double the length of the table, moving every
+   string to its bucket in the new table. The caller must hold the lock.
+ */
+static void growTable( void )
+{
+  int len = tableLen * 2;
+  Interned **buckets = (Interned **) calloc( len, sizeof( Interned * ) );
+  for ( int i = 0; i < tableLen; i++ ) {
+    Interned *s = table[ i ];
+    while ( s ) {
+      Interned *next = s->next;
+      int idx = s->hash % len;
+      s->next = buckets[ idx ];
+      buckets[ idx ] = s;
+      s = next;
+    }
+  }
+  free( table );
+  table = buckets;
+  tableLen = len;
+}
+
+/**
+   Helper function to find the interned copy of a string, adding it if
+   it isn't there yet, and take a reference to it. The caller must hold
+   the lock.
+
+   @param str characters to look for
+   @param len number of characters in str
+   @return the header of the interned copy
+ */
+static Interned *lookup( char const *str, int len )
+{
+  unsigned int hash = hashBytes( str, len, 0 );
+  if ( ! table ) {
+    tableLen = INITIAL_LEN;
+    table = (Interned **) calloc( tableLen, sizeof( Interned * ) );
+  }
+
+  // Share the copy that's already there, if there is one.
+  Interned **bucket = &table[ hash % tableLen ];
+  for ( Interned *s = *bucket; s; s = s->next ) {
+    if ( s->hash == hash && s->len == len && memcmp( s->str, str, len ) == 0 ) {
+      s->refs++;
+      return s;
+    }
+  }
+
+  Interned *s = (Interned *) poolAlloc( sizeof( Interned ) + len + 1 );
+  s->hash = hash;
+  s->refs = 1;
+  s->len = len;
+  s->shared = NULL;
+  memcpy( s->str, str, len );
+  s->str[ len ] = '\0';
+  s->next = *bucket;
+  *bucket = s;
+
+  if ( ++count > tableLen * MAX_LOAD )
+    growTable();
+  return s;
+}
+
+char const *internString( char const *str, int len )
+{
+  pthread_mutex_lock( &internLock );
+  Interned *s = lookup( str, len );
+  pthread_mutex_unlock( &internLock );
+  return s->str;
+}
+
+void *internShared( char const *str, int len,
+                    void *(*make)( char const *str, int len ),
+                    void (*drop)( void *obj ) )
+{
+  pthread_mutex_lock( &internLock );
+  Interned *s = lookup( str, len );
+  if ( ! s->shared ) {
+    s->shared = make( s->str, len );
+    s->drop = drop;
+  }
+  void *obj = s->shared;
+  pthread_mutex_unlock( &internLock );
+  return obj;
+}
+
+void releaseString( char const *str )
+{
+  Interned *s = header( str );
+  void *shared = NULL;
+  void (*drop)( void *obj ) = NULL;
+  pthread_mutex_lock( &internLock );
+  if ( --s->refs == 0 ) {
+    Interned **link = &table[ s->hash % tableLen ];
+    while ( *link != s )
+      link = &( *link )->next;
+    *link = s->next;
+    shared = s->shared;
+    drop = s->drop;
+    poolFree( s, sizeof( Interned ) + s->len + 1 );
+
+    if ( --count == 0 ) {
+      free( table );
+      table = NULL;
+    }
+  }
+  pthread_mutex_unlock( &internLock );
+
+  // Nothing can find the shared object any more.
+  if ( shared )
+    drop( shared );
+}
+
+int internedCount( void )
+{
+  pthread_mutex_lock( &internLock );
+  int n = count;
+  pthread_mutex_unlock( &internLock );
+  return n;
+}
@@ -0,0 +1,55 @@
+/**
+    @file intern.h
+    @author Christopher Fields (cwfields)
+    Header for the intern component, which keeps a single shared copy of
+    each distinct string. Interning a string returns the one copy with
+    its contents, so equal interned strings always have the same address
+    and can be compared by pointer. Interned strings are immutable and
+    reference counted; a string is freed when its last reference is
+    released. The table is synchronized, so strings can be interned and
+    released from any thread.
+*/
+
+#ifndef INTERN_H
+#define INTERN_H
+
+/** Get the interned copy of the given characters, adding it to the
+    table if it isn't there yet, and take a reference to it.
+    @param str Characters to intern, which don't need to be null
+    terminated.
+    @param len Number of characters in str.
+    @return the interned, null-terminated copy, which must not be changed.
+*/
+char const *internString( char const *str, int len );
+
+/** Get an object shared by everyone who interns the given characters
+    this way, making it the first time, and take a reference to the
+    interned string. Each reference counts toward the string, and the
+    object is freed along with the string once the last reference is
+    released, whether it was taken by internShared or internString.
+    @param str Characters to intern, which don't need to be null
+    terminated.
+    @param len Number of characters in str.
+    @param make Function that makes the shared object, given the
+    interned copy of the string and its length. It's called with the
+    table locked, so it must not use the intern component.
+    @param drop Function that frees the shared object.
+    @return the shared object.
+*/
+void *internShared( char const *str, int len,
+                    void *(*make)( char const *str, int len ),
+                    void (*drop)( void *obj ) );
+
+/** Release a reference to an interned string, freeing it (and its
+    shared object, if it has one) if that was the last one.
+    @param str String returned by internString, or the string a shared
+    object was made with.
+*/
+void releaseString( char const *str );
+
+/** Get the number of distinct strings interned.
+    @return number of strings in the table.
+*/
+int internedCount( void );
+
+#endif
@@ -6,16 +6,90 @@
     the client to make a Map, get the size of the Map,
     add to the Map, remove from the Map, get an element
     from the Map, and free the memory contained by the Map.
+    When the chained table grows, its nodes are moved into the
+    larger table a few buckets at a time by later operations, so
+    no single operation pays for rehashing the whole map.
+    A Map made with the MAP_OPEN backend hands all of its work
+    to an open addressing table from the openmap component, and one
+    made with MAP_PERSISTENT hands it to a hash array mapped trie from
+    the hamt component, which is what lets mapSnapshot share it.
+    A bounded Map allocates larger nodes that are also linked into a
+    list from most to least recently used, so the pair to evict is
+    always at the end of the list. An expiring Map adds a Timer to the
+    end of each node, so a timer wheel can find the pairs whose time to
+    live has run out.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "map.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "vtype.h"
+#include "integer.h"
+#include "text.h"
+#include "openmap.h"
+#include "hamt.h"
+#include "orderIndex.h"
+#include "wheel.h"
+#include "pool.h"
+#include "serial.h"
+#include "hash.h"
 
 /** Mutlpilier to change capacity by if size reaches capacity of table */
 #define CAP_MULTIPLIER 2
 
+/** The table shrinks to half its length when it has fewer than one
+    entry for every SHRINK_LOAD buckets. It grows when it's full, so a
+    map that has just grown or shrunk is never close to doing either. */
+#define SHRINK_LOAD 4
+
+/** Number of buckets of the old table moved into the new table by each
+    map operation while the map is growing or shrinking. */
+#define MIGRATE_BUCKETS 8
+
+/** Most expired pairs removed by each operation on an expiring map,
+    so a burst of pairs expiring together is spread over several
+    operations. */
+#define EXPIRE_STEP 16
+
+/** Number of pairs mapSetMany adds at a time, which bounds the extra
+    memory it needs. */
+#define SET_MANY_BLOCK ( 1 << 20 )
+
+/** mapSetMany adds fewer pairs than this one at a time, since starting
+    threads would cost more than it saves. */
+#define SET_MANY_SERIAL 4096
+
+/** Most threads mapSetMany will use. */
+#define SET_MANY_THREADS 64
+
+/** Bytes at the start of every snapshot file. */
+#define SNAPSHOT_MAGIC "P6MAP\0\0\1"
+
+/** Number of bytes in SNAPSHOT_MAGIC. */
+#define MAGIC_LEN 8
+
+/** Size of the output buffer used when saving a snapshot. */
+#define SAVE_BUFFER ( 1 << 20 )
+
+#ifdef MAP_STATS
+/** Add to one of the map's counters. */
+#define COUNT( m, field, n ) ( ( m )->counters.field += ( n ) )
+#else
+/** Counting is compiled out without MAP_STATS. */
+#define COUNT( m, field, n )
+#endif
+
 /** Node containing a key / value pair. */
 typedef struct NodeStruct {
   /** Pointer to the key part of the key / value pair. */
@@ -26,8 +100,23 @@ typedef struct NodeStruct {
   
   /** Pointer to the next node at the same element of this table. */
   struct NodeStruct *next;
+
+  /** Hash of the key, saved so it's never computed twice. */
+  unsigned int hash;
 } Node;
 
+/** Node of a bounded map, which is also in the map's recency list. */
+typedef struct CacheNodeStruct {
+  /** The node itself, first so a CacheNode can be used as a Node. */
+  Node node;
+
+  /** Next more recently used node, or NULL for the newest. */
+  struct CacheNodeStruct *newer;
+
+  /** Next less recently used node, or NULL for the oldest. */
+  struct CacheNodeStruct *older;
+} CacheNode;
+
 /** Representation of a hash table implementation of a map. */
 struct MapStruct {
   /** Table of key / value pairs. */
@@ -38,14 +127,162 @@ struct MapStruct {
   
   /** Current size of the map (number of different keys). */
   int size;
+
+  /** While the map is growing, the smaller table that nodes are being
+      moved out of, otherwise NULL. */
+  Node **oldTable;
+
+  /** Length of oldTable. */
+  int oldLen;
+
+  /** Index of the next bucket in oldTable to move. Buckets before
+      this one are empty. */
+  int migrateIdx;
+
+  /** The table doesn't shrink below this length, set by makeMap and
+      mapReserve. */
+  int minLen;
+
+  /** True if keys are hashed with the seeded hash functions. */
+  bool seeded;
+
+  /** Seed for the seeded hash functions. */
+  uint64_t seed;
+
+  /** Slab that all of this map's nodes are allocated from. */
+  Slab *nodes;
+
+  /** Open addressing table used instead of the chained table, or NULL
+      if this map uses chaining. */
+  OpenMap *open;
+
+  /** Persistent trie used instead of the chained table, or NULL if this
+      map doesn't use one. */
+  Hamt *hamt;
+
+  /** Ordered index of the keys, or NULL if the map doesn't keep one. */
+  OrderIndex *index;
+
+  /** True if the map has a limit, so its nodes are CacheNodes. */
+  bool bounded;
+
+  /** Most pairs and bytes the map may hold, or zero for no limit. */
+  int maxEntries;
+  long maxBytes;
+
+  /** Bytes taken up by a bounded map's nodes, keys and values. */
+  long bytes;
+
+  /** Most and least recently used nodes of a bounded map. */
+  CacheNode *newest, *oldest;
+
+  /** Gets that found their key, gets that didn't, and pairs evicted,
+      in a bounded map. */
+  long hits, misses, evictions;
+
+  /** Timer wheel for pairs with a time to live, or NULL if the map
+      doesn't allow them. */
+  TimerWheel *wheel;
+
+  /** Offset of the Timer in each node of an expiring map. */
+  size_t timerOff;
+
+  /** Size of each node. */
+  size_t nodeSize;
+
+  /** Pairs removed because their time to live ran out. */
+  long expirations;
+
+#ifdef MAP_STATS
+  /** Counters for the chained table's operations. */
+  OpenMapCounters counters;
+#endif
 };
 
+/**
+   Helper method to get the time used for expiring pairs.
+
+   @return milliseconds since some fixed point
+ */
+static long nowMillis(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000L + t.tv_nsec / 1000000;
+}
+
+/**
+   Helper method to get the wall-clock time, used to record when pairs
+   expire in a snapshot, since the clock from nowMillis starts over
+   when the machine restarts.
+
+   @return milliseconds since the epoch
+ */
+static long wallMillis(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return t.tv_sec * 1000L + t.tv_nsec / 1000000;
+}
+
 Map *makeMap( int len )
+{
+  return makeMapWith( len, NULL );
+}
+
+Map *makeMapWith( int len, MapOptions const *opts )
 {
   Map *m = (Map *) malloc( sizeof( Map ) );
   m->size = 0;
 
-  m->tlen = len;
+  m->seeded = opts && opts->hash == MAP_HASH_SEEDED;
+  m->seed = 0;
+  if ( m->seeded )
+    m->seed = opts->seed ? opts->seed : hashRandomSeed();
+
+  m->oldTable = NULL;
+  m->oldLen = 0;
+  m->migrateIdx = 0;
+  m->index = opts && opts->ordered ? makeOrderIndex() : NULL;
+#ifdef MAP_STATS
+  m->counters = (OpenMapCounters) { 0 };
+#endif
+
+  m->maxEntries = opts && opts->maxEntries > 0 ? opts->maxEntries : 0;
+  m->maxBytes = opts && opts->maxBytes > 0 ? opts->maxBytes : 0;
+  m->bounded = m->maxEntries || m->maxBytes;
+  m->bytes = 0;
+  m->newest = m->oldest = NULL;
+  m->hits = m->misses = m->evictions = 0;
+  m->wheel = opts && opts->expiring ? makeTimerWheel( nowMillis() ) : NULL;
+  m->expirations = 0;
+
+  m->hamt = NULL;
+  if ( opts && opts->backend == MAP_PERSISTENT && ! m->index && ! m->bounded &&
+       ! m->wheel ) {
+    m->hamt = makeHamt();
+    m->open = NULL;
+    m->tlen = 0;
+    m->table = NULL;
+    m->nodes = NULL;
+    return m;
+  }
+  if ( opts && opts->backend == MAP_OPEN && ! m->bounded && ! m->wheel ) {
+    m->open = makeOpenMap( len );
+    m->tlen = 0;
+    m->table = NULL;
+    m->nodes = NULL;
+    return m;
+  }
+  m->open = NULL;
+
+  // Nodes have room for whatever bookkeeping the map's options need
+  m->timerOff = m->bounded ? sizeof(CacheNode) : sizeof(Node);
+  m->nodeSize = m->timerOff + (m->wheel ? sizeof(Timer) : 0);
+  m->nodes = makeSlab(m->nodeSize);
+
+  m->tlen = len > 0 ? len : 1;
+  m->minLen = m->tlen;
   m->table = malloc(m->tlen * sizeof(Node *));
 
   for (int i = 0; i < m->tlen; i++) {
@@ -57,140 +294,1217 @@ Map *makeMap( int len )
 
 int mapSize( Map *m )
 {
+  if ( m->open )
+    return openMapSize( m->open );
+  if ( m->hamt )
+    return hamtSize( m->hamt );
   return m->size;
 }
 
+int mapCapacity( Map *m )
+{
+  if ( m->open )
+    return openMapCapacity( m->open );
+  if ( m->hamt )
+    return 0;
+  return m->tlen;
+}
+
+/**
+   Helper method to hash a key the way this map was set up to.
+
+   @param m the Map the key is for
+   @param key the key to hash
+   @return hash of the key
+ */
+static unsigned int keyHash(Map *m, VType *key)
+{
+  if (m->seeded) {
+    return hashVType(key, m->seed);
+  }
+  return key->hash(key);
+}
+
+/**
+   Helper method to move up to count buckets from the old table into
+   the new table while the map is growing. Nodes are relinked into the
+   new table rather than copied. Frees the old table once it's empty.
+
+   @param m the Map to continue growing
+   @param count maximum number of old buckets to move
+ */
+static void migrate(Map *m, int count)
+{
+  while (m->oldTable && count-- > 0) {
+    Node *current = m->oldTable[m->migrateIdx];
+    while (current) { // Move each node to the front of its new bucket
+      Node *next = current->next;
+      int idx = current->hash % m->tlen;
+      current->next = m->table[idx];
+      m->table[idx] = current;
+      current = next;
+    }
+    m->oldTable[m->migrateIdx++] = NULL;
+
+    if (m->migrateIdx == m->oldLen) { // Everything has moved
+      free(m->oldTable);
+      m->oldTable = NULL;
+      m->oldLen = 0;
+      m->migrateIdx = 0;
+    }
+  }
+}
+
+/**
+   Helper method to change the length of the table. Allocates a new
+   table of the given length and keeps the old one around, so its nodes
+   can be moved a few buckets at a time by later operations.
+
+   @param m the Map to resize the table of
+   @param len the new length of the table
+ */
+static void resizeMap(Map *m, int len)
+{
+  // Finish any earlier resize first, there's only room for two tables
+  if (m->oldTable) {
+    migrate(m, m->oldLen - m->migrateIdx);
+  }
+
+  m->oldTable = m->table;
+  m->oldLen = m->tlen;
+  m->migrateIdx = 0;
+
+  m->tlen = len;
+  m->table = calloc(m->tlen, sizeof(Node *));
+}
+
 /**
    Helper method to expand the capacity of the Map if
-   the size becomes equal to capacity. Moves all data
-   from table into new table, freeing the old table of
-   smaller capacity.
+   the size becomes equal to capacity.
  
    @param m the Map to expand the table capacity of
  */
 static void expandMap(Map *m)
 {
-  // Create a newLen and allocate a new table
-  int newLen = CAP_MULTIPLIER * m->tlen;
-  Node **newTable = malloc(newLen * sizeof(Node *));
+#ifdef MAP_STATS
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+  resizeMap(m, CAP_MULTIPLIER * m->tlen);
 
-  // Initialize new table values to NULL
-  for (int i = 0; i < newLen; i++) {
-    newTable[i] = NULL;
-  }
+#ifdef MAP_STATS
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  COUNT(m, expansions, 1);
+  COUNT(m, expandSeconds, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+#endif
+}
 
-  // Iterate through each element of the Map table, adding it to the newTable
-  for (int i = 0; i < m->tlen; i++) {
-    if (m->table[i]) {
-      Node *current = m->table[i];
-      while (current) { // Iterate through each element at an index, adding it to newTable
-        int idx = current->key->hash(current->key) % newLen; // Index of element in newTable
-        Node *node = malloc(sizeof(Node));
-        node->key = current->key;
-        node->val = current->val;
-        node->next = NULL;
-        if (newTable[idx] == NULL) {
-          newTable[idx] = node;
-        } else {
-          node->next = newTable[idx];
-          newTable[idx] = node;
-        }
-        // Free the old node in original Map
-        Node *oldNode = current;
-        current = current->next;
-        free(oldNode);
-      }
+/**
+   Helper method to find the bucket that would hold a key with the
+   given hash. While the map is growing, this is in the old table if
+   that bucket hasn't been moved yet.
+
+   @param m the Map to look in
+   @param h hash of the key
+   @return pointer to the head of the bucket's list
+ */
+static Node **bucket(Map *m, unsigned int h)
+{
+  if (m->oldTable) {
+    int oldIdx = h % m->oldLen;
+    if (oldIdx >= m->migrateIdx) {
+      return &m->oldTable[oldIdx];
     }
   }
+  return &m->table[h % m->tlen];
+}
 
-  // Make change the reference of the original map to be the new table
-  Node **oldTable = m->table;
-  m->table = newTable;
-  m->tlen = newLen;
+/**
+   Helper method to estimate the memory taken up by a key or value. An
+   interned Text is shared by every pair that holds its string, so only
+   its header is charged to each of them.
 
-  // Free the memory associated with the old table
-  free(oldTable);
+   @param v the key or value
+   @return number of bytes it takes up
+ */
+static long vtypeBytes(VType const *v)
+{
+  if (isText(v)) {
+    int len = textLength(v);
+    bool shared = ((Text const *) v)->interned;
+    return sizeof(Text) + (len > TEXT_INLINE && !shared ? len + 1 : 0);
+  }
+  if (isInteger(v)) {
+    return sizeof(Integer);
+  }
+  return sizeof(VType);
 }
 
-void mapSet(Map *m, VType *key, VType *val) {
+/**
+   Helper method to estimate the memory a pair takes up in a bounded map.
+
+   @param m the Map the node is in
+   @param n the node holding the pair
+   @return number of bytes for the node, its key and its value
+ */
+static long pairBytes(Map *m, Node const *n)
+{
+  return m->nodeSize + vtypeBytes(n->key) + vtypeBytes(n->val);
+}
+
+/**
+   Helper method to take a node out of a bounded map's recency list.
+
+   @param m the Map the node is in
+   @param c the node to unlink
+ */
+static void unlinkRecent(Map *m, CacheNode *c)
+{
+  if (c->newer) {
+    c->newer->older = c->older;
+  } else {
+    m->newest = c->older;
+  }
+  if (c->older) {
+    c->older->newer = c->newer;
+  } else {
+    m->oldest = c->newer;
+  }
+}
+
+/**
+   Helper method to put a node at the front of a bounded map's recency
+   list, as the most recently used.
+
+   @param m the Map the node is in
+   @param c the node to add
+ */
+static void pushRecent(Map *m, CacheNode *c)
+{
+  c->newer = NULL;
+  c->older = m->newest;
+  if (m->newest) {
+    m->newest->newer = c;
+  } else {
+    m->oldest = c;
+  }
+  m->newest = c;
+}
+
+/**
+   Helper method to mark a node of a bounded map as just used.
+
+   @param m the Map the node is in
+   @param n the node that was used
+ */
+static void touch(Map *m, Node *n)
+{
+  CacheNode *c = (CacheNode *) n;
+  if (m->newest != c) {
+    unlinkRecent(m, c);
+    pushRecent(m, c);
+  }
+}
+
+/**
+   Helper method to find the Timer in a node of an expiring map.
+
+   @param m the Map the node is in
+   @param n the node
+   @return pointer to the node's Timer
+ */
+static Timer *timerOf(Map *m, Node *n)
+{
+  return (Timer *) ((char *) n + m->timerOff);
+}
+
+/**
+   Helper method to find the node a Timer is in.
+
+   @param m the Map the node is in
+   @param t the node's Timer
+   @return pointer to the node
+ */
+static Node *timerNode(Map *m, Timer *t)
+{
+  return (Node *) ((char *) t - m->timerOff);
+}
+
+/**
+   Helper method to check whether a pair's time to live has run out.
+
+   @param m the Map the node is in
+   @param n the node holding the pair
+   @param now the current time, from nowMillis
+   @return true if the pair has expired
+ */
+static bool isExpired(Map *m, Node *n, long now)
+{
+  if (!m->wheel) {
+    return false;
+  }
+  Timer *t = timerOf(m, n);
+  return t->pprev && t->expires <= now;
+}
+
+/**
+   Helper method to free a node that's been unlinked from its bucket,
+   along with its key and value, taking it out of the recency list and
+   the timer wheel first.
+
+   @param m the Map the node was in
+   @param n the node to free
+ */
+static void releaseNode(Map *m, Node *n)
+{
+  if (m->bounded) {
+    unlinkRecent(m, (CacheNode *) n);
+    m->bytes -= pairBytes(m, n);
+  }
+  if (m->wheel) {
+    wheelRemove(m->wheel, timerOf(m, n));
+  }
+  n->key->destroy(n->key);
+  n->val->destroy(n->val);
+  slabFree(m->nodes, n);
+  m->size--;
+}
+
+/**
+   Helper method to remove a node the map chose to drop, by eviction or
+   expiry, from the index and its bucket, and free it.
+
+   @param m the Map the node is in
+   @param n the node to drop
+ */
+static void dropNode(Map *m, Node *n)
+{
+  if (m->index) {
+    orderIndexRemove(m->index, n->key);
+  }
+
+  // The node is still in the bucket its hash leads to
+  Node **link = bucket(m, n->hash);
+  while (*link != n) {
+    link = &(*link)->next;
+  }
+  *link = n->next;
+  releaseNode(m, n);
+}
+
+/**
+   Helper method to evict the least recently used pairs from a bounded
+   map until it's within its limits, always keeping the newest pair.
+
+   @param m the Map to evict from
+ */
+static void evict(Map *m)
+{
+  while (m->size > 1 && ((m->maxEntries && m->size > m->maxEntries) ||
+                         (m->maxBytes && m->bytes > m->maxBytes))) {
+    dropNode(m, &m->oldest->node);
+    m->evictions++;
+  }
+}
+
+/**
+   Helper method to remove up to count pairs whose time to live has run
+   out from an expiring map. The timer wheel finds them without looking
+   at any other pairs.
+
+   @param m the Map to remove pairs from
+   @param count most pairs to remove
+   @return the current time, from nowMillis
+ */
+static long expireDue(Map *m, int count)
+{
+  long now = nowMillis();
+  Timer *t;
+  while (count-- > 0 && (t = wheelPop(m->wheel, now))) {
+    dropNode(m, timerNode(m, t));
+    m->expirations++;
+  }
+  return now;
+}
+
+/**
+   Helper method to do a step of expiry work before an operation on the
+   map. Maps without an armed timer skip it, and don't read the clock.
+
+   @param m the Map about to be used
+   @return the current time, or 0 if no pair in m can expire
+ */
+static long expireStep(Map *m)
+{
+  if (!m->wheel || wheelCount(m->wheel) == 0) {
+    return 0;
+  }
+  return expireDue(m, EXPIRE_STEP);
+}
+
+/**
+   Helper method to add a pair to the chained table, or replace the
+   value of a key that's already there.
+
+   @param m the Map to add to
+   @param key the key of the pair
+   @param val the value of the pair
+   @return the node holding the pair
+ */
+static Node *setNode(Map *m, VType *key, VType *val)
+{
   if (m->size >= m->tlen) {
     expandMap(m);
   }
-  int idx = key->hash(key) % m->tlen;
-  Node *current = m->table[idx];
+  migrate(m, MIGRATE_BUCKETS);
+  COUNT(m, sets, 1);
+
+  unsigned int h = keyHash(m, key);
+  Node **head = bucket(m, h);
+  Node *current = *head;
   while (current) { // Check if item is in list and replace it
-    if (current->key->equals(current->key, key)) {
+    COUNT(m, setProbes, 1);
+    if (current->hash == h && current->key->equals(current->key, key)) {
+      if (m->bounded) {
+        m->bytes += vtypeBytes(val) - vtypeBytes(current->val);
+        touch(m, current);
+      }
       current->val->destroy(current->val);
       current->val = val;
       key->destroy(key);
-      return;
+      if (m->bounded) {
+        evict(m);
+      }
+      return current;
     }
     current = current->next;
   }
-  Node *node = malloc(sizeof(Node)); // Allocate a new node to add
+  Node *node = slabAlloc(m->nodes); // Allocate a new node to add
   node->key = key;
   node->val = val;
-  node->next = NULL;
-  if (m->table[idx] == NULL) { // If the hashed index is empty
-    m->table[idx] = node;
-  } else { // Hashed index is not empty, add to the beginning of a linked list
-    node->next = m->table[idx];
-    m->table[idx] = node;
-  }
+  node->hash = h;
+  node->next = *head; // Add to the beginning of the linked list
+  *head = node;
   m->size++;
+
+  if (m->bounded) {
+    m->bytes += pairBytes(m, node);
+    pushRecent(m, (CacheNode *) node);
+    evict(m);
+  }
+  if (m->wheel) {
+    timerOf(m, node)->pprev = NULL;
+  }
+  return node;
+}
+
+void mapSet(Map *m, VType *key, VType *val) {
+  expireStep(m);
+
+  // The index keeps the key already there, as the table does
+  if (m->index) {
+    orderIndexSet(m->index, key, val);
+  }
+  if (m->open) {
+    openMapSet(m->open, key, val, keyHash(m, key));
+    return;
+  }
+  if (m->hamt) {
+    COUNT(m, sets, 1);
+    hamtSet(m->hamt, key, val, keyHash(m, key));
+    return;
+  }
+
+  Node *n = setNode(m, key, val);
+
+  // A plain set keeps the pair until it's removed
+  if (m->wheel) {
+    wheelRemove(m->wheel, timerOf(m, n));
+  }
+}
+
+bool mapSetTTL(Map *m, VType *key, VType *val, long millis)
+{
+  if (!m->wheel) {
+    mapSet(m, key, val);
+    return false;
+  }
+  long now = expireDue(m, EXPIRE_STEP);
+  if (m->index) {
+    orderIndexSet(m->index, key, val);
+  }
+
+  Timer *t = timerOf(m, setNode(m, key, val));
+  wheelRemove(m->wheel, t);
+  wheelAdd(m->wheel, t, millis < LONG_MAX - now ? now + millis : LONG_MAX);
+  return true;
+}
+
+/** A block of pairs being added by mapSetMany, shared by its threads. */
+typedef struct {
+  /** Map the pairs are added to. */
+  Map *m;
+
+  /** Keys and values of the pairs in this block. */
+  VType **keys, **vals;
+
+  /** Number of pairs in this block. */
+  int n;
+
+  /** Number of threads, which is also the number of bucket ranges. */
+  int threads;
+
+  /** Hash of each key. */
+  unsigned int *hashes;
+
+  /** Indexes of the pairs, grouped by bucket range and otherwise in
+      their original order. */
+  int *order;
+
+  /** Number of pairs each thread hashed for each bucket range, turned
+      into the position in order where each thread's pairs for each
+      range go. Element [ t * threads + r ] is for thread t, range r. */
+  int *counts;
+
+  /** Start of each bucket range's pairs in order, with an extra element
+      marking the end. */
+  int *starts;
+
+  /** A node for each pair, allocated in advance. */
+  Node **nodes;
+
+  /** For each pair whose key was already in the map, the value it
+      replaced, otherwise NULL. */
+  VType **olds;
+
+  /** Number of new keys linked into the table by each thread. */
+  int *added;
+} SetManyJob;
+
+/** One thread's part of a SetManyJob. */
+typedef struct {
+  /** The job being worked on. */
+  SetManyJob *job;
+
+  /** Index of this thread, which picks its pairs and bucket range. */
+  int id;
+} SetManyPart;
+
+/**
+   Helper method to find which bucket range a hash falls in.
+
+   @param job the job the hash is for
+   @param h hash of a key
+   @return index of the bucket range
+ */
+static int bucketRange(SetManyJob *job, unsigned int h)
+{
+  return (long long) (h % job->m->tlen) * job->threads / job->m->tlen;
+}
+
+/**
+   Thread function that hashes this thread's share of the pairs and
+   counts how many fall in each bucket range.
+
+   @param arg the SetManyPart for this thread
+   @return NULL
+ */
+static void *hashPart(void *arg)
+{
+  SetManyPart *part = arg;
+  SetManyJob *job = part->job;
+  int *counts = job->counts + part->id * job->threads;
+  int lo = (long long) job->n * part->id / job->threads;
+  int hi = (long long) job->n * (part->id + 1) / job->threads;
+  if (job->m->seeded) {
+    hashVTypes(job->keys + lo, hi - lo, job->m->seed, job->hashes + lo);
+  } else {
+    for (int i = lo; i < hi; i++) {
+      job->hashes[i] = keyHash(job->m, job->keys[i]);
+    }
+  }
+  for (int i = lo; i < hi; i++) {
+    counts[bucketRange(job, job->hashes[i])]++;
+  }
+  return NULL;
+}
+
+/**
+   Thread function that copies the indexes of this thread's share of
+   the pairs into their places in order.
+
+   @param arg the SetManyPart for this thread
+   @return NULL
+ */
+static void *scatterPart(void *arg)
+{
+  SetManyPart *part = arg;
+  SetManyJob *job = part->job;
+  int *next = job->counts + part->id * job->threads;
+  int lo = (long long) job->n * part->id / job->threads;
+  int hi = (long long) job->n * (part->id + 1) / job->threads;
+  for (int i = lo; i < hi; i++) {
+    job->order[next[bucketRange(job, job->hashes[i])]++] = i;
+  }
+  return NULL;
+}
+
+/**
+   Thread function that links the pairs in this thread's bucket range
+   into the table. No other thread touches these buckets, so nothing
+   is locked. Replaced values are saved to be destroyed afterward, so
+   only the calling thread uses the allocator.
+
+   @param arg the SetManyPart for this thread
+   @return NULL
+ */
+static void *linkPart(void *arg)
+{
+  SetManyPart *part = arg;
+  SetManyJob *job = part->job;
+  Map *m = job->m;
+  int added = 0;
+  for (int j = job->starts[part->id]; j < job->starts[part->id + 1]; j++) {
+    int i = job->order[j];
+    unsigned int h = job->hashes[i];
+    Node **head = &m->table[h % m->tlen];
+    Node *current = *head;
+    while (current && (current->hash != h || !current->key->equals(current->key, job->keys[i]))) {
+      current = current->next;
+    }
+
+    if (current) {
+      job->olds[i] = current->val;
+      current->val = job->vals[i];
+    } else {
+      Node *node = job->nodes[i];
+      node->key = job->keys[i];
+      node->val = job->vals[i];
+      node->hash = h;
+      node->next = *head;
+      *head = node;
+      added++;
+    }
+  }
+  job->added[part->id] = added;
+  return NULL;
+}
+
+/**
+   Helper method to run one step of a SetManyJob on all of its
+   threads, using the calling thread as the first one and for any
+   part whose thread can't be started.
+
+   @param job the job to work on
+   @param step thread function for the step
+ */
+static void runStep(SetManyJob *job, void *(*step)(void *))
+{
+  pthread_t tid[SET_MANY_THREADS];
+  bool started[SET_MANY_THREADS];
+  SetManyPart parts[SET_MANY_THREADS];
+  for (int t = 0; t < job->threads; t++) {
+    parts[t] = (SetManyPart) { job, t };
+    started[t] = t > 0 && pthread_create(&tid[t], NULL, step, &parts[t]) == 0;
+  }
+
+  for (int t = 0; t < job->threads; t++) {
+    if (!started[t]) {
+      step(&parts[t]);
+    }
+  }
+  for (int t = 1; t < job->threads; t++) {
+    if (started[t]) {
+      pthread_join(tid[t], NULL);
+    }
+  }
+}
+
+/**
+   Helper method to add one block of pairs with mapSetMany.
+
+   @param job the job for the block, with its arrays allocated
+ */
+static void setBlock(SetManyJob *job)
+{
+  Map *m = job->m;
+  int threads = job->threads;
+
+  // Nodes come from the slab, which only one thread may use.
+  for (int i = 0; i < job->n; i++) {
+    job->nodes[i] = slabAlloc(m->nodes);
+    job->olds[i] = NULL;
+  }
+  memset(job->counts, 0, threads * threads * sizeof(int));
+  runStep(job, hashPart);
+
+  // Lay out order by bucket range, then by thread within each range, so
+  // pairs with the same key stay in their original order.
+  int pos = 0;
+  for (int r = 0; r < threads; r++) {
+    job->starts[r] = pos;
+    for (int t = 0; t < threads; t++) {
+      int count = job->counts[t * threads + r];
+      job->counts[t * threads + r] = pos;
+      pos += count;
+    }
+  }
+  job->starts[threads] = pos;
+  runStep(job, scatterPart);
+  runStep(job, linkPart);
+
+  // Clean up after the pairs that replaced a value.
+  for (int i = 0; i < job->n; i++) {
+    if (job->olds[i]) {
+      job->keys[i]->destroy(job->keys[i]);
+      job->olds[i]->destroy(job->olds[i]);
+      slabFree(m->nodes, job->nodes[i]);
+    }
+  }
+  for (int t = 0; t < threads; t++) {
+    m->size += job->added[t];
+  }
+}
+
+void mapSetMany( Map *m, VType **keys, VType **vals, int n, int threads )
+{
+  if ( threads <= 0 )
+    threads = sysconf( _SC_NPROCESSORS_ONLN );
+  if ( threads > SET_MANY_THREADS )
+    threads = SET_MANY_THREADS;
+
+  // The open table, the trie, the ordered index, the recency list and
+  // the timer wheel aren't split up by bucket.
+  if ( m->open || m->hamt || m->index || m->bounded || m->wheel || threads <= 1 ||
+       n < SET_MANY_SERIAL ) {
+    for ( int i = 0; i < n; i++ )
+      mapSet( m, keys[ i ], vals[ i ] );
+    return;
+  }
+  COUNT( m, sets, n );
+
+  // Make room for every pair now, and finish any resize in progress.
+  if ( m->size + n > m->tlen )
+    resizeMap( m, m->size + n );
+  migrate( m, m->oldLen - m->migrateIdx );
+
+  int block = n < SET_MANY_BLOCK ? n : SET_MANY_BLOCK;
+  SetManyJob job = { m };
+  job.threads = threads;
+  job.hashes = malloc( block * sizeof( unsigned int ) );
+  job.order = malloc( block * sizeof( int ) );
+  job.counts = malloc( threads * threads * sizeof( int ) );
+  job.starts = malloc( ( threads + 1 ) * sizeof( int ) );
+  job.nodes = malloc( block * sizeof( Node * ) );
+  job.olds = malloc( block * sizeof( VType * ) );
+  job.added = malloc( threads * sizeof( int ) );
+
+  for ( int i = 0; i < n; i += block ) {
+    job.keys = keys + i;
+    job.vals = vals + i;
+    job.n = n - i < block ? n - i : block;
+    setBlock( &job );
+  }
+
+  free( job.hashes );
+  free( job.order );
+  free( job.counts );
+  free( job.starts );
+  free( job.nodes );
+  free( job.olds );
+  free( job.added );
 }
 
 VType *mapGet( Map *m, VType *key )
 {
-  int idx = key->hash(key) % m->tlen; // Hashed index to find key at
-  Node *current = m->table[idx];
+  if ( m->open )
+    return openMapGet( m->open, key, keyHash( m, key ) );
+  if ( m->hamt ) {
+    COUNT( m, gets, 1 );
+    return hamtGet( m->hamt, key, keyHash( m, key ) );
+  }
+  long now = expireStep( m );
+  migrate( m, MIGRATE_BUCKETS );
+  COUNT( m, gets, 1 );
+
+  unsigned int h = keyHash( m, key );
+  Node *current = *bucket( m, h ); // Bucket to find key in
 
   while (current) { // Iterate through values in linked list, searching for key
-    if (current->key->equals(current->key, key)) {
+    COUNT(m, getProbes, 1);
+    if (current->hash == h && current->key->equals(current->key, key)) {
+      if (isExpired(m, current, now)) { // Reclaim it now instead of waiting
+        dropNode(m, current);
+        m->expirations++;
+        break;
+      }
+      if (m->bounded) {
+        m->hits++;
+        touch(m, current);
+      }
       return current->val;
     }
     current = current->next;
   }
+  if (m->bounded) {
+    m->misses++;
+  }
   return NULL;
 }
 
 bool mapRemove(Map *m, VType *key) {
-  Node **target = &( m->table[key->hash(key) % m->tlen] ); // Use pointer to pointer to remove
+  long now = expireStep(m);
 
-  while (*target && !(*target)->key->equals((*target)->key, key)) { // Until you reach key (or end of list)
+  // Unlink the key from the index before the table destroys it
+  if (m->index) {
+    orderIndexRemove(m->index, key);
+  }
+  if (m->open) {
+    return openMapRemove(m->open, key, keyHash(m, key));
+  }
+  if (m->hamt) {
+    COUNT(m, removes, 1);
+    return hamtRemove(m->hamt, key, keyHash(m, key));
+  }
+  migrate(m, MIGRATE_BUCKETS);
+  COUNT(m, removes, 1);
+
+  unsigned int h = keyHash(m, key);
+  Node **target = bucket(m, h); // Use pointer to pointer to remove
+
+  // Until you reach key (or end of list), checking the saved hash before calling equals
+  while (*target && ((*target)->hash != h || !(*target)->key->equals((*target)->key, key))) {
+    COUNT(m, removeProbes, 1);
     target = &(*target)->next;
   }
+  COUNT(m, removeProbes, *target != NULL);
 
   if (*target) { // If you found the key (value of target is not NULL), return it
+    // A pair that's expired is removed, but it was already gone
     Node *n = *target;
+    bool live = !isExpired(m, n, now);
+    if (!live) {
+      m->expirations++;
+    }
     *target = (*target)->next;
-    n->key->destroy(n->key);
-    n->val->destroy(n->val);
-    free(n);
-    m->size--;
-    return true;
+    releaseNode(m, n);
+
+    // Shrink a mostly empty table, but not while it's still resizing
+    if (!m->oldTable && m->size * SHRINK_LOAD < m->tlen && m->tlen > m->minLen) {
+      int len = m->tlen / CAP_MULTIPLIER;
+      resizeMap(m, len > m->minLen ? len : m->minLen);
+    }
+    return live;
   }
 
   return false;
 }
 
+int mapExpire( Map *m )
+{
+  if ( ! m->wheel || wheelCount( m->wheel ) == 0 )
+    return 0;
+  long before = m->expirations;
+  expireDue( m, INT_MAX );
+  return m->expirations - before;
+}
+
+Map *mapSnapshot( Map *m )
+{
+  if ( ! m->hamt )
+    return NULL;
+
+  // Everything else about a persistent map is just its hash settings.
+  Map *snap = (Map *) malloc( sizeof( Map ) );
+  *snap = *m;
+  snap->hamt = copyHamt( m->hamt );
+#ifdef MAP_STATS
+  snap->counters = (OpenMapCounters) { 0 };
+#endif
+  return snap;
+}
+
+void mapReserve( Map *m, int n )
+{
+  if ( m->open ) {
+    openMapReserve( m->open, n );
+    return;
+  }
+
+  // A trie has no table to size.
+  if ( m->hamt )
+    return;
+
+  // Rehash everything now, so the reservation doesn't slow down later
+  // operations.
+  if ( n > m->tlen )
+    resizeMap( m, n );
+  migrate( m, m->oldLen - m->migrateIdx );
+  if ( n > m->minLen )
+    m->minLen = n;
+}
+
+void mapShrinkToFit( Map *m )
+{
+  if ( m->open ) {
+    openMapShrinkToFit( m->open );
+    return;
+  }
+  if ( m->hamt )
+    return;
+
+  m->minLen = 1;
+  int len = m->size > 0 ? m->size : 1;
+  if ( len < m->tlen )
+    resizeMap( m, len );
+  migrate( m, m->oldLen - m->migrateIdx );
+}
+
+void mapForEach( Map *m,
+                 void (*visit)( VType const *key, VType const *val, void *arg ),
+                 void *arg )
+{
+  if ( m->open ) {
+    openMapForEach( m->open, visit, arg );
+    return;
+  }
+  if ( m->hamt ) {
+    hamtForEach( m->hamt, visit, arg );
+    return;
+  }
+
+  // Visit the nodes in both tables, in case the map is growing.
+  for (int t = 0; t < 2; t++) {
+    Node **table = t == 0 ? m->table : m->oldTable;
+    int len = t == 0 ? m->tlen : m->oldLen;
+    for (int i = 0; table && i < len; i++) {
+      for (Node *current = table[i]; current; current = current->next) {
+        visit(current->key, current->val, arg);
+      }
+    }
+  }
+}
+
+/**
+   Helper method to add a pair to an ordered index, for mapForEach.
+
+   @param key key of the pair
+   @param val value of the pair
+   @param arg the index to add to
+ */
+static void indexPair(VType const *key, VType const *val, void *arg)
+{
+  orderIndexSet((OrderIndex *) arg, (VType *) key, (VType *) val);
+}
+
+bool mapRange( Map *m, VType const *lo, VType const *hi,
+               void (*visit)( VType const *key, VType const *val, void *arg ),
+               void *arg )
+{
+  if ( m->hamt )
+    return false;
+
+  // Build the index on first use, so maps that never scan don't pay to
+  // keep it up to date.
+  if ( ! m->index ) {
+    m->index = makeOrderIndex();
+    mapForEach( m, indexPair, m->index );
+  }
+  orderIndexRange( m->index, lo, hi, visit, arg );
+  return true;
+}
+
+/**
+   Helper method to count the chain lengths in one of the tables.
+
+   @param table the table to count, may be NULL
+   @param len length of the table
+   @param chains histogram of chain lengths to add to
+ */
+static void countChains(Node **table, int len, int *chains)
+{
+  for (int i = 0; table && i < len; i++) {
+    int n = 0;
+    for (Node *current = table[i]; current; current = current->next) {
+      n++;
+    }
+    chains[n < MAP_STATS_CHAINS ? n : MAP_STATS_CHAINS - 1]++;
+  }
+}
+
+void mapStats( Map *m, MapStats *stats )
+{
+  *stats = (MapStats) { mapSize( m ), mapCapacity( m ) };
+  stats->loadFactor = stats->capacity ? (double) stats->size / stats->capacity : 0;
+
+  OpenMapCounters c;
+  if ( m->open ) {
+    stats->bytes = sizeof( Map ) + openMapHistogram( m->open, stats->chains, MAP_STATS_CHAINS );
+    openMapCounters( m->open, &c );
+  } else if ( m->hamt ) {
+    // Counts depths in the trie rather than chain lengths.
+    stats->bytes = sizeof( Map ) + hamtHistogram( m->hamt, stats->chains, MAP_STATS_CHAINS );
+#ifdef MAP_STATS
+    c = m->counters;
+#else
+    c = (OpenMapCounters) { 0 };
+#endif
+  } else {
+    // Buckets still in the old table are counted too, while it's growing
+    countChains( m->table, m->tlen, stats->chains );
+    countChains( m->oldTable, m->oldLen, stats->chains );
+    stats->bytes = sizeof( Map ) + ( m->tlen + m->oldLen ) * sizeof( Node * ) +
+      m->size * m->nodeSize;
+#ifdef MAP_STATS
+    c = m->counters;
+#else
+    c = (OpenMapCounters) { 0 };
+#endif
+  }
+
+  if ( m->index )
+    stats->bytes += orderIndexBytes( m->index );
+
+#ifdef MAP_STATS
+  stats->counted = true;
+#endif
+  stats->gets = c.gets;
+  stats->sets = c.sets;
+  stats->removes = c.removes;
+  stats->getProbes = c.getProbes;
+  stats->setProbes = c.setProbes;
+  stats->removeProbes = c.removeProbes;
+  stats->expansions = c.expansions;
+  stats->expandSeconds = c.expandSeconds;
+  stats->hits = m->hits;
+  stats->misses = m->misses;
+  stats->evictions = m->evictions;
+  stats->expirations = m->expirations;
+}
+
+/** State used while writing a snapshot. */
+typedef struct {
+  /** File the snapshot is written to. */
+  FILE *fp;
+
+  /** Set to false if anything couldn't be written. */
+  bool ok;
+} SaveState;
+
+/**
+   Helper function to write one key / value pair to a snapshot.
+
+   @param key the key to write
+   @param val the value to write
+   @param arg the SaveState for the snapshot
+ */
+static void saveEntry(VType const *key, VType const *val, void *arg)
+{
+  SaveState *state = arg;
+  if (state->ok) {
+    state->ok = writeVType(state->fp, key) && writeVType(state->fp, val);
+  }
+}
+
+/**
+   Helper function to write the times pairs expire to a snapshot, after
+   its entries: the number of pairs with a time to live, then the key
+   of each one and the wall-clock time it expires.
+
+   @param m the Map being saved, which must be expiring
+   @param state the SaveState for the snapshot
+ */
+static void saveExpiries(Map *m, SaveState *state)
+{
+  long offset = wallMillis() - nowMillis();
+  state->ok = state->ok && writeU64(state->fp, wheelCount(m->wheel));
+  for (int t = 0; t < 2; t++) {
+    Node **table = t == 0 ? m->table : m->oldTable;
+    int len = t == 0 ? m->tlen : m->oldLen;
+    for (int i = 0; state->ok && table && i < len; i++) {
+      for (Node *current = table[i]; state->ok && current; current = current->next) {
+        Timer *timer = timerOf(m, current);
+        if (timer->pprev) {
+          state->ok = writeVType(state->fp, current->key) &&
+            writeU64(state->fp, (uint64_t) (timer->expires + offset));
+        }
+      }
+    }
+  }
+}
+
+/**
+   Helper function to read the times pairs expire from the end of a
+   snapshot and give the pairs in the map their times to live again.
+   Pairs the map doesn't hold any more are skipped.
+
+   @param m the Map loaded from the snapshot, which must be expiring
+   @param pos start of the expiry times
+   @param end end of the snapshot
+   @return false if the expiry times are truncated or corrupt
+ */
+static bool loadExpiries(Map *m, unsigned char const *pos, unsigned char const *end)
+{
+  long now = nowMillis();
+  long offset = wallMillis() - now;
+  uint64_t count;
+  if (!readU64(&pos, end, &count)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t deadline;
+    VType *key = readVType(&pos, end);
+    if (!key || !readU64(&pos, end, &deadline)) {
+      if (key) {
+        key->destroy(key);
+      }
+      return false;
+    }
+
+    unsigned int h = keyHash(m, key);
+    Node *n = *bucket(m, h);
+    while (n && (n->hash != h || !n->key->equals(n->key, key))) {
+      n = n->next;
+    }
+    if (n) {
+      Timer *timer = timerOf(m, n);
+      wheelRemove(m->wheel, timer);
+      wheelAdd(m->wheel, timer, (long) deadline - offset);
+    }
+    key->destroy(key);
+  }
+  return true;
+}
+
+bool mapSave( Map *m, char const *fname )
+{
+  // Write to a temporary file, and rename it once it's all written.
+  char *tmp = malloc(strlen(fname) + sizeof(".tmp"));
+  strcpy(tmp, fname);
+  strcat(tmp, ".tmp");
+
+  SaveState state = { fopen(tmp, "wb"), true };
+  if (!state.fp) {
+    free(tmp);
+    return false;
+  }
+  setvbuf(state.fp, NULL, _IOFBF, SAVE_BUFFER);
+
+  // A header with the number of entries, then the entries themselves.
+  state.ok = fwrite(SNAPSHOT_MAGIC, 1, MAGIC_LEN, state.fp) == MAGIC_LEN &&
+    writeU64(state.fp, mapSize(m));
+  mapForEach(m, saveEntry, &state);
+
+  // Readers that don't know about times to live stop after the entries.
+  if (m->wheel) {
+    saveExpiries(m, &state);
+  }
+
+  // Make sure it's all on disk before it replaces the old snapshot.
+  state.ok = fflush(state.fp) == 0 && fsync(fileno(state.fp)) == 0 && state.ok;
+  state.ok = fclose(state.fp) == 0 && state.ok;
+  state.ok = state.ok && rename(tmp, fname) == 0;
+  if (!state.ok) {
+    remove(tmp);
+  }
+
+  free(tmp);
+  return state.ok;
+}
+
+Map *mapLoad( char const *fname, MapOptions const *opts )
+{
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < MAGIC_LEN) {
+    close(fd);
+    return NULL;
+  }
+
+  // Map the whole file into memory and decode entries straight from it.
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+  unsigned char const *pos = data;
+  unsigned char const *end = pos + st.st_size;
+  uint64_t count;
+  Map *m = NULL;
+  if (memcmp(pos, SNAPSHOT_MAGIC, MAGIC_LEN) == 0) {
+    pos += MAGIC_LEN;
+
+    // Each entry takes at least ten bytes, which bounds a sane count,
+    // and a map can't hold more than INT_MAX - 1 pairs.
+    if (readU64(&pos, end, &count) && count <= (uint64_t) (end - pos) / 10 &&
+        count < INT_MAX) {
+      m = makeMapWith(count + 1, opts);
+      for (uint64_t i = 0; m && i < count; i++) {
+        VType *key = readVType(&pos, end);
+        VType *val = key ? readVType(&pos, end) : NULL;
+        if (val) {
+          mapSet(m, key, val);
+        } else { // Truncated or corrupt file
+          if (key) {
+            key->destroy(key);
+          }
+          freeMap(m);
+          m = NULL;
+        }
+      }
+
+      // Expiry times follow the entries in a snapshot of an expiring map.
+      if (m && m->wheel && pos < end && !loadExpiries(m, pos, end)) {
+        freeMap(m);
+        m = NULL;
+      }
+    }
+  }
+
+  munmap(data, st.st_size);
+  return m;
+}
+
 void freeMap( Map *m )
 {
-  // Free each entry in the table and each key/value pair in the Nodes
-  for (int i = 0; i < m->tlen; i++) {
-    Node *current = m->table[i];
-    while (current) {
-      // Use destroy to free any allocated memory within the key/val
-      current->key->destroy(current->key);
-      current->val->destroy(current->val);
-      // Free the node itself and move to the next node
-      Node *node = current;
-      current = current->next;
-      free(node);
+  if ( m->index )
+    freeOrderIndex( m->index );
+  if ( m->wheel )
+    freeTimerWheel( m->wheel );
+  if ( m->open ) {
+    freeOpenMap( m->open );
+    free( m );
+    return;
+  }
+  if ( m->hamt ) {
+    freeHamt( m->hamt );
+    free( m );
+    return;
+  }
+
+  // Destroy the key/value pair in each Node of both tables
+  for (int t = 0; t < 2; t++) {
+    Node **table = t == 0 ? m->table : m->oldTable;
+    int len = t == 0 ? m->tlen : m->oldLen;
+    for (int i = 0; table && i < len; i++) {
+      for (Node *current = table[i]; current; current = current->next) {
+        // Use destroy to free any allocated memory within the key/val
+        current->key->destroy(current->key);
+        current->val->destroy(current->val);
+      }
     }
   }
 
-  // Free the table and map itself
+  // The nodes all live in the slab, so they're freed together with it
+  freeSlab(m->nodes);
+
+  // Free the tables and map itself
   free(m->table);
+  free(m->oldTable);
   free( m );
 }
@@ -4,7 +4,11 @@
     Header for the map component, a hash map. Provides
     the functions to define a Map, including makeMap,
     mapSize, mapSet, mapGet, mapRemove, and freeMap for
-    performing specied operations on the Map.
+    performing specied operations on the Map. The hash table
+    layout can be chosen when the Map is made, and the contents
+    can be saved to and loaded from a binary snapshot file. A map with
+    the persistent layout can also make a point-in-time snapshot of
+    itself in constant time with mapSnapshot.
 */
 
 #ifndef MAP_H
@@ -12,21 +16,155 @@
 
 #include "vtype.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 /** Incomplete type for the Map representation. */
 typedef struct MapStruct Map;
 
+/** Ways a Map can lay out its hash table. */
+typedef enum {
+  /** Separate chaining, with a list node for each key/value pair. */
+  MAP_CHAINED,
+
+  /** Open addressing, with key/value pairs stored inline in the table
+      and collisions resolved by Robin Hood probing. Faster for
+      lookup-heavy use. */
+  MAP_OPEN,
+
+  /** A persistent hash array mapped trie, whose nodes can be shared
+      between a map and its snapshots (see mapSnapshot). Somewhat slower
+      than the other layouts, and it can't keep an ordered index, have
+      limits or expire pairs; asking for any of those gives a chained
+      map instead. */
+  MAP_PERSISTENT
+} MapBackend;
+
+/** Ways a Map can hash its keys. */
+typedef enum {
+  /** Use each key's own hash function. */
+  MAP_HASH_VTYPE,
+
+  /** Use the seeded hash functions from the hash component: a
+      word-at-a-time hash for Text and a mixing hash for Integer. */
+  MAP_HASH_SEEDED
+} MapHash;
+
+/** Options for making a map. A zero-initialized MapOptions gives the
+    same map as makeMap. */
+typedef struct {
+  /** Layout to use for the hash table. */
+  MapBackend backend;
+
+  /** How keys are hashed. */
+  MapHash hash;
+
+  /** Seed for MAP_HASH_SEEDED, or zero to pick a random seed for the map. */
+  uint64_t seed;
+
+  /** True to keep an ordered index of the keys alongside the hash
+      table from the start. Otherwise, the index is built by the first
+      call to mapRange, and kept from then on. */
+  bool ordered;
+
+  /** Most key/value pairs the map may hold, or zero for no limit. A
+      map with a limit is a cache: once it's over the limit, mapSet
+      evicts the least recently used pairs, where both mapSet and
+      mapGet count as a use. A bounded map always uses the chained
+      backend. */
+  int maxEntries;
+
+  /** Most bytes the map's nodes, keys and values may take up, or zero
+      for no limit. Evicts the same way as maxEntries. The most recently
+      set pair is always kept, even if it's over the limit by itself.
+      The figure is an estimate from the sizes of the objects, without
+      allocator overhead. The characters of an interned Text are shared,
+      so they aren't charged to any pair; each pair holding it is only
+      charged for the Text object. */
+  long maxBytes;
+
+  /** True to let pairs be given a time to live with mapSetTTL. An
+      expiring map always uses the chained backend. */
+  bool expiring;
+} MapOptions;
+
+/** Number of entries in the chain length histogram of MapStats. */
+#define MAP_STATS_CHAINS 8
+
+/** Statistics about a map, filled in by mapStats. The operation
+    counters are only kept when map.c and openmap.c are compiled with
+    MAP_STATS defined (make STATS=-DMAP_STATS), so they cost nothing
+    otherwise; without it they're all zero and counted is false. */
+typedef struct {
+  /** Number of key/value pairs. */
+  int size;
+
+  /** Length of the hash table. */
+  int capacity;
+
+  /** Entries per bucket (or slot), or zero for a persistent map. */
+  double loadFactor;
+
+  /** For a chained map, chains[ i ] is the number of buckets holding i
+      entries. For an open map, it's the number of entries i slots away
+      from their home slot, and for a persistent map, the number of
+      entries i levels below the root. The last element counts
+      everything larger. */
+  int chains[ MAP_STATS_CHAINS ];
+
+  /** Bytes allocated for the table and nodes (not keys and values). */
+  long bytes;
+
+  /** True if the counters below were kept. */
+  bool counted;
+
+  /** Number of gets, sets and removes. */
+  long gets, sets, removes;
+
+  /** Total nodes (or slots) examined by gets, sets and removes. */
+  long getProbes, setProbes, removeProbes;
+
+  /** Number of times the table grew. */
+  long expansions;
+
+  /** Time spent growing the table, in seconds. */
+  double expandSeconds;
+
+  /** For a bounded map (see MapOptions), the number of gets that found
+      their key, gets that didn't, and pairs evicted to stay within its
+      limits. These are always kept for a bounded map, and zero for any
+      other map. */
+  long hits, misses, evictions;
+
+  /** For an expiring map, the number of pairs removed because their
+      time to live ran out. */
+  long expirations;
+} MapStats;
+
 /** Make an empty map.
     @param len Initial length of the hash table.
     @return pointer to a new map.
 */
 Map *makeMap( int len );
 
+/** Make an empty map with the given options.
+    @param len Initial length of the hash table.
+    @param opts Options for the new map, or NULL for the defaults.
+    @return pointer to a new map.
+*/
+Map *makeMapWith( int len, MapOptions const *opts );
+
 /** Get the size of the given map.
     @param m Pointer to the map.
     @return Number of key/value pairs in the map. */
 int mapSize( Map *m );
 
+/** Get the length of the given map's hash table. This changes whenever
+    the table is resized. A persistent map has no table, so this is
+    zero.
+    @param m Pointer to the map.
+    @return Number of buckets (or slots) in the map's table. */
+int mapCapacity( Map *m );
+
 /**
    Adds the given key/value pair to the given map. If
    the key is already in the map, it replaces its value
@@ -37,8 +175,40 @@ int mapSize( Map *m );
  */
 void mapSet(Map *m, VType *key, VType *val);
 
+/** Add a key/value pair to the map, like mapSet, but have it expire
+    the given number of milliseconds from now. An expired pair is never
+    returned by mapGet. It's removed when it's next looked up, or by the
+    map's timer wheel, which removes a few of the pairs that have come
+    due at each operation on the map. Setting the key again with mapSet
+    keeps it until it's removed.
+    @param m Map to add to, which must have been made with expiring set.
+    @param key Key of the value to add to Map.
+    @param val Value to add to the Map.
+    @param millis Milliseconds until the pair expires.
+    @return false if the map isn't an expiring map, in which case the
+    pair is added without a time to live.
+*/
+bool mapSetTTL( Map *m, VType *key, VType *val, long millis );
+
+/** Add many key/value pairs to the map, with the same result as
+    calling mapSet for each pair in order. The table is sized for all
+    the pairs up front, then keys are hashed and linked into the table
+    by several threads at once, each working on its own range of
+    buckets. Maps with the open backend, an ordered index, limits or
+    expiring pairs add the pairs one at a time instead.
+    @param m Map to add to.
+    @param keys Keys to add. The map takes ownership of each one.
+    @param vals Values to add, one for each key. The map takes ownership
+    of each one.
+    @param n Number of pairs.
+    @param threads Number of threads to use, or zero for one per CPU.
+*/
+void mapSetMany( Map *m, VType **keys, VType **vals, int n, int threads );
+
 /** Return the value associated with the given key. The returned VType
-    is still owned by the map.
+    is still owned by the map. In a bounded map, this makes the pair the
+    most recently used, so a bounded map can't be read by several
+    threads at once.
     @param m Map to query.
     @param k Key to look for in the map.
     @return Value associated with the given key, or NULL if the key
@@ -55,6 +225,101 @@ VType *mapGet( Map *m, VType *key );
  */
 bool mapRemove(Map *m, VType *key);
 
+/** Remove every pair whose time to live has run out. Pairs that have
+    expired but haven't been removed yet still count in mapSize and are
+    visited by mapForEach and mapRange, so call this first for an exact
+    view. Only the expired pairs are looked at, not the whole table.
+    @param m Map to remove pairs from.
+    @return number of pairs removed.
+*/
+int mapExpire( Map *m );
+
+/** Make a snapshot of the map as it is now, in constant time. The
+    snapshot is a map of its own that shares the persistent map's nodes,
+    and each of them copies a node before changing it, so changes to
+    one never show up in the other. The snapshot and the map can be
+    used by different threads at the same time, for example to save or
+    report on the snapshot while the map keeps changing. Values returned
+    by mapGet belong to every map that shares them, and stay valid
+    until the map they came from changes that key or is freed.
+    @param m Map to snapshot, which must use the MAP_PERSISTENT backend.
+    @return pointer to the snapshot, which must be freed with freeMap,
+    or NULL if the map isn't persistent.
+*/
+Map *mapSnapshot( Map *m );
+
+/** Make sure the map can hold at least n key/value pairs without its
+    table growing, rehashing the whole table now if needed, and keep
+    the table from shrinking below that size as pairs are removed. Use
+    this before a bulk load instead of letting the table double over
+    and over.
+    @param m Map to reserve space in.
+    @param n Number of key/value pairs to make room for.
+*/
+void mapReserve( Map *m, int n );
+
+/** Shrink the map's table to fit its current contents, and clear any
+    reservation so it can keep shrinking as pairs are removed. The table
+    also shrinks on its own when a remove leaves it mostly empty.
+    @param m Map to shrink.
+*/
+void mapShrinkToFit( Map *m );
+
+/** Get statistics about the map.
+    @param m Map to get statistics for.
+    @param stats Returns the statistics.
+*/
+void mapStats( Map *m, MapStats *stats );
+
+/** Call the given function for each key/value pair in the map, in no
+    particular order. The function must not change the map.
+    @param m Map to visit.
+    @param visit Function called with each key, its value and arg.
+    @param arg Extra argument passed to visit.
+*/
+void mapForEach( Map *m,
+                 void (*visit)( VType const *key, VType const *val, void *arg ),
+                 void *arg );
+
+/** Call the given function for each key from lo to hi (inclusive), in
+    key order, along with its value. Integer keys come before Text keys,
+    Integers are ordered by value and Texts byte by byte. Takes
+    O(log n + k) time for k keys visited. The function must not change
+    the map.
+    @param m Map to scan. If it wasn't made with ordered set, the first
+    scan builds its ordered index in O(n log n) time, and every change
+    after that keeps the index up to date.
+    @param lo Smallest key to visit, or NULL to start at the first key.
+    @param hi Largest key to visit, or NULL to continue to the last key.
+    @param visit Function called with each key, its value and arg.
+    @param arg Extra argument passed to visit.
+    @return false if the map is persistent, so it can't keep an index.
+*/
+bool mapRange( Map *m, VType const *lo, VType const *hi,
+               void (*visit)( VType const *key, VType const *val, void *arg ),
+               void *arg );
+
+/** Save the contents of a map to a binary snapshot file. The snapshot
+    is written to a temporary file that replaces fname once it's
+    complete, so an old snapshot is never left half overwritten. Keys
+    and values must be Integer or Text. For an expiring map, the time
+    each pair expires is saved too, and a pair loaded into an expiring
+    map keeps whatever time it has left.
+    @param m Map to save.
+    @param fname Name of the snapshot file.
+    @return true if the snapshot was saved successfully.
+*/
+bool mapSave( Map *m, char const *fname );
+
+/** Make a new map holding the contents of a snapshot file written by
+    mapSave. The map's table is sized for the whole snapshot up front.
+    @param fname Name of the snapshot file.
+    @param opts Options for the new map, or NULL for the defaults.
+    @return pointer to a new map, or NULL if the file can't be read,
+    isn't a valid snapshot, or holds more pairs than a map can.
+*/
+Map *mapLoad( char const *fname, MapOptions const *opts );
+
 /** Free all the memory used to store a map, including all the
     memory in its key/value pairs.
     @param m The map to free.
@@ -0,0 +1,401 @@
+/**
+    @file mapBench.c
+    @author Christopher Fields (cwfields)
+    Benchmark suite for the map component. Runs workloads with a
+    chosen mix of operations, key type and key distribution against a
+    map, and reports throughput, latency percentiles for each kind of
+    operation, how many times the table was resized, and peak memory
+    use. Each workload runs in its own process, so the memory reported
+    belongs to that workload alone.
+
+    Usage: mapBench [-n ops] [-k keys] [-w insert|read|mixed|all]
+                    [-t int|text|all] [-d uniform|zipf|all]
+                    [-b chained|open|persistent] [-h vtype|seeded] [-r]
+
+    With -r, the map reserves room for every key before it's filled.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "vtype.h"
+#include "integer.h"
+#include "text.h"
+#include "map.h"
+
+/** Default number of operations timed in each workload. */
+#define DEFAULT_OPS 1000000
+
+/** Default number of different keys. */
+#define DEFAULT_KEYS 100000
+
+/** Initial table length, the same as the driver uses. */
+#define MAP_CAPACITY 100
+
+/** Exponent for the Zipfian key distribution. */
+#define ZIPF_S 0.99
+
+/** Longest text key generated. */
+#define MAX_KEY 24
+
+/** Kinds of operation. */
+enum { OP_SET, OP_GET, OP_REMOVE, OP_KINDS };
+
+/** Names of the kinds of operation. */
+static char const *opNames[ OP_KINDS ] = { "set", "get", "remove" };
+
+/** A mix of operations, as percentages of set and get (the rest are removes). */
+typedef struct {
+  /** Name of the workload. */
+  char const *name;
+
+  /** Percentage of operations that are sets. */
+  int sets;
+
+  /** Percentage of operations that are gets. */
+  int gets;
+} Workload;
+
+/** The workloads that can be chosen. */
+static Workload const workloads[] = {
+  { "insert", 90, 10 },
+  { "read", 5, 95 },
+  { "mixed", 45, 45 },
+};
+
+/** Number of workloads. */
+#define WORKLOADS ( sizeof( workloads ) / sizeof( workloads[ 0 ] ) )
+
+/** Settings for one run. */
+typedef struct {
+  /** Number of operations to time. */
+  int ops;
+
+  /** Number of different keys. */
+  int keys;
+
+  /** Workload to run. */
+  Workload const *work;
+
+  /** True for Text keys, false for Integer keys. */
+  bool text;
+
+  /** True for Zipfian key choice, false for uniform. */
+  bool zipf;
+
+  /** Options for the map. */
+  MapOptions opts;
+
+  /** True to reserve room for every key up front. */
+  bool reserve;
+} Settings;
+
+/** Latencies of one kind of operation, in nanoseconds. */
+typedef struct {
+  /** Array of latencies. */
+  long *ns;
+
+  /** Number of latencies recorded. */
+  int count;
+} Latencies;
+
+/**
+   Get the current time in nanoseconds.
+   @return nanoseconds since some fixed point.
+ */
+static long nowNs( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+   Small, fast random number generator (xorshift).
+   @param state Generator state, updated on each call.
+   @return the next random value.
+ */
+static unsigned int nextRandom( unsigned int *state )
+{
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+   Make the cumulative distribution for choosing keys with a Zipfian
+   distribution, so key i is chosen in proportion to 1 / (i + 1)^s.
+   @param keys Number of keys.
+   @return array of keys cumulative probabilities.
+ */
+static double *makeZipf( int keys )
+{
+  double *cdf = (double *) malloc( keys * sizeof( double ) );
+  double sum = 0;
+  for ( int i = 0; i < keys; i++ ) {
+    sum += 1.0 / pow( i + 1, ZIPF_S );
+    cdf[ i ] = sum;
+  }
+  for ( int i = 0; i < keys; i++ )
+    cdf[ i ] /= sum;
+  return cdf;
+}
+
+/**
+   Choose a key.
+   @param s Settings for the run.
+   @param cdf Zipfian distribution, or NULL for uniform.
+   @param state Random number generator state.
+   @return index of the chosen key.
+ */
+static int chooseKey( Settings const *s, double const *cdf, unsigned int *state )
+{
+  if ( ! cdf )
+    return nextRandom( state ) % s->keys;
+
+  // Binary search for the first key whose cumulative probability is
+  // at least a random number in [0, 1).
+  double u = nextRandom( state ) / 4294967296.0;
+  int lo = 0, hi = s->keys - 1;
+  while ( lo < hi ) {
+    int mid = ( lo + hi ) / 2;
+    if ( cdf[ mid ] < u )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+   Make the key with the given index.
+   @param s Settings for the run.
+   @param i Index of the key.
+   @return a new key.
+ */
+static VType *makeKey( Settings const *s, int i )
+{
+  if ( ! s->text )
+    return makeInteger( i );
+
+  char buf[ MAX_KEY ];
+  int len = snprintf( buf, sizeof( buf ), "key%d", i );
+  return makeText( buf, len );
+}
+
+/**
+   Compare two longs, for qsort.
+   @param a Pointer to the first long.
+   @param b Pointer to the second long.
+   @return negative, zero or positive as a is less, equal or greater.
+ */
+static int compareLong( void const *a, void const *b )
+{
+  long x = *(long const *) a;
+  long y = *(long const *) b;
+  return ( x > y ) - ( x < y );
+}
+
+/**
+   Get a percentile from a sorted array of latencies.
+   @param lat Sorted latencies.
+   @param p Percentile, between 0 and 1.
+   @return the latency at that percentile.
+ */
+static long percentile( Latencies const *lat, double p )
+{
+  if ( lat->count == 0 )
+    return 0;
+  int idx = (int) ( p * ( lat->count - 1 ) + 0.5 );
+  return lat->ns[ idx ];
+}
+
+/**
+   Run one workload and print its results. Runs in a child process.
+   @param s Settings for the run.
+ */
+static void runWorkload( Settings const *s )
+{
+  double *cdf = s->zipf ? makeZipf( s->keys ) : NULL;
+  Latencies lat[ OP_KINDS ];
+  for ( int k = 0; k < OP_KINDS; k++ ) {
+    lat[ k ].ns = (long *) malloc( s->ops * sizeof( long ) );
+    lat[ k ].count = 0;
+  }
+
+  // Start with half the keys in the map.
+  Map *map = makeMapWith( MAP_CAPACITY, &s->opts );
+  if ( s->reserve )
+    mapReserve( map, s->keys );
+  int resizes = 0;
+  int cap = mapCapacity( map );
+  for ( int i = 0; i < s->keys; i += 2 ) {
+    mapSet( map, makeKey( s, i ), makeInteger( i ) );
+    if ( mapCapacity( map ) != cap ) {
+      cap = mapCapacity( map );
+      resizes++;
+    }
+  }
+
+  unsigned int state = 2463534242u;
+  long total = 0;
+  for ( int i = 0; i < s->ops; i++ ) {
+    int op = nextRandom( &state ) % 100;
+    op = op < s->work->sets ? OP_SET : op < s->work->sets + s->work->gets ? OP_GET : OP_REMOVE;
+    VType *key = makeKey( s, chooseKey( s, cdf, &state ) );
+
+    long start, end;
+    if ( op == OP_SET ) {
+      VType *val = makeInteger( i );
+      start = nowNs();
+      mapSet( map, key, val );
+      end = nowNs();
+    } else {
+      start = nowNs();
+      if ( op == OP_GET )
+        mapGet( map, key );
+      else
+        mapRemove( map, key );
+      end = nowNs();
+      key->destroy( key );
+    }
+
+    lat[ op ].ns[ lat[ op ].count++ ] = end - start;
+    total += end - start;
+    if ( mapCapacity( map ) != cap ) {
+      cap = mapCapacity( map );
+      resizes++;
+    }
+  }
+
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+
+  printf( "%-7s %-5s %-8s %12.0f %8d %8ld", s->work->name, s->text ? "text" : "int",
+          s->zipf ? "zipf" : "uniform", s->ops / ( total / 1e9 ), resizes,
+          usage.ru_maxrss );
+  for ( int k = 0; k < OP_KINDS; k++ ) {
+    qsort( lat[ k ].ns, lat[ k ].count, sizeof( long ), compareLong );
+    printf( "  %s %ld/%ld/%ld", opNames[ k ], percentile( &lat[ k ], 0.5 ),
+            percentile( &lat[ k ], 0.99 ), percentile( &lat[ k ], 0.999 ) );
+    free( lat[ k ].ns );
+  }
+  printf( "\n" );
+
+  freeMap( map );
+  free( cdf );
+}
+
+/**
+   Print the usage message and exit.
+ */
+static void usage( void )
+{
+  fprintf( stderr, "usage: mapBench [-n ops] [-k keys] [-w insert|read|mixed|all]\n"
+           "                [-t int|text|all] [-d uniform|zipf|all]\n"
+           "                [-b chained|open|persistent] [-h vtype|seeded] [-r]\n" );
+  exit( EXIT_FAILURE );
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  Settings s = { DEFAULT_OPS, DEFAULT_KEYS };
+  char const *work = "all", *type = "all", *dist = "all";
+
+  int opt;
+  while ( ( opt = getopt( argc, argv, "n:k:w:t:d:b:h:r" ) ) != -1 ) {
+    switch ( opt ) {
+    case 'n':
+      s.ops = atoi( optarg );
+      break;
+    case 'k':
+      s.keys = atoi( optarg );
+      break;
+    case 'w':
+      work = optarg;
+      break;
+    case 't':
+      type = optarg;
+      break;
+    case 'd':
+      dist = optarg;
+      break;
+    case 'b':
+      if ( strcmp( optarg, "open" ) == 0 )
+        s.opts.backend = MAP_OPEN;
+      else if ( strcmp( optarg, "persistent" ) == 0 )
+        s.opts.backend = MAP_PERSISTENT;
+      else if ( strcmp( optarg, "chained" ) != 0 )
+        usage();
+      break;
+    case 'h':
+      if ( strcmp( optarg, "seeded" ) == 0 )
+        s.opts.hash = MAP_HASH_SEEDED;
+      else if ( strcmp( optarg, "vtype" ) != 0 )
+        usage();
+      break;
+    case 'r':
+      s.reserve = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if ( s.ops < 1 || s.keys < 1 )
+    usage();
+
+  printf( "%d ops, %d keys, %s table, %s hash%s\n", s.ops, s.keys,
+          s.opts.backend == MAP_OPEN ? "open" :
+          s.opts.backend == MAP_PERSISTENT ? "persistent" : "chained",
+          s.opts.hash == MAP_HASH_SEEDED ? "seeded" : "vtype",
+          s.reserve ? ", reserved" : "" );
+  printf( "%-7s %-5s %-8s %12s %8s %8s  latency p50/p99/p999 (ns)\n",
+          "work", "keys", "dist", "ops/sec", "resizes", "rss(KB)" );
+  fflush( stdout );
+
+  bool matched = false;
+  for ( int w = 0; w < (int) WORKLOADS; w++ ) {
+    if ( strcmp( work, "all" ) != 0 && strcmp( work, workloads[ w ].name ) != 0 )
+      continue;
+    for ( int t = 0; t < 2; t++ ) {
+      if ( strcmp( type, "all" ) != 0 && strcmp( type, t ? "text" : "int" ) != 0 )
+        continue;
+      for ( int d = 0; d < 2; d++ ) {
+        if ( strcmp( dist, "all" ) != 0 && strcmp( dist, d ? "zipf" : "uniform" ) != 0 )
+          continue;
+
+        // Run each workload in its own process to measure its memory.
+        matched = true;
+        s.work = &workloads[ w ];
+        s.text = t;
+        s.zipf = d;
+        pid_t pid = fork();
+        if ( pid == 0 ) {
+          runWorkload( &s );
+          exit( EXIT_SUCCESS );
+        }
+        waitpid( pid, NULL, 0 );
+      }
+    }
+  }
+
+  if ( ! matched )
+    usage();
+  return EXIT_SUCCESS;
+}
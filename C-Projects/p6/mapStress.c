@@ -0,0 +1,207 @@
+/**
+    @file mapStress.c
+    @author Christopher Fields (cwfields)
+    Multi-threaded stress test and benchmark for the concurrent map.
+    First has several threads fill and partly empty a map at once and
+    checks the result, then measures throughput of a mixed get/set
+    workload with increasing numbers of threads.
+
+    Usage: mapStress [threads [ops [keys [read-percent [shards]]]]]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "vtype.h"
+#include "integer.h"
+#include "concurrentMap.h"
+
+/** Default number of threads to use. */
+#define DEFAULT_THREADS 8
+
+/** Default number of operations each thread performs. */
+#define DEFAULT_OPS 1000000
+
+/** Default number of different keys used. */
+#define DEFAULT_KEYS 100000
+
+/** Default percentage of operations that are lookups. */
+#define DEFAULT_READS 90
+
+/** Default number of shards in the map. */
+#define DEFAULT_SHARDS 64
+
+/** Work for one thread. */
+typedef struct {
+  /** Map all the threads share. */
+  ConcurrentMap *map;
+
+  /** Index of this thread. */
+  int id;
+
+  /** Number of threads in this run. */
+  int threads;
+
+  /** Number of operations to perform (or keys to insert). */
+  int ops;
+
+  /** Number of different keys. */
+  int keys;
+
+  /** Percentage of operations that are lookups. */
+  int reads;
+
+  /** Number of lookups that found their key. */
+  long hits;
+} Work;
+
+/**
+   Small, fast random number generator (xorshift) so the threads
+   don't contend for the C library's generator.
+   @param state Generator state, updated on each call.
+   @return the next random value.
+ */
+static unsigned int nextRandom( unsigned int *state )
+{
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+   Visitor that copies an Integer value out of the map.
+   @param val Value found in the map.
+   @param arg Pointer to the int to copy it into.
+ */
+static void copyInteger( VType const *val, void *arg )
+{
+  *(int *) arg = ( (Integer const *) val )->val;
+}
+
+/**
+   Thread that inserts every key this thread is responsible for, mapping
+   k to 2k, then removes the ones that are multiples of three.
+   @param arg Work for this thread.
+   @return NULL
+ */
+static void *fillThread( void *arg )
+{
+  Work *w = (Work *) arg;
+  for ( int k = w->id; k < w->keys; k += w->threads )
+    cmapSet( w->map, makeInteger( k ), makeInteger( 2 * k ) );
+
+  for ( int k = w->id; k < w->keys; k += w->threads ) {
+    if ( k % 3 == 0 ) {
+      VType *key = makeInteger( k );
+      assert( cmapRemove( w->map, key ) );
+      key->destroy( key );
+    }
+  }
+  return NULL;
+}
+
+/**
+   Thread that performs a random mix of lookups and updates.
+   @param arg Work for this thread.
+   @return NULL
+ */
+static void *mixedThread( void *arg )
+{
+  Work *w = (Work *) arg;
+  unsigned int state = 2463534242u + w->id;
+  for ( int i = 0; i < w->ops; i++ ) {
+    int k = nextRandom( &state ) % w->keys;
+    if ( (int) ( nextRandom( &state ) % 100 ) < w->reads ) {
+      VType *key = makeInteger( k );
+      if ( cmapGet( w->map, key, NULL, NULL ) )
+        w->hits++;
+      key->destroy( key );
+    } else
+      cmapSet( w->map, makeInteger( k ), makeInteger( i ) );
+  }
+  return NULL;
+}
+
+/**
+   Run the given function on a number of threads and wait for them all.
+   @param fn Function for each thread to run.
+   @param work Array of work, one element for each thread.
+   @param threads Number of threads to start.
+   @return elapsed time in seconds.
+ */
+static double runThreads( void *(*fn)( void * ), Work *work, int threads )
+{
+  struct timespec start, end;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+
+  pthread_t *tid = (pthread_t *) malloc( threads * sizeof( pthread_t ) );
+  for ( int i = 0; i < threads; i++ )
+    pthread_create( &tid[ i ], NULL, fn, &work[ i ] );
+  for ( int i = 0; i < threads; i++ )
+    pthread_join( tid[ i ], NULL );
+  free( tid );
+
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  return ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) / 1e9;
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  int threads = argc > 1 ? atoi( argv[ 1 ] ) : DEFAULT_THREADS;
+  int ops = argc > 2 ? atoi( argv[ 2 ] ) : DEFAULT_OPS;
+  int keys = argc > 3 ? atoi( argv[ 3 ] ) : DEFAULT_KEYS;
+  int reads = argc > 4 ? atoi( argv[ 4 ] ) : DEFAULT_READS;
+  int shards = argc > 5 ? atoi( argv[ 5 ] ) : DEFAULT_SHARDS;
+  if ( threads < 1 || ops < 1 || keys < 1 || reads < 0 || reads > 100 || shards < 1 ) {
+    fprintf( stderr, "usage: mapStress [threads [ops [keys [read-percent [shards]]]]]\n" );
+    return EXIT_FAILURE;
+  }
+
+  Work *work = (Work *) malloc( threads * sizeof( Work ) );
+
+  // Fill the map from all the threads at once and check the result.
+  ConcurrentMap *map = makeConcurrentMap( 16, shards, NULL );
+  for ( int i = 0; i < threads; i++ )
+    work[ i ] = (Work) { map, i, threads, ops, keys, reads, 0 };
+  runThreads( fillThread, work, threads );
+
+  assert( cmapSize( map ) == keys - ( keys + 2 ) / 3 );
+  for ( int k = 0; k < keys; k++ ) {
+    VType *key = makeInteger( k );
+    int val = -1;
+    bool found = cmapGet( map, key, copyInteger, &val );
+    assert( found == ( k % 3 != 0 ) );
+    assert( ! found || val == 2 * k );
+    key->destroy( key );
+  }
+  printf( "Concurrent fill of %d keys with %d threads: OK\n", keys, threads );
+
+  // Measure throughput of the mixed workload with more and more threads.
+  printf( "%d%% reads, %d keys, %d shards\n", reads, keys, shards );
+  printf( "%8s %14s\n", "threads", "ops/sec" );
+  for ( int n = 1; ; n = n * 2 < threads ? n * 2 : threads ) {
+    for ( int i = 0; i < n; i++ )
+      work[ i ] = (Work) { map, i, n, ops, keys, reads, 0 };
+    double secs = runThreads( mixedThread, work, n );
+    printf( "%8d %14.0f\n", n, (double) n * ops / secs );
+    if ( n == threads )
+      break;
+  }
+
+  freeConcurrentMap( map );
+  free( work );
+  return EXIT_SUCCESS;
+}
@@ -1,15 +1,31 @@
 // Simple test program for the text component.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "vtype.h"
 #include "map.h"
 #include "integer.h"
+#include "text.h"
+#include "mapdef.h"
+#include "value.h"
+#include "intern.h"
 
-int main()
+// Map from int to int, with no boxing.
+MAP_DEFINE( IntMap, int, int, mapHashInt, mapEqualsInt )
+
+// Map from Value to Value, stored inline.
+MAP_DEFINE_OWNED( ValueMap, Value, Value, valueHash, valueEquals, valueDestroy, valueDestroy )
+
+/** Run the basic map checks on a map made with the given options.
+    @param opts Options to make the map with. */
+static void testMap( MapOptions const *opts )
 {
   // Make a few values we use below.
   VType *v5 = parseInteger( "5", NULL );
@@ -18,7 +34,7 @@ int main()
   VType *v20 = parseInteger( "20", NULL );
   
   // Make a map with 3 slots in its hash table.
-  Map *map = makeMap( 3 );
+  Map *map = makeMapWith( 3, opts );
   assert( mapSize( map ) == 0 );
 
   // Put a the entry 5 -> 10 in the map.
@@ -63,6 +79,763 @@ int main()
   v10->destroy( v10 );
   v15->destroy( v15 );
   v20->destroy( v20 );
+}
+
+/** Put enough keys in a map to make it grow several times, then
+    remove half of them and check what's left.
+    @param opts Options to make the map with. */
+static void testGrowth( MapOptions const *opts )
+{
+  Map *map = makeMapWith( 3, opts );
+  char buf[ 20 ];
+
+  // Key i maps to -i.
+  for ( int i = 0; i < 1000; i++ ) {
+    sprintf( buf, "%d", i * 1024 );
+    VType *k = parseInteger( buf, NULL );
+    sprintf( buf, "%d", -i );
+    mapSet( map, k, parseInteger( buf, NULL ) );
+  }
+  assert( mapSize( map ) == 1000 );
+
+  // Remove the even keys.
+  for ( int i = 0; i < 1000; i += 2 ) {
+    sprintf( buf, "%d", i * 1024 );
+    VType *k = parseInteger( buf, NULL );
+    assert( mapRemove( map, k ) );
+    k->destroy( k );
+  }
+  assert( mapSize( map ) == 500 );
+
+  // Odd keys should still have their values.
+  for ( int i = 0; i < 1000; i++ ) {
+    sprintf( buf, "%d", i * 1024 );
+    VType *k = parseInteger( buf, NULL );
+    VType *v = mapGet( map, k );
+    if ( i % 2 == 0 )
+      assert( v == NULL );
+    else {
+      sprintf( buf, "%d", -i );
+      VType *expected = parseInteger( buf, NULL );
+      assert( expected->equals( expected, v ) );
+      expected->destroy( expected );
+    }
+    k->destroy( k );
+  }
+
+  freeMap( map );
+}
+
+/** Remove the keys from lo up to (not including) hi from the map.
+    @param map Map to remove from.
+    @param lo First key to remove.
+    @param hi One past the last key to remove. */
+static void removeKeys( Map *map, int lo, int hi )
+{
+  for ( int i = lo; i < hi; i++ ) {
+    VType *k = makeInteger( i );
+    assert( mapRemove( map, k ) );
+    k->destroy( k );
+  }
+}
+
+/** Check reserving space in a map and shrinking it.
+    @param opts Options to make the map with. */
+static void testReserve( MapOptions const *opts )
+{
+  // A reserved map doesn't grow while it's filled.
+  Map *map = makeMapWith( 10, opts );
+  mapReserve( map, 1000 );
+  int cap = mapCapacity( map );
+  assert( cap >= 1000 );
+  for ( int i = 0; i < 1000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+  assert( mapCapacity( map ) == cap );
+
+  // Or shrink below the reservation when it's emptied.
+  removeKeys( map, 10, 1000 );
+  assert( mapCapacity( map ) == cap );
+
+  // Until it's asked to.
+  mapShrinkToFit( map );
+  assert( mapCapacity( map ) < 100 );
+  assert( mapSize( map ) == 10 );
+  for ( int i = 0; i < 10; i++ ) {
+    VType *k = makeInteger( i );
+    VType *v = mapGet( map, k );
+    assert( v && ( (Integer *) v )->val == i );
+    k->destroy( k );
+  }
+  freeMap( map );
+
+  // Without a reservation, a map shrinks as it's emptied.
+  map = makeMapWith( 10, opts );
+  for ( int i = 0; i < 10000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+  cap = mapCapacity( map );
+  removeKeys( map, 10, 10000 );
+  assert( mapSize( map ) == 10 );
+  assert( mapCapacity( map ) < cap / 100 );
+  for ( int i = 0; i < 10; i++ ) {
+    VType *k = makeInteger( i );
+    VType *v = mapGet( map, k );
+    assert( v && ( (Integer *) v )->val == i );
+    k->destroy( k );
+  }
+  freeMap( map );
+}
+
+/** Check adding many pairs at once to a map made with the given
+    options, with repeated keys and keys already in the map.
+    @param opts Options to make the map with. */
+static void testSetMany( MapOptions const *opts )
+{
+  Map *map = makeMapWith( 10, opts );
+  for ( int i = 0; i < 1000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( -1 ) );
+
+  // Keys repeat, and the last value for each one should win.
+  int n = 100000, keys = 60000;
+  VType **k = malloc( n * sizeof( VType * ) );
+  VType **v = malloc( n * sizeof( VType * ) );
+  for ( int i = 0; i < n; i++ ) {
+    k[ i ] = makeInteger( i % keys );
+    v[ i ] = makeInteger( i );
+  }
+  mapSetMany( map, k, v, n, 4 );
+  free( k );
+  free( v );
+
+  assert( mapSize( map ) == keys );
+  for ( int i = 0; i < keys; i++ ) {
+    VType *key = makeInteger( i );
+    VType *val = mapGet( map, key );
+    int last = i + keys < n ? i + keys : i;
+    assert( val && ( (Integer *) val )->val == last );
+    key->destroy( key );
+  }
+
+  // The map still works normally afterward.
+  removeKeys( map, 0, keys );
+  assert( mapSize( map ) == 0 );
+  freeMap( map );
+}
+
+/** State for collecting the keys visited by mapRange. */
+typedef struct {
+  /** Integer value of each key visited. */
+  int keys[ 1000 ];
+
+  /** Number of keys visited. */
+  int count;
+} RangeState;
+
+/** Record a key visited by mapRange.
+    @param key Key visited.
+    @param val Value for the key.
+    @param arg RangeState to record the key in. */
+static void collectKey( VType const *key, VType const *val, void *arg )
+{
+  RangeState *state = arg;
+  assert( ( (Integer const *) val )->val == -( (Integer const *) key )->val );
+  state->keys[ state->count++ ] = ( (Integer const *) key )->val;
+}
+
+/** Check range scans over a map made with the given options.
+    @param opts Options to make the map with. */
+static void testRange( MapOptions const *opts )
+{
+  Map *map = makeMapWith( 10, opts );
+
+  // Insert the keys out of order, then replace some of the values.
+  for ( int i = 0; i < 1000; i++ ) {
+    int k = i * 7919 % 1000;
+    mapSet( map, makeInteger( k ), makeInteger( k ) );
+  }
+  for ( int i = 0; i < 1000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( -i ) );
+  for ( int i = 0; i < 1000; i += 2 ) {
+    VType *k = makeInteger( i );
+    assert( mapRemove( map, k ) );
+    k->destroy( k );
+  }
+
+  RangeState state = { { 0 }, 0 };
+  assert( mapRange( map, NULL, NULL, collectKey, &state ) );
+  assert( state.count == 500 );
+  for ( int i = 0; i < state.count; i++ )
+    assert( state.keys[ i ] == 2 * i + 1 );
+
+  // Both ends of a range are included, and Text keys come after Integers.
+  mapSet( map, parseText( "\"text\"", NULL ), makeInteger( 0 ) );
+  VType *lo = makeInteger( 100 ), *hi = makeInteger( 111 );
+  state.count = 0;
+  mapRange( map, lo, hi, collectKey, &state );
+  assert( state.count == 6 && state.keys[ 0 ] == 101 && state.keys[ 5 ] == 111 );
+  lo->destroy( lo );
+  hi->destroy( hi );
+
+  freeMap( map );
+
+  // Persistent maps can't keep an index, so they can't do range scans.
+  MapOptions persistent = { MAP_PERSISTENT };
+  map = makeMapWith( 10, &persistent );
+  assert( ! mapRange( map, NULL, NULL, collectKey, &state ) );
+  freeMap( map );
+}
+
+/** Count the pairs visited, for mapRange.
+    @param key Key of the pair.
+    @param val Value of the pair.
+    @param arg Pointer to the count. */
+static void countPair( VType const *key, VType const *val, void *arg )
+{
+  ( *(int *) arg )++;
+}
+
+/** Return true if the given integer key is in the map.
+    @param map Map to look in.
+    @param key Key to look for.
+    @return True if it's there. */
+static bool hasKey( Map *map, int key )
+{
+  VType *k = makeInteger( key );
+  bool found = mapGet( map, k ) != NULL;
+  k->destroy( k );
+  return found;
+}
+
+/** Check eviction from a bounded map made with the given options.
+    @param base Options to make the map with, before adding limits. */
+static void testCache( MapOptions const *base )
+{
+  // Once it's full, each new key evicts the least recently used one.
+  MapOptions opts = *base;
+  opts.maxEntries = 3;
+  Map *map = makeMapWith( 2, &opts );
+  for ( int i = 1; i <= 3; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+  assert( hasKey( map, 1 ) );
+  mapSet( map, makeInteger( 4 ), makeInteger( 4 ) );
+  assert( mapSize( map ) == 3 );
+  assert( ! hasKey( map, 2 ) );
+  assert( hasKey( map, 1 ) && hasKey( map, 3 ) && hasKey( map, 4 ) );
+
+  // Replacing a value counts as a use too.
+  mapSet( map, makeInteger( 1 ), makeInteger( 10 ) );
+  mapSet( map, makeInteger( 5 ), makeInteger( 5 ) );
+  assert( ! hasKey( map, 3 ) );
+  assert( hasKey( map, 1 ) && hasKey( map, 4 ) && hasKey( map, 5 ) );
+
+  // Removing a pair leaves room for another without evicting.
+  VType *k = makeInteger( 4 );
+  assert( mapRemove( map, k ) );
+  k->destroy( k );
+  mapSet( map, makeInteger( 6 ), makeInteger( 6 ) );
+  assert( mapSize( map ) == 3 );
+
+  MapStats st;
+  mapStats( map, &st );
+  assert( st.hits == 7 && st.misses == 2 && st.evictions == 2 );
+  if ( opts.ordered ) {
+    int count = 0;
+    mapRange( map, NULL, NULL, countPair, &count );
+    assert( count == 3 );
+  }
+
+  // Filling it with many more keys keeps the newest ones.
+  for ( int i = 0; i < 10000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+  assert( mapSize( map ) == 3 );
+  assert( hasKey( map, 9999 ) && hasKey( map, 9997 ) && ! hasKey( map, 9996 ) );
+  freeMap( map );
+
+  // A limit on bytes evicts as values get bigger.
+  opts.maxEntries = 0;
+  opts.maxBytes = 4096;
+  map = makeMapWith( 10, &opts );
+  char buf[ 1000 ];
+  memset( buf, 'x', sizeof( buf ) );
+  for ( int i = 0; i < 100; i++ )
+    mapSet( map, makeInteger( i ), makeText( buf, sizeof( buf ) ) );
+  assert( mapSize( map ) > 1 && mapSize( map ) < 5 );
+  assert( hasKey( map, 99 ) );
+
+  // An interned value's characters are shared, so they aren't charged
+  // to each pair holding it.
+  for ( int i = 0; i < 40; i++ )
+    mapSet( map, makeInteger( i ), internText( buf, sizeof( buf ) ) );
+  assert( mapSize( map ) > 20 );
+
+  // Small values replacing big ones make room for more pairs.
+  for ( int i = 99; i >= 0; i-- )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+  assert( mapSize( map ) > 20 );
+
+  // But a pair too big for the limit by itself is still kept.
+  char *huge = calloc( 10000, 1 );
+  mapSet( map, makeInteger( -1 ), makeText( huge, 10000 ) );
+  free( huge );
+  assert( mapSize( map ) == 1 );
+  assert( hasKey( map, -1 ) );
+  freeMap( map );
+}
+
+/** Wait for a while.
+    @param millis Milliseconds to wait. */
+static void sleepMillis( long millis )
+{
+  struct timespec t = { millis / 1000, millis % 1000 * 1000000 };
+  nanosleep( &t, NULL );
+}
+
+/** Check pairs with a time to live in a map made with the given options.
+    @param base Options to make the map with, before making it expiring. */
+static void testExpiry( MapOptions const *base )
+{
+  // A map that isn't expiring just keeps the pair.
+  Map *map = makeMapWith( 10, base );
+  assert( ! mapSetTTL( map, makeInteger( 1 ), makeInteger( 1 ), 0 ) );
+  assert( hasKey( map, 1 ) );
+  freeMap( map );
+
+  MapOptions opts = *base;
+  opts.expiring = true;
+  map = makeMapWith( 10, &opts );
+
+  // An expired pair is never found, and one with time left is.
+  assert( mapSetTTL( map, makeInteger( 1 ), makeInteger( 1 ), 0 ) );
+  assert( ! hasKey( map, 1 ) );
+  mapSetTTL( map, makeInteger( 2 ), makeInteger( 2 ), 60000 );
+  assert( hasKey( map, 2 ) );
+
+  // Setting a key again without a time to live keeps it.
+  mapSetTTL( map, makeInteger( 3 ), makeInteger( 3 ), 30 );
+  mapSet( map, makeInteger( 3 ), makeInteger( 30 ) );
+
+  // Removing an expired pair reports that it wasn't there.
+  mapSetTTL( map, makeInteger( 4 ), makeInteger( 4 ), 0 );
+  VType *k = makeInteger( 4 );
+  assert( ! mapRemove( map, k ) );
+  k->destroy( k );
+
+  // Pairs expiring within the wheel's first level, and further out.
+  for ( int i = 100; i < 1100; i++ )
+    mapSetTTL( map, makeInteger( i ), makeInteger( i ), i % 2 ? 20 : 90 );
+  assert( mapSize( map ) > 1000 );
+  sleepMillis( 150 );
+  assert( hasKey( map, 2 ) && hasKey( map, 3 ) );
+  mapExpire( map );
+  assert( mapSize( map ) == 2 );
+  assert( mapExpire( map ) == 0 );
+
+  MapStats st;
+  mapStats( map, &st );
+  assert( st.expirations == 1002 );
+  if ( opts.ordered ) {
+    int count = 0;
+    mapRange( map, NULL, NULL, countPair, &count );
+    assert( count == 2 );
+  }
+  freeMap( map );
+}
+
+/** Check the statistics reported for a map with the given options.
+    @param opts Options to make the map with. */
+static void testStats( MapOptions const *opts )
+{
+  Map *map = makeMapWith( 16, opts );
+  for ( int i = 0; i < 1000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+
+  MapStats st;
+  mapStats( map, &st );
+  assert( st.size == 1000 );
+  assert( st.capacity == mapCapacity( map ) );
+  assert( st.capacity == 0 ? st.loadFactor == 0 : st.loadFactor == 1000.0 / st.capacity );
+  assert( st.bytes > 0 );
+
+  // For a chained map the histogram covers every bucket, for an open
+  // or persistent map it covers every entry.
+  int total = 0, entries = 0;
+  for ( int i = 0; i < MAP_STATS_CHAINS; i++ ) {
+    total += st.chains[ i ];
+    entries += i * st.chains[ i ];
+  }
+  if ( opts && opts->backend != MAP_CHAINED )
+    assert( total == 1000 );
+  else {
+    assert( total >= st.capacity );
+    assert( entries <= 1000 );
+  }
+
+  // Counters are only kept in MAP_STATS builds.
+  if ( st.counted ) {
+    assert( st.sets == 1000 );
+    assert( st.setProbes >= 0 );
+    assert( st.expansions > 0 || opts->backend == MAP_PERSISTENT );
+  } else
+    assert( st.sets == 0 && st.expansions == 0 );
+
+  freeMap( map );
+}
+
+/** Save a map with both kinds of keys and values, load it back with
+    the given options and check the contents.
+    @param opts Options to load the map with. */
+static void testSnapshot( MapOptions const *opts )
+{
+  Map *map = makeMap( 10 );
+  for ( int i = 0; i < 100; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i * i ) );
+  mapSet( map, parseText( "\"key\"", NULL ), parseText( "\"a \\\"quoted\\\" value\"", NULL ) );
+  mapSet( map, parseText( "\"\"", NULL ), makeInteger( -7 ) );
+  assert( mapSave( map, "mapTest.map" ) );
+
+  Map *copy = mapLoad( "mapTest.map", opts );
+  assert( copy );
+  assert( mapSize( copy ) == mapSize( map ) );
+  for ( int i = 0; i < 100; i++ ) {
+    VType *k = makeInteger( i );
+    VType *v = mapGet( copy, k );
+    assert( v && ( (Integer *) v )->val == i * i );
+    k->destroy( k );
+  }
+  VType *k = parseText( "\"key\"", NULL );
+  VType *v = mapGet( copy, k );
+  assert( v && strcmp( textValue( v ), "a \"quoted\" value" ) == 0 );
+  k->destroy( k );
+  k = parseText( "\"\"", NULL );
+  v = mapGet( copy, k );
+  assert( v && ( (Integer *) v )->val == -7 );
+  k->destroy( k );
+
+  freeMap( copy );
+  freeMap( map );
+  remove( "mapTest.map" );
+
+  // Missing files can't be loaded.
+  assert( mapLoad( "mapTest.map", opts ) == NULL );
+}
+
+/** Hash function that gives every four consecutive Integers the same
+    hash, to make keys collide.
+    @param v Integer to hash.
+    @return its value divided by four. */
+static unsigned int quarterHash( VType const *v )
+{
+  return ( (Integer const *) v )->val / 4;
+}
+
+/** Make an Integer key that collides with its neighbors.
+    @param i Value of the key.
+    @return the new key. */
+static VType *collidingKey( int i )
+{
+  VType *k = makeInteger( i );
+  k->hash = quarterHash;
+  return k;
+}
+
+/** Check that every key from 0 up to n is in a map with the given
+    value, and nothing else is.
+    @param map Map to check.
+    @param n Number of keys.
+    @param sign Each key i should map to sign * i.
+    @param colliding True if the keys were made with collidingKey. */
+static void checkKeys( Map *map, int n, int sign, bool colliding )
+{
+  assert( mapSize( map ) == n );
+  for ( int i = 0; i < n; i++ ) {
+    VType *k = colliding ? collidingKey( i ) : makeInteger( i );
+    VType *v = mapGet( map, k );
+    assert( v && ( (Integer *) v )->val == sign * i );
+    k->destroy( k );
+  }
+}
+
+/** Arguments for a thread reading a snapshot. */
+typedef struct {
+  /** Snapshot to read. */
+  Map *snap;
+
+  /** Number of keys in the snapshot. */
+  int n;
+} ReaderArgs;
+
+/** Thread that reads a snapshot over and over while the map it came
+    from is changed, then frees it.
+    @param arg ReaderArgs for the snapshot.
+    @return NULL */
+static void *readSnapshot( void *arg )
+{
+  ReaderArgs *args = arg;
+  for ( int pass = 0; pass < 20; pass++ )
+    checkKeys( args->snap, args->n, 1, false );
+  freeMap( args->snap );
+  return NULL;
+}
+
+/** Check point-in-time snapshots of a persistent map.
+    @param opts Options to make the map with, using MAP_PERSISTENT. */
+static void testPointInTime( MapOptions const *opts )
+{
+  // Change every key after taking a snapshot, in both kinds of node.
+  for ( int colliding = 0; colliding < 2; colliding++ ) {
+    Map *map = makeMapWith( 10, opts );
+    for ( int i = 0; i < 1000; i++ )
+      mapSet( map, colliding ? collidingKey( i ) : makeInteger( i ), makeInteger( i ) );
+    Map *snap = mapSnapshot( map );
+    assert( snap );
+
+    for ( int i = 0; i < 1000; i++ )
+      mapSet( map, colliding ? collidingKey( i ) : makeInteger( i ), makeInteger( -i ) );
+    checkKeys( map, 1000, -1, colliding );
+    checkKeys( snap, 1000, 1, colliding );
+
+    // A snapshot of a snapshot, changed on its own.
+    Map *again = mapSnapshot( snap );
+    for ( int i = 500; i < 1000; i++ ) {
+      VType *k = colliding ? collidingKey( i ) : makeInteger( i );
+      assert( mapRemove( again, k ) );
+      k->destroy( k );
+    }
+    checkKeys( again, 500, 1, colliding );
+    checkKeys( snap, 1000, 1, colliding );
+
+    // Emptying the map leaves the snapshots alone, and they outlive it.
+    for ( int i = 0; i < 1000; i++ ) {
+      VType *k = colliding ? collidingKey( i ) : makeInteger( i );
+      assert( mapRemove( map, k ) );
+      k->destroy( k );
+    }
+    assert( mapSize( map ) == 0 );
+    freeMap( map );
+    checkKeys( snap, 1000, 1, colliding );
+    freeMap( snap );
+    checkKeys( again, 500, 1, colliding );
+    freeMap( again );
+  }
+
+  // Read a snapshot from another thread while the map keeps changing.
+  Map *map = makeMapWith( 10, opts );
+  for ( int i = 0; i < 20000; i++ )
+    mapSet( map, makeInteger( i ), makeInteger( i ) );
+  ReaderArgs args = { mapSnapshot( map ), 20000 };
+  pthread_t reader;
+  pthread_create( &reader, NULL, readSnapshot, &args );
+  for ( int pass = 0; pass < 5; pass++ ) {
+    for ( int i = 0; i < 20000; i++ )
+      mapSet( map, makeInteger( i ), makeInteger( -i ) );
+    for ( int i = 20000; i < 30000; i++ )
+      mapSet( map, makeInteger( i ), makeInteger( -i ) );
+    removeKeys( map, 20000, 30000 );
+  }
+  pthread_join( reader, NULL );
+  checkKeys( map, 20000, -1, false );
+  freeMap( map );
+
+  // Only persistent maps can be snapshotted.
+  map = makeMap( 10 );
+  assert( mapSnapshot( map ) == NULL );
+  freeMap( map );
+  MapOptions ordered = *opts;
+  ordered.ordered = true;
+  map = makeMapWith( 10, &ordered );
+  assert( mapSnapshot( map ) == NULL );
+  freeMap( map );
+}
+
+/** Run the same checks as testMap and testGrowth on a specialized
+    map. */
+static void testIntMap( void )
+{
+  IntMap *map = IntMapMake( 3 );
+  int v;
+  assert( IntMapSize( map ) == 0 );
+
+  // Put in 5 -> 10 and 10 -> 15, then change 5 to 20.
+  IntMapSet( map, 5, 10 );
+  assert( IntMapSize( map ) == 1 );
+  assert( IntMapGet( map, 5, &v ) && v == 10 );
+  IntMapSet( map, 10, 15 );
+  assert( IntMapSize( map ) == 2 );
+  assert( IntMapGet( map, 10, &v ) && v == 15 );
+  assert( IntMapGet( map, 5, &v ) && v == 10 );
+  IntMapSet( map, 5, 20 );
+  assert( IntMapSize( map ) == 2 );
+  assert( IntMapGet( map, 5, &v ) && v == 20 );
+
+  // Remove 10, then try to remove it again.
+  assert( IntMapRemove( map, 10 ) );
+  assert( IntMapSize( map ) == 1 );
+  assert( ! IntMapGet( map, 10, NULL ) );
+  assert( ! IntMapRemove( map, 10 ) );
+  assert( IntMapSize( map ) == 1 );
+  IntMapFree( map );
+
+  // Grow the map, then remove the even keys.
+  map = IntMapMake( 3 );
+  for ( int i = 0; i < 1000; i++ )
+    IntMapSet( map, i * 1024, -i );
+  assert( IntMapSize( map ) == 1000 );
+  for ( int i = 0; i < 1000; i += 2 )
+    assert( IntMapRemove( map, i * 1024 ) );
+  assert( IntMapSize( map ) == 500 );
+  for ( int i = 0; i < 1000; i++ ) {
+    bool found = IntMapGet( map, i * 1024, &v );
+    assert( found == ( i % 2 == 1 ) );
+    assert( ! found || v == -i );
+  }
+  IntMapFree( map );
+}
+
+/** Check Values against the VTypes they stand for, and a map generated
+    for them that owns its keys and values. */
+static void testValueMap( void )
+{
+  // Hashes, equality and conversions match the VTypes.
+  char const *inputs[] = { "0", "-7", "2147483647", "\"\"", "\"key\"",
+                           "\"\\xff\\tescaped\"", "\"a longer string than fits inline\"" };
+  int count = sizeof( inputs ) / sizeof( inputs[ 0 ] );
+  for ( int i = 0; i < count; i++ ) {
+    VType *a = parseInteger( inputs[ i ], NULL );
+    if ( ! a )
+      a = parseText( inputs[ i ], NULL );
+    Value va = valueFromVType( a );
+    assert( valueHash( va ) == a->hash( a ) );
+    for ( int j = 0; j < count; j++ ) {
+      VType *b = parseInteger( inputs[ j ], NULL );
+      if ( ! b )
+        b = parseText( inputs[ j ], NULL );
+      Value vb = valueFromVType( b );
+      assert( valueEquals( va, vb ) == a->equals( a, b ) );
+      valueDestroy( vb );
+      b->destroy( b );
+    }
+
+    VType *back = valueToVType( va );
+    assert( back->equals( back, a ) && a->equals( a, back ) );
+    back->destroy( back );
+    valueDestroy( va );
+    a->destroy( a );
+  }
+  assert( sizeof( Value ) <= 16 );
+
+  // Integer keys map to Text values, and Text keys to Integers.
+  ValueMap *map = ValueMapMake( 3 );
+  char buf[ 20 ];
+  for ( int i = 0; i < 1000; i++ ) {
+    int len = sprintf( buf, "%d", i );
+    ValueMapSet( map, valueInteger( i ), valueText( buf, len ) );
+    ValueMapSet( map, valueText( buf, len ), valueInteger( -i ) );
+  }
+  assert( ValueMapSize( map ) == 2000 );
+  for ( int i = 0; i < 1000; i++ ) {
+    int len = sprintf( buf, "%d", i );
+    Value key = valueText( buf, len ), v;
+    assert( ValueMapGet( map, key, &v ) && v.tag == VALUE_INTEGER && v.as.i == -i );
+    assert( ValueMapGet( map, valueInteger( i ), &v ) && v.tag == VALUE_TEXT );
+    assert( v.len == len && strcmp( v.as.str, buf ) == 0 );
+
+    // Replacing a Text value frees the old one, and replacing the value
+    // for a Text key frees the duplicate key.
+    ValueMapSet( map, valueInteger( i ), valueText( "replaced", 8 ) );
+    ValueMapSet( map, valueText( buf, len ), valueInteger( i ) );
+    assert( ValueMapGet( map, valueInteger( i ), &v ) );
+    assert( strcmp( v.as.str, "replaced" ) == 0 );
+
+    // Removing frees the stored pair, but not the key passed in.
+    assert( ValueMapRemove( map, valueInteger( i ) ) );
+    if ( i % 2 )
+      assert( ValueMapRemove( map, key ) );
+    valueDestroy( key );
+  }
+  assert( ValueMapSize( map ) == 500 );
+
+  // Freeing the map frees the pairs still in it.
+  ValueMapFree( map );
+  assert( internedCount() == 0 );
+}
+
+int main()
+{
+  // Check the default, chained map.
+  testMap( NULL );
+  testGrowth( NULL );
+
+  // Check the open addressing map.
+  MapOptions open = { MAP_OPEN };
+  testMap( &open );
+  testGrowth( &open );
+
+  // Check both kinds of map with the seeded hash functions.
+  MapOptions seeded = { MAP_CHAINED, MAP_HASH_SEEDED, 0 };
+  testMap( &seeded );
+  testGrowth( &seeded );
+  seeded.backend = MAP_OPEN;
+  testMap( &seeded );
+  testGrowth( &seeded );
+
+  // Check the persistent map, and its snapshots.
+  MapOptions persistent = { MAP_PERSISTENT };
+  testMap( &persistent );
+  testGrowth( &persistent );
+  testPointInTime( &persistent );
+  seeded.backend = MAP_PERSISTENT;
+  testGrowth( &seeded );
+  testPointInTime( &seeded );
+
+  // Check specialized maps.
+  testIntMap();
+  testValueMap();
+
+  // Check reserving and shrinking both kinds of map.
+  testReserve( NULL );
+  testReserve( &open );
+
+  // Check adding many pairs at once.
+  testSetMany( NULL );
+  testSetMany( &open );
+  testSetMany( &persistent );
+  seeded.backend = MAP_CHAINED;
+  testSetMany( &seeded );
+
+  // Check range scans over both kinds of map, with an index kept from
+  // the start and with one built by the first scan.
+  MapOptions ordered = { MAP_CHAINED, MAP_HASH_VTYPE, 0, true };
+  MapOptions plain = { MAP_CHAINED };
+  testRange( &ordered );
+  testRange( &plain );
+  ordered.backend = MAP_OPEN;
+  testRange( &ordered );
+  testRange( &open );
+
+  // Check bounded maps, including one with an index to keep up to date.
+  // The open backend is replaced by chaining for a bounded map.
+  testCache( &plain );
+  testCache( &seeded );
+  ordered.backend = MAP_CHAINED;
+  testCache( &ordered );
+  testCache( &open );
+
+  // Check pairs with a time to live, including in a bounded map.
+  testExpiry( &plain );
+  testExpiry( &ordered );
+  testExpiry( &open );
+  MapOptions bounded = { MAP_CHAINED };
+  bounded.maxEntries = 5000;
+  testExpiry( &bounded );
+
+  // Check map statistics.
+  testStats( NULL );
+  testStats( &open );
+  testStats( &persistent );
+
+  // Save and load maps.
+  testSnapshot( NULL );
+  testSnapshot( &open );
+  testSnapshot( &persistent );
 
   return EXIT_SUCCESS;
 }
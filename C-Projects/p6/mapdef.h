@@ -0,0 +1,235 @@
+/**
+    @file mapdef.h
+    @author Christopher Fields (cwfields)
+    Generator for type-specialized maps. MAP_DEFINE expands to a map
+    type with keys and values of the given types stored unboxed, right
+    in the table, and functions that call the given hash and equality
+    functions directly instead of through VType function pointers, so
+    the compiler can inline them. The maps use the same Robin Hood open
+    addressing as the openmap component.
+
+    For example, MAP_DEFINE( IntMap, int, int, mapHashInt, mapEqualsInt )
+    defines the type IntMap and the functions IntMapMake, IntMapSize,
+    IntMapSet, IntMapGet, IntMapRemove and IntMapFree. Keys and values
+    are copied in and out by assignment and are never freed by the map.
+
+    MAP_DEFINE_OWNED takes two more arguments, functions (or macros) that
+    free a key and a value. A map defined with it owns what it holds, as
+    a Map does: it frees the value a set replaces and the duplicate key
+    passed in with it, the pair a remove takes out, and every pair left
+    when the map is freed.
+*/
+
+#ifndef MAPDEF_H
+#define MAPDEF_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/** Smallest number of slots a generated map will have. */
+#define MAPDEF_MIN_CAPACITY 8
+
+/**
+   Scrambles the bits of a hash so the low bits used to pick a slot
+   depend on all of them. This is the finalizer from MurmurHash3.
+
+   @param h hash value to mix
+   @return the mixed hash value
+ */
+static inline unsigned int mapdefMix( unsigned int h )
+{
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h;
+}
+
+/** Hash function for int keys, for use with MAP_DEFINE.
+    @param k Key to hash.
+    @return hash of the key. */
+static inline unsigned int mapHashInt( int k )
+{
+  return k;
+}
+
+/** Equality function for int keys, for use with MAP_DEFINE.
+    @param a Left-hand key.
+    @param b Right-hand key.
+    @return True if the keys are equal. */
+static inline bool mapEqualsInt( int a, int b )
+{
+  return a == b;
+}
+
+/** Free function for MAP_DEFINE_OWNED that leaves a key or value alone.
+    @param x Key or value that isn't freed. */
+#define MAPDEF_KEEP( x ) ( (void) 0 )
+
+/** Define a map type called Name that never frees its keys or values.
+    See MAP_DEFINE_OWNED for the functions it defines. */
+#define MAP_DEFINE( Name, K, V, hashFn, eqFn )                              \
+  MAP_DEFINE_OWNED( Name, K, V, hashFn, eqFn, MAPDEF_KEEP, MAPDEF_KEEP )
+
+/**
+   Define a map type called Name with keys of type K and values of type
+   V, along with its functions:
+
+   Name *NameMake( int len ) makes an empty map with room for len entries.
+   int NameSize( Name *m ) returns the number of entries.
+   void NameSet( Name *m, K key, V val ) adds or replaces an entry. A
+     replaced entry keeps its key, and the old value and the new key
+     are freed.
+   bool NameGet( Name *m, K key, V *val ) copies the value for key into
+     *val (if val isn't NULL) and returns true if the key is present.
+     The map still owns the value.
+   bool NameRemove( Name *m, K key ) removes and frees an entry,
+     returning true if it was there.
+   void NameFree( Name *m ) frees the map and the entries in it.
+
+   @param Name Name of the map type, also used as a prefix for its functions.
+   @param K Type of the keys.
+   @param V Type of the values.
+   @param hashFn Function (or macro) returning an unsigned int hash for a K.
+   @param eqFn Function (or macro) returning true if two K values are equal.
+   @param keyFree Function (or macro) that frees a K, or MAPDEF_KEEP.
+   @param valFree Function (or macro) that frees a V, or MAPDEF_KEEP.
+ */
+#define MAP_DEFINE_OWNED( Name, K, V, hashFn, eqFn, keyFree, valFree )      \
+                                                                            \
+typedef struct {                                                            \
+  unsigned int hash;                                                        \
+  unsigned int dist;                                                        \
+  K key;                                                                    \
+  V val;                                                                    \
+} Name##Slot;                                                               \
+                                                                            \
+typedef struct {                                                            \
+  Name##Slot *slots;                                                        \
+  unsigned int mask;                                                        \
+  int size;                                                                 \
+} Name;                                                                     \
+                                                                            \
+static inline Name *Name##Make( int len )                                   \
+{                                                                           \
+  Name *m = (Name *) malloc( sizeof( Name ) );                              \
+  unsigned int cap = MAPDEF_MIN_CAPACITY;                                   \
+  while ( len > 0 && cap / 8 * 7 < (unsigned int) len )                     \
+    cap *= 2;                                                               \
+  m->slots = (Name##Slot *) calloc( cap, sizeof( Name##Slot ) );            \
+  m->mask = cap - 1;                                                        \
+  m->size = 0;                                                              \
+  return m;                                                                 \
+}                                                                           \
+                                                                            \
+static inline int Name##Size( Name *m )                                     \
+{                                                                           \
+  return m->size;                                                           \
+}                                                                           \
+                                                                            \
+static inline void Name##Place( Name *m, Name##Slot entry )                 \
+{                                                                           \
+  unsigned int idx = entry.hash & m->mask;                                  \
+  entry.dist = 1;                                                           \
+  while ( m->slots[ idx ].dist ) {                                          \
+    if ( m->slots[ idx ].dist < entry.dist ) {                              \
+      Name##Slot tmp = m->slots[ idx ];                                     \
+      m->slots[ idx ] = entry;                                              \
+      entry = tmp;                                                          \
+    }                                                                       \
+    idx = ( idx + 1 ) & m->mask;                                            \
+    entry.dist++;                                                           \
+  }                                                                         \
+  m->slots[ idx ] = entry;                                                  \
+}                                                                           \
+                                                                            \
+static inline void Name##Set( Name *m, K key, V val )                       \
+{                                                                           \
+  if ( (unsigned int) ( m->size + 1 ) * 8 > ( m->mask + 1 ) * 7 ) {         \
+    Name##Slot *old = m->slots;                                             \
+    unsigned int oldCap = m->mask + 1;                                      \
+    m->slots = (Name##Slot *) calloc( 2 * oldCap, sizeof( Name##Slot ) );   \
+    m->mask = 2 * oldCap - 1;                                               \
+    for ( unsigned int i = 0; i < oldCap; i++ )                             \
+      if ( old[ i ].dist )                                                  \
+        Name##Place( m, old[ i ] );                                         \
+    free( old );                                                            \
+  }                                                                         \
+                                                                            \
+  unsigned int h = mapdefMix( hashFn( key ) );                              \
+  unsigned int idx = h & m->mask;                                           \
+  unsigned int dist = 1;                                                    \
+  while ( m->slots[ idx ].dist >= dist ) {                                  \
+    Name##Slot *s = &m->slots[ idx ];                                       \
+    if ( s->hash == h && eqFn( s->key, key ) ) {                            \
+      valFree( s->val );                                                    \
+      keyFree( key );                                                       \
+      s->val = val;                                                         \
+      return;                                                               \
+    }                                                                       \
+    idx = ( idx + 1 ) & m->mask;                                            \
+    dist++;                                                                 \
+  }                                                                         \
+                                                                            \
+  Name##Slot entry = { h, 1, key, val };                                    \
+  Name##Place( m, entry );                                                  \
+  m->size++;                                                                \
+}                                                                           \
+                                                                            \
+static inline long Name##Find( Name *m, K key )                             \
+{                                                                           \
+  unsigned int h = mapdefMix( hashFn( key ) );                              \
+  unsigned int idx = h & m->mask;                                           \
+  unsigned int dist = 1;                                                    \
+  while ( m->slots[ idx ].dist >= dist ) {                                  \
+    if ( m->slots[ idx ].hash == h && eqFn( m->slots[ idx ].key, key ) )    \
+      return idx;                                                           \
+    idx = ( idx + 1 ) & m->mask;                                            \
+    dist++;                                                                 \
+  }                                                                         \
+  return -1;                                                                \
+}                                                                           \
+                                                                            \
+static inline bool Name##Get( Name *m, K key, V *val )                      \
+{                                                                           \
+  long idx = Name##Find( m, key );                                          \
+  if ( idx < 0 )                                                            \
+    return false;                                                           \
+  if ( val )                                                                \
+    *val = m->slots[ idx ].val;                                             \
+  return true;                                                              \
+}                                                                           \
+                                                                            \
+static inline bool Name##Remove( Name *m, K key )                           \
+{                                                                           \
+  long found = Name##Find( m, key );                                        \
+  if ( found < 0 )                                                          \
+    return false;                                                           \
+  unsigned int idx = found;                                                 \
+  keyFree( m->slots[ idx ].key );                                           \
+  valFree( m->slots[ idx ].val );                                           \
+  unsigned int next = ( idx + 1 ) & m->mask;                                \
+  while ( m->slots[ next ].dist > 1 ) {                                     \
+    m->slots[ idx ] = m->slots[ next ];                                     \
+    m->slots[ idx ].dist--;                                                 \
+    idx = next;                                                             \
+    next = ( next + 1 ) & m->mask;                                          \
+  }                                                                         \
+  m->slots[ idx ].dist = 0;                                                 \
+  m->size--;                                                                \
+  return true;                                                              \
+}                                                                           \
+                                                                            \
+static inline void Name##Free( Name *m )                                    \
+{                                                                           \
+  for ( unsigned int i = 0; i <= m->mask; i++ )                             \
+    if ( m->slots[ i ].dist ) {                                             \
+      keyFree( m->slots[ i ].key );                                         \
+      valFree( m->slots[ i ].val );                                         \
+    }                                                                       \
+  free( m->slots );                                                         \
+  free( m );                                                                \
+}
+
+#endif
@@ -0,0 +1,402 @@
+/**
+    @file openmap.c
+    @author Christopher Fields (cwfields)
+    Open addressing implementation of a hash table, used as an
+    alternative backend for the map component. Each slot stores the
+    (mixed) hash of its key and its distance from its home slot, so
+    most probes are resolved by comparing integers without calling the
+    key's equals function. Uses Robin Hood insertion and backward-shift
+    deletion, which keeps probe sequences short without tombstones.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "openmap.h"
+#include <stdlib.h>
+#include <time.h>
+
+/** Smallest number of slots a table will have. */
+#define MIN_CAPACITY 8
+
+/** Mutlpilier to change capacity by when the table gets too full. */
+#define CAP_MULTIPLIER 2
+
+/** The table shrinks to half its size when it has fewer than one entry
+    for every SHRINK_LOAD slots, well below the load where it grows. */
+#define SHRINK_LOAD 8
+
+/** Numerator of the maximum load factor (entries / slots) of the table. */
+#define LOAD_NUM 7
+
+/** Denominator of the maximum load factor (entries / slots) of the table. */
+#define LOAD_DEN 8
+
+#ifdef MAP_STATS
+/** Add to one of the table's counters. */
+#define COUNT( m, field, n ) ( ( m )->counters.field += ( n ) )
+
+/** Pointer to one of the table's counters. */
+#define COUNTER( m, field ) ( &( m )->counters.field )
+
+/** Add to the counter at the given address. */
+#define COUNT_AT( p, n ) ( *( p ) += ( n ) )
+#else
+/** Counting is compiled out without MAP_STATS. */
+#define COUNT( m, field, n )
+#define COUNTER( m, field ) NULL
+#define COUNT_AT( p, n )
+#endif
+
+/** A single slot in the table. */
+typedef struct {
+  /** Mixed hash of the key stored in this slot. */
+  unsigned int hash;
+
+  /** One more than the distance of this slot from the key's home slot,
+      or zero if this slot is empty. */
+  unsigned int dist;
+
+  /** Pointer to the key part of the key / value pair. */
+  VType *key;
+
+  /** Pointer to the value part of the key / value pair. */
+  VType *val;
+} Slot;
+
+/** Representation of an open addressing hash table. */
+struct OpenMapStruct {
+  /** Array of slots, its length is always a power of two. */
+  Slot *slots;
+
+  /** Number of slots minus one, used to reduce a hash to an index. */
+  unsigned int mask;
+
+  /** Number of key / value pairs in the table. */
+  int size;
+
+  /** The table doesn't shrink below this many slots, set by
+      makeOpenMap and openMapReserve. */
+  unsigned int minCap;
+
+#ifdef MAP_STATS
+  /** Counters for the table's operations. */
+  OpenMapCounters counters;
+#endif
+};
+
+/**
+   Scrambles the bits of a key's hash. Hashes can be very regular
+   (an Integer hashes to its own value), and the table only uses the
+   low bits of the hash to pick a slot, so the high bits are mixed down
+   first. This is the finalizer from MurmurHash3.
+
+   @param h hash value returned by the key
+   @return the mixed hash value
+ */
+static unsigned int mix(unsigned int h)
+{
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+   Helper method to allocate an array of empty slots.
+
+   @param cap number of slots to allocate
+   @return the new array of slots
+ */
+static Slot *makeSlots(unsigned int cap)
+{
+  // calloc leaves every dist at zero, marking every slot empty
+  return calloc(cap, sizeof(Slot));
+}
+
+/**
+   Helper method to place an entry that is known not to be in the table
+   already. Used when moving entries into a larger table.
+
+   @param m the table to place the entry into
+   @param entry the entry to place, its dist field is ignored
+ */
+static void placeNew(OpenMap *m, Slot entry)
+{
+  unsigned int idx = entry.hash & m->mask;
+  entry.dist = 1;
+  while (m->slots[idx].dist) {
+    if (m->slots[idx].dist < entry.dist) { // Take the slot from a richer entry
+      Slot tmp = m->slots[idx];
+      m->slots[idx] = entry;
+      entry = tmp;
+    }
+    idx = (idx + 1) & m->mask;
+    entry.dist++;
+  }
+  m->slots[idx] = entry;
+}
+
+/**
+   Helper method to change the number of slots in the table, moving
+   every entry to its position in the new table. Uses the hash stored
+   in each slot, so keys aren't rehashed.
+
+   @param m the table to resize
+   @param newCap the new number of slots, a power of two with room for
+   every entry
+ */
+static void resizeOpenMap(OpenMap *m, unsigned int newCap)
+{
+  Slot *oldSlots = m->slots;
+  unsigned int oldCap = m->mask + 1;
+
+  m->slots = makeSlots(newCap);
+  m->mask = newCap - 1;
+
+  for (unsigned int i = 0; i < oldCap; i++) {
+    if (oldSlots[i].dist) {
+      placeNew(m, oldSlots[i]);
+    }
+  }
+
+  free(oldSlots);
+}
+
+/**
+   Helper method to double the number of slots in the table.
+
+   @param m the table to expand
+ */
+static void expandOpenMap(OpenMap *m)
+{
+#ifdef MAP_STATS
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+  resizeOpenMap(m, CAP_MULTIPLIER * (m->mask + 1));
+
+#ifdef MAP_STATS
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  COUNT(m, expansions, 1);
+  COUNT(m, expandSeconds, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+#endif
+}
+
+/**
+   Helper method to find the smallest number of slots that can hold
+   the given number of entries.
+
+   @param len number of entries
+   @return a power of two number of slots
+ */
+static unsigned int capacityFor(int len)
+{
+  unsigned int cap = MIN_CAPACITY;
+  while (len > 0 && cap / LOAD_DEN * LOAD_NUM < (unsigned int) len) {
+    cap *= CAP_MULTIPLIER;
+  }
+  return cap;
+}
+
+OpenMap *makeOpenMap( int len )
+{
+  OpenMap *m = (OpenMap *) malloc( sizeof( OpenMap ) );
+  m->size = 0;
+
+  // Round up to a power of two with enough room for len entries
+  unsigned int cap = capacityFor(len);
+  m->slots = makeSlots(cap);
+  m->mask = cap - 1;
+  m->minCap = cap;
+#ifdef MAP_STATS
+  m->counters = (OpenMapCounters) { 0 };
+#endif
+
+  return m;
+}
+
+int openMapSize( OpenMap *m )
+{
+  return m->size;
+}
+
+int openMapCapacity( OpenMap *m )
+{
+  return m->mask + 1;
+}
+
+void openMapSet( OpenMap *m, VType *key, VType *val, unsigned int h )
+{
+  if ((unsigned int) (m->size + 1) * LOAD_DEN > (m->mask + 1) * LOAD_NUM) {
+    expandOpenMap(m);
+  }
+
+  COUNT(m, sets, 1);
+  Slot entry = { mix(h), 1, key, val };
+  unsigned int idx = entry.hash & m->mask;
+
+  // Look for the key until we reach a slot whose entry is closer to home
+  // than we are. Robin Hood ordering means the key can't be past there.
+  while (m->slots[idx].dist >= entry.dist) {
+    COUNT(m, setProbes, 1);
+    Slot *s = &m->slots[idx];
+    if (s->hash == entry.hash && s->key->equals(s->key, key)) {
+      s->val->destroy(s->val);
+      s->val = val;
+      key->destroy(key);
+      return;
+    }
+    idx = (idx + 1) & m->mask;
+    entry.dist++;
+  }
+
+  // Insert here, pushing richer entries further along the table
+  COUNT(m, setProbes, 1);
+  while (m->slots[idx].dist) {
+    if (m->slots[idx].dist < entry.dist) {
+      Slot tmp = m->slots[idx];
+      m->slots[idx] = entry;
+      entry = tmp;
+    }
+    idx = (idx + 1) & m->mask;
+    entry.dist++;
+  }
+  m->slots[idx] = entry;
+  m->size++;
+}
+
+/**
+   Helper method to find the slot holding the given key.
+
+   @param m the table to search
+   @param key the key to search for
+   @param h hash of the key
+   @param probes counter to add the number of slots examined to, or
+   NULL if the table isn't counting
+   @return index of the slot holding key, or -1 if it isn't in the table
+ */
+static long findSlot(OpenMap *m, VType *key, unsigned int h, long *probes)
+{
+  h = mix(h);
+  unsigned int idx = h & m->mask;
+  unsigned int dist = 1;
+
+  // An empty slot has a dist of zero, so this stops there too
+  while (m->slots[idx].dist >= dist) {
+    COUNT_AT(probes, 1);
+    Slot *s = &m->slots[idx];
+    if (s->hash == h && s->key->equals(s->key, key)) {
+      return idx;
+    }
+    idx = (idx + 1) & m->mask;
+    dist++;
+  }
+  return -1;
+}
+
+VType *openMapGet( OpenMap *m, VType *key, unsigned int h )
+{
+  COUNT(m, gets, 1);
+  long idx = findSlot(m, key, h, COUNTER(m, getProbes));
+  return idx < 0 ? NULL : m->slots[idx].val;
+}
+
+bool openMapRemove( OpenMap *m, VType *key, unsigned int h )
+{
+  COUNT(m, removes, 1);
+  long found = findSlot(m, key, h, COUNTER(m, removeProbes));
+  if (found < 0) {
+    return false;
+  }
+
+  unsigned int idx = found;
+  m->slots[idx].key->destroy(m->slots[idx].key);
+  m->slots[idx].val->destroy(m->slots[idx].val);
+
+  // Shift the following entries back one slot until one is already home
+  unsigned int next = (idx + 1) & m->mask;
+  while (m->slots[next].dist > 1) {
+    m->slots[idx] = m->slots[next];
+    m->slots[idx].dist--;
+    idx = next;
+    next = (next + 1) & m->mask;
+  }
+  m->slots[idx].dist = 0;
+
+  m->size--;
+
+  // Shrink a mostly empty table
+  if ((unsigned int) m->size * SHRINK_LOAD < m->mask + 1 && m->mask + 1 > m->minCap) {
+    resizeOpenMap(m, (m->mask + 1) / CAP_MULTIPLIER);
+  }
+  return true;
+}
+
+void openMapReserve( OpenMap *m, int n )
+{
+  unsigned int cap = capacityFor(n);
+  if (cap > m->mask + 1) {
+    resizeOpenMap(m, cap);
+  }
+  if (cap > m->minCap) {
+    m->minCap = cap;
+  }
+}
+
+void openMapShrinkToFit( OpenMap *m )
+{
+  unsigned int cap = capacityFor(m->size);
+  m->minCap = MIN_CAPACITY;
+  if (cap < m->mask + 1) {
+    resizeOpenMap(m, cap);
+  }
+}
+
+void openMapCounters( OpenMap *m, OpenMapCounters *c )
+{
+#ifdef MAP_STATS
+  *c = m->counters;
+#else
+  *c = (OpenMapCounters) { 0 };
+#endif
+}
+
+long openMapHistogram( OpenMap *m, int *hist, int len )
+{
+  for (int i = 0; i < len; i++) {
+    hist[i] = 0;
+  }
+  for (unsigned int i = 0; i <= m->mask; i++) {
+    if (m->slots[i].dist) {
+      unsigned int d = m->slots[i].dist - 1;
+      hist[d < (unsigned int) len ? d : (unsigned int) len - 1]++;
+    }
+  }
+  return sizeof(OpenMap) + (long) (m->mask + 1) * sizeof(Slot);
+}
+
+void openMapForEach( OpenMap *m,
+                     void (*visit)( VType const *key, VType const *val, void *arg ),
+                     void *arg )
+{
+  for (unsigned int i = 0; i <= m->mask; i++) {
+    if (m->slots[i].dist) {
+      visit(m->slots[i].key, m->slots[i].val, arg);
+    }
+  }
+}
+
+void freeOpenMap( OpenMap *m )
+{
+  for (unsigned int i = 0; i <= m->mask; i++) {
+    if (m->slots[i].dist) {
+      m->slots[i].key->destroy(m->slots[i].key);
+      m->slots[i].val->destroy(m->slots[i].val);
+    }
+  }
+
+  free(m->slots);
+  free( m );
+}
@@ -0,0 +1,122 @@
+/**
+    @file openmap.h
+    @author Christopher Fields (cwfields)
+    Header for the open addressing table used as an alternative
+    backend for the map component. Entries are stored inline in a
+    single array of slots and collisions are resolved with Robin Hood
+    linear probing, so a lookup touches one contiguous run of memory
+    instead of chasing a list of nodes.
+*/
+
+#ifndef OPENMAP_H
+#define OPENMAP_H
+
+#include "vtype.h"
+#include <stdbool.h>
+
+/** Incomplete type for the open addressing table representation. */
+typedef struct OpenMapStruct OpenMap;
+
+/** Make an empty open addressing table.
+    @param len Minimum number of entries the table should hold before
+    it needs to grow.
+    @return pointer to a new table.
+*/
+OpenMap *makeOpenMap( int len );
+
+/** Get the number of key/value pairs in the given table.
+    @param m Pointer to the table.
+    @return Number of key/value pairs in the table. */
+int openMapSize( OpenMap *m );
+
+/** Get the number of slots in the given table.
+    @param m Pointer to the table.
+    @return Number of slots in the table. */
+int openMapCapacity( OpenMap *m );
+
+/** Counters kept by a table when compiled with MAP_STATS defined. */
+typedef struct {
+  /** Number of lookups, inserts and removes. */
+  long gets, sets, removes;
+
+  /** Total slots examined by lookups, inserts and removes. */
+  long getProbes, setProbes, removeProbes;
+
+  /** Number of times the table grew. */
+  long expansions;
+
+  /** Time spent growing the table, in seconds. */
+  double expandSeconds;
+} OpenMapCounters;
+
+/** Get the table's counters, which are all zero unless the table was
+    compiled with MAP_STATS defined.
+    @param m Pointer to the table.
+    @param c Returns the counters.
+*/
+void openMapCounters( OpenMap *m, OpenMapCounters *c );
+
+/** Count the entries at each distance from their home slot.
+    @param m Pointer to the table.
+    @param hist Array where hist[ i ] receives the number of entries i
+    slots from home. The last element counts everything further.
+    @param len Length of hist.
+    @return Number of bytes allocated for the table.
+*/
+long openMapHistogram( OpenMap *m, int *hist, int len );
+
+/** Adds the given key/value pair to the table, replacing (and
+    destroying) the old value and the given key if the key is already
+    present. The table takes ownership of both key and val.
+    @param m Pointer to the table to add to.
+    @param key Key of the value to add.
+    @param val Value to add.
+    @param h Hash of the key.
+*/
+void openMapSet( OpenMap *m, VType *key, VType *val, unsigned int h );
+
+/** Return the value associated with the given key. The returned VType
+    is still owned by the table.
+    @param m Table to query.
+    @param key Key to look for.
+    @param h Hash of the key.
+    @return Value associated with the key, or NULL if it isn't present.
+*/
+VType *openMapGet( OpenMap *m, VType *key, unsigned int h );
+
+/** Removes and destroys the key/value pair associated with the given key.
+    @param m Table to remove from.
+    @param key Key to remove.
+    @param h Hash of the key.
+    @return true if the key was in the table.
+*/
+bool openMapRemove( OpenMap *m, VType *key, unsigned int h );
+
+/** Make sure the table can hold at least n entries without growing,
+    and keep it from shrinking below that.
+    @param m Table to reserve space in.
+    @param n Number of entries to make room for.
+*/
+void openMapReserve( OpenMap *m, int n );
+
+/** Shrink the table to the fewest slots that hold its entries, and
+    let it shrink as far as that again as entries are removed.
+    @param m Table to shrink.
+*/
+void openMapShrinkToFit( OpenMap *m );
+
+/** Call the given function for each key/value pair in the table.
+    @param m Table to visit.
+    @param visit Function called with each key, its value and arg.
+    @param arg Extra argument passed to visit.
+*/
+void openMapForEach( OpenMap *m,
+                     void (*visit)( VType const *key, VType const *val, void *arg ),
+                     void *arg );
+
+/** Free all the memory used by the table, including its key/value pairs.
+    @param m The table to free.
+*/
+void freeOpenMap( OpenMap *m );
+
+#endif
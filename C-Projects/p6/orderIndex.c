@@ -0,0 +1,208 @@
+/**
+    @file orderIndex.c
+    @author Christopher Fields (cwfields)
+    Skip list implementation of the ordered index. Each node is linked
+    into a random number of levels, with each level holding about a
+    quarter of the nodes of the level below, so a search skips over
+    most of the list and takes O(log n) time on average.
+*/
+
+#include "orderIndex.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "integer.h"
+#include "text.h"
+#include "pool.h"
+
+/** Largest number of levels a node can be linked into. With a quarter
+    of the nodes on each level, this is plenty for 2^32 keys. */
+#define MAX_LEVEL 16
+
+/** A key and value in the skip list. */
+typedef struct IndexNodeStruct {
+  /** Key, owned by the map. */
+  VType *key;
+
+  /** Value for the key, owned by the map. */
+  VType *val;
+
+  /** Number of levels this node is linked into. */
+  int height;
+
+  /** Next node on each level this node is linked into. */
+  struct IndexNodeStruct *next[];
+} IndexNode;
+
+/** Representation of the skip list. */
+struct OrderIndexStruct {
+  /** First node on each level. */
+  IndexNode *head[ MAX_LEVEL ];
+
+  /** Number of levels in use. */
+  int levels;
+
+  /** Number of keys in the index. */
+  int size;
+
+  /** Total number of links in all the nodes, for measuring memory. */
+  long links;
+
+  /** State of the random number generator used to pick node heights. */
+  unsigned int seed;
+};
+
+int compareVType( VType const *a, VType const *b )
+{
+  bool aInt = isInteger( a ), bInt = isInteger( b );
+  if ( aInt != bInt )
+    return aInt ? -1 : 1;
+
+  if ( aInt ) {
+    int x = ( (Integer const *) a )->val, y = ( (Integer const *) b )->val;
+    return ( x > y ) - ( x < y );
+  }
+
+  int alen = textLength( a ), blen = textLength( b );
+  int cmp = memcmp( textValue( a ), textValue( b ), alen < blen ? alen : blen );
+  if ( cmp )
+    return cmp;
+  return ( alen > blen ) - ( alen < blen );
+}
+
+OrderIndex *makeOrderIndex( void )
+{
+  OrderIndex *idx = (OrderIndex *) malloc( sizeof( OrderIndex ) );
+  for ( int i = 0; i < MAX_LEVEL; i++ )
+    idx->head[ i ] = NULL;
+  idx->levels = 1;
+  idx->size = 0;
+  idx->links = 0;
+  idx->seed = 2463534242u;
+  return idx;
+}
+
+/**
+   Helper method to choose the height of a new node, so each level has
+   about a quarter of the nodes of the level below.
+
+   @param idx the index the node is for
+   @return the number of levels to link the node into
+ */
+static int randomHeight( OrderIndex *idx )
+{
+  unsigned int x = idx->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  idx->seed = x;
+
+  // Each pair of zero bits adds a level
+  int height = 1;
+  while ( height < MAX_LEVEL && ( x & 3 ) == 0 ) {
+    height++;
+    x >>= 2;
+  }
+  return height;
+}
+
+/**
+   Helper method to find, on each level, the link that a node for the
+   given key would follow. The first of these is where the key's node
+   is, or would go, on the bottom level.
+
+   @param idx the index to search
+   @param key the key to search for
+   @param prev filled in with the address of that link on each level
+ */
+static void findLinks( OrderIndex *idx, VType const *key, IndexNode **prev[ MAX_LEVEL ] )
+{
+  IndexNode *last = NULL; // Last node passed, or NULL for the head
+  for ( int lev = idx->levels - 1; lev >= 0; lev-- ) {
+    IndexNode **link = last ? &last->next[ lev ] : &idx->head[ lev ];
+    while ( *link && compareVType( ( *link )->key, key ) < 0 ) {
+      last = *link;
+      link = &last->next[ lev ];
+    }
+    prev[ lev ] = link;
+  }
+}
+
+void orderIndexSet( OrderIndex *idx, VType *key, VType *val )
+{
+  IndexNode **prev[ MAX_LEVEL ];
+  findLinks( idx, key, prev );
+
+  IndexNode *found = *prev[ 0 ];
+  if ( found && compareVType( found->key, key ) == 0 ) {
+    found->val = val;
+    return;
+  }
+
+  int height = randomHeight( idx );
+  for ( ; idx->levels < height; idx->levels++ )
+    prev[ idx->levels ] = &idx->head[ idx->levels ];
+
+  IndexNode *n = poolAlloc( sizeof( IndexNode ) + height * sizeof( IndexNode * ) );
+  n->key = key;
+  n->val = val;
+  n->height = height;
+  for ( int lev = 0; lev < height; lev++ ) {
+    n->next[ lev ] = *prev[ lev ];
+    *prev[ lev ] = n;
+  }
+  idx->size++;
+  idx->links += height;
+}
+
+bool orderIndexRemove( OrderIndex *idx, VType const *key )
+{
+  IndexNode **prev[ MAX_LEVEL ];
+  findLinks( idx, key, prev );
+
+  IndexNode *n = *prev[ 0 ];
+  if ( ! n || compareVType( n->key, key ) != 0 )
+    return false;
+
+  for ( int lev = 0; lev < n->height; lev++ )
+    *prev[ lev ] = n->next[ lev ];
+  while ( idx->levels > 1 && ! idx->head[ idx->levels - 1 ] )
+    idx->levels--;
+
+  idx->size--;
+  idx->links -= n->height;
+  poolFree( n, sizeof( IndexNode ) + n->height * sizeof( IndexNode * ) );
+  return true;
+}
+
+void orderIndexRange( OrderIndex *idx, VType const *lo, VType const *hi,
+                      void (*visit)( VType const *key, VType const *val, void *arg ),
+                      void *arg )
+{
+  IndexNode *n = idx->head[ 0 ];
+  if ( lo ) {
+    IndexNode **prev[ MAX_LEVEL ];
+    findLinks( idx, lo, prev );
+    n = *prev[ 0 ];
+  }
+
+  for ( ; n && ( ! hi || compareVType( n->key, hi ) <= 0 ); n = n->next[ 0 ] )
+    visit( n->key, n->val, arg );
+}
+
+long orderIndexBytes( OrderIndex *idx )
+{
+  return sizeof( OrderIndex ) + idx->size * sizeof( IndexNode ) +
+    idx->links * sizeof( IndexNode * );
+}
+
+void freeOrderIndex( OrderIndex *idx )
+{
+  IndexNode *n = idx->head[ 0 ];
+  while ( n ) {
+    IndexNode *next = n->next[ 0 ];
+    poolFree( n, sizeof( IndexNode ) + n->height * sizeof( IndexNode * ) );
+    n = next;
+  }
+  free( idx );
+}
@@ -0,0 +1,73 @@
+/**
+    @file orderIndex.h
+    @author Christopher Fields (cwfields)
+    Header for the ordered index component, a skip list that a Map can
+    keep alongside its hash table so keys can be visited in order and
+    range scans take O(log n + k) time instead of a pass over every
+    bucket. The index doesn't own the keys and values it refers to;
+    the map that maintains it does.
+*/
+
+#ifndef ORDERINDEX_H
+#define ORDERINDEX_H
+
+#include "vtype.h"
+#include <stdbool.h>
+
+/** Incomplete type for the ordered index representation. */
+typedef struct OrderIndexStruct OrderIndex;
+
+/** Compare two keys. Every Integer comes before every Text, Integers
+    are ordered by value and Texts are ordered byte by byte, with a
+    shorter Text before any longer Text it's a prefix of.
+    @param a Left-hand key.
+    @param b Right-hand key.
+    @return negative, zero or positive as a is less than, equal to or
+    greater than b.
+*/
+int compareVType( VType const *a, VType const *b );
+
+/** Make an empty index.
+    @return pointer to a new index.
+*/
+OrderIndex *makeOrderIndex( void );
+
+/** Add a key to the index, or change the value recorded for it if an
+    equal key is already there (keeping the key that was there).
+    @param idx Index to add to.
+    @param key Key to add.
+    @param val Value to record for the key.
+*/
+void orderIndexSet( OrderIndex *idx, VType *key, VType *val );
+
+/** Remove the key equal to the given one from the index.
+    @param idx Index to remove from.
+    @param key Key to remove.
+    @return true if the key was in the index.
+*/
+bool orderIndexRemove( OrderIndex *idx, VType const *key );
+
+/** Call the given function for each key from lo to hi (inclusive), in
+    order, along with its value.
+    @param idx Index to scan.
+    @param lo Smallest key to visit, or NULL to start at the first key.
+    @param hi Largest key to visit, or NULL to continue to the last key.
+    @param visit Function called with each key, its value and arg.
+    @param arg Extra argument passed to visit.
+*/
+void orderIndexRange( OrderIndex *idx, VType const *lo, VType const *hi,
+                      void (*visit)( VType const *key, VType const *val, void *arg ),
+                      void *arg );
+
+/** Get the number of bytes allocated for the index.
+    @param idx Index to measure.
+    @return Number of bytes used by the index, not counting keys and values.
+*/
+long orderIndexBytes( OrderIndex *idx );
+
+/** Free the index. The keys and values it refers to aren't freed.
+    @param idx The index to free.
+*/
+void freeOrderIndex( OrderIndex *idx );
+
+#endif
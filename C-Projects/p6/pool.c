@@ -0,0 +1,326 @@
+/**
+    @file pool.c
+    @author Christopher Fields (cwfields)
+    Implementation of the pool component. Slabs carve objects out of
+    large chunks of memory, keeping a free list of returned objects and
+    a pointer to the unused part of the newest chunk. The value arena
+    is an array of slabs, one for each multiple of SIZE_STEP bytes up
+    to MAX_POOLED. Each thread has its own arena, so values can be
+    allocated and freed from many threads without locking. Chunks for
+    the arenas are recorded in one shared list, taking a lock only when
+    a new chunk is needed, so freePool can release them all.
+
+    A thread's free list for each size class holds at most CACHE_BYTES.
+    Past that, the thread hands the whole list to a shared depot as one
+    batch, and a thread that runs out of freed objects takes a batch
+    from the depot before carving into a new chunk. So memory freed by
+    one thread is reused by the others, a thread that only frees what
+    others allocate can't build up an unbounded list, and a thread's
+    list isn't lost when it exits. Chunks still aren't returned to the
+    system until freePool, so the arenas hold onto their peak use.
+*/
+
+#include "pool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/** Number of bytes in each chunk a slab allocates. */
+#define CHUNK_BYTES 65536
+
+/** Space reserved at the start of each chunk for linking the chunks of
+    a slab, kept large enough that objects stay aligned. */
+#define CHUNK_HEADER 16
+
+/** Objects are rounded up to a multiple of this many bytes. */
+#define ALIGNMENT 8
+
+/** Difference in size between consecutive size classes in the arena. */
+#define SIZE_STEP 16
+
+/** Largest request handled by the arena instead of malloc. */
+#define MAX_POOLED 256
+
+/** Number of size classes in the value arena. */
+#define CLASSES ( MAX_POOLED / SIZE_STEP )
+
+/** Most bytes of freed objects a thread keeps in each size class. */
+#define CACHE_BYTES CHUNK_BYTES
+
+/** A free object, reused to link it to the other free objects. */
+typedef struct FreeObjStruct {
+  /** Next free object in the slab. */
+  struct FreeObjStruct *next;
+
+  /** For the first object of a batch in the depot, the next batch. */
+  struct FreeObjStruct *nextBatch;
+} FreeObj;
+
+/** Header at the start of each chunk. */
+typedef struct ChunkStruct {
+  /** Next (older) chunk belonging to the same slab. */
+  struct ChunkStruct *next;
+} Chunk;
+
+/** Representation of a slab. */
+struct SlabStruct {
+  /** Size of each object, after rounding for alignment. */
+  size_t objSize;
+
+  /** Number of objects that fit in each chunk. */
+  size_t perChunk;
+
+  /** List of all chunks allocated by this slab. */
+  Chunk *chunks;
+
+  /** List of objects that have been freed and can be reused. */
+  FreeObj *freeList;
+
+  /** Number of objects in freeList. */
+  size_t freeCount;
+
+  /** Next never-used object in the newest chunk. */
+  char *next;
+
+  /** End of the newest chunk. */
+  char *end;
+
+  /** True if this slab's chunks are recorded in the shared arena list
+      instead of its own chunks list. */
+  bool shared;
+};
+
+/** Slabs for each size class in this thread's value arena. A slab with
+    an objSize of zero hasn't been used yet. */
+static __thread Slab arena[ CLASSES ];
+
+/** Every chunk allocated for any thread's value arena. */
+static Chunk *arenaChunks;
+
+/** Batches of freed objects handed over by the arenas, for each size
+    class. Read without the lock only to see if it's empty. */
+static FreeObj *depot[ CLASSES ];
+
+/** Lock protecting arenaChunks and depot. */
+static pthread_mutex_t arenaLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Key whose destructor hands a thread's freed objects to the depot. */
+static pthread_key_t arenaKey;
+
+/** Makes arenaKey the first time any thread uses its arena. */
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+
+/**
+   Helper function to fill in the fields of a new, empty slab.
+
+   @param s slab to initialize
+   @param objSize size of each object the slab will hand out
+   @param shared true if the slab is part of a value arena
+ */
+static void initSlab( Slab *s, size_t objSize, bool shared )
+{
+  // Each object must be big enough to link into the free list.
+  if ( objSize < sizeof( FreeObj ) )
+    objSize = sizeof( FreeObj );
+  s->objSize = ( objSize + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT;
+
+  s->perChunk = ( CHUNK_BYTES - CHUNK_HEADER ) / s->objSize;
+  if ( s->perChunk < 1 )
+    s->perChunk = 1;
+
+  s->chunks = NULL;
+  s->freeList = NULL;
+  s->freeCount = 0;
+  s->next = NULL;
+  s->end = NULL;
+  s->shared = shared;
+}
+
+Slab *makeSlab( size_t objSize )
+{
+  Slab *s = (Slab *) malloc( sizeof( Slab ) );
+  initSlab( s, objSize, false );
+  return s;
+}
+
+void *slabAlloc( Slab *s )
+{
+  // Reuse a freed object if there is one.
+  if ( s->freeList ) {
+    FreeObj *obj = s->freeList;
+    s->freeList = obj->next;
+    s->freeCount--;
+    return obj;
+  }
+
+  // Start a new chunk if the newest one is used up.
+  if ( s->next == s->end ) {
+    Chunk *c = (Chunk *) malloc( CHUNK_HEADER + s->perChunk * s->objSize );
+    if ( s->shared ) {
+      pthread_mutex_lock( &arenaLock );
+      c->next = arenaChunks;
+      arenaChunks = c;
+      pthread_mutex_unlock( &arenaLock );
+    } else {
+      c->next = s->chunks;
+      s->chunks = c;
+    }
+    s->next = (char *) c + CHUNK_HEADER;
+    s->end = s->next + s->perChunk * s->objSize;
+  }
+
+  void *p = s->next;
+  s->next += s->objSize;
+  return p;
+}
+
+void slabFree( Slab *s, void *p )
+{
+  FreeObj *obj = (FreeObj *) p;
+  obj->next = s->freeList;
+  s->freeList = obj;
+  s->freeCount++;
+}
+
+void freeSlab( Slab *s )
+{
+  // Individual objects don't need to be freed, just the chunks.
+  while ( s->chunks ) {
+    Chunk *c = s->chunks;
+    s->chunks = c->next;
+    free( c );
+  }
+  free( s );
+}
+
+/**
+   Helper function to hand all of a slab's freed objects to the depot
+   as one batch.
+
+   @param s slab in the current thread's arena
+   @param cls size class of the slab
+ */
+static void giveBatch( Slab *s, int cls )
+{
+  if ( ! s->freeList )
+    return;
+  pthread_mutex_lock( &arenaLock );
+  s->freeList->nextBatch = depot[ cls ];
+  __atomic_store_n( &depot[ cls ], s->freeList, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &arenaLock );
+  s->freeList = NULL;
+  s->freeCount = 0;
+}
+
+/**
+   Helper function to refill a slab's empty free list with a batch from
+   the depot, if there is one.
+
+   @param s slab in the current thread's arena
+   @param cls size class of the slab
+ */
+static void takeBatch( Slab *s, int cls )
+{
+  if ( ! __atomic_load_n( &depot[ cls ], __ATOMIC_RELAXED ) )
+    return;
+  pthread_mutex_lock( &arenaLock );
+  FreeObj *batch = depot[ cls ];
+  if ( batch )
+    __atomic_store_n( &depot[ cls ], batch->nextBatch, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &arenaLock );
+
+  s->freeList = batch;
+  for ( FreeObj *obj = batch; obj; obj = obj->next )
+    s->freeCount++;
+}
+
+/**
+   Helper function called as a thread exits, to hand its arena's freed
+   objects, and the unused part of each newest chunk, to the depot.
+
+   @param arg the thread's arena
+ */
+static void releaseArena( void *arg )
+{
+  Slab *slabs = (Slab *) arg;
+  for ( int cls = 0; cls < CLASSES; cls++ ) {
+    Slab *s = &slabs[ cls ];
+    if ( s->objSize == 0 )
+      continue;
+    for ( ; s->next != s->end; s->next += s->objSize )
+      slabFree( s, s->next );
+    giveBatch( s, cls );
+  }
+}
+
+/**
+   Helper function to make the key that runs releaseArena.
+ */
+static void makeArenaKey( void )
+{
+  pthread_key_create( &arenaKey, releaseArena );
+}
+
+/**
+   Helper function to get a slab from the current thread's arena,
+   setting it up on first use.
+
+   @param cls size class of the slab
+   @return the slab
+ */
+static Slab *arenaSlab( int cls )
+{
+  Slab *s = &arena[ cls ];
+  if ( s->objSize == 0 ) {
+    initSlab( s, ( cls + 1 ) * SIZE_STEP, true );
+    pthread_once( &arenaOnce, makeArenaKey );
+    pthread_setspecific( arenaKey, arena );
+  }
+  return s;
+}
+
+void *poolAlloc( size_t size )
+{
+  if ( size == 0 || size > MAX_POOLED )
+    return malloc( size );
+
+  int cls = ( size - 1 ) / SIZE_STEP;
+  Slab *s = arenaSlab( cls );
+  if ( ! s->freeList )
+    takeBatch( s, cls );
+  return slabAlloc( s );
+}
+
+void poolFree( void *p, size_t size )
+{
+  if ( size == 0 || size > MAX_POOLED ) {
+    free( p );
+    return;
+  }
+
+  // The memory may have come from another thread's arena, but every
+  // object in a size class is the same size, so it can be reused here.
+  int cls = ( size - 1 ) / SIZE_STEP;
+  Slab *s = arenaSlab( cls );
+  if ( s->freeCount * s->objSize >= CACHE_BYTES )
+    giveBatch( s, cls );
+  slabFree( s, p );
+}
+
+void freePool( void )
+{
+  pthread_mutex_lock( &arenaLock );
+  while ( arenaChunks ) {
+    Chunk *c = arenaChunks;
+    arenaChunks = c->next;
+    free( c );
+  }
+  for ( int i = 0; i < CLASSES; i++ )
+    __atomic_store_n( &depot[ i ], NULL, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &arenaLock );
+
+  // Forget about the freed chunks in this thread's arena.
+  for ( int i = 0; i < CLASSES; i++ )
+    arena[ i ].objSize = 0;
+}
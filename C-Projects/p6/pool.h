@@ -0,0 +1,68 @@
+/**
+    @file pool.h
+    @author Christopher Fields (cwfields)
+    Header for the pool component, which provides pooled memory
+    allocation for the map program. A Slab hands out objects of a single
+    size carved from large chunks and releases all of its chunks at once
+    when it's freed. The value arena is a set of shared slabs for small
+    sizes (size classes) used for VType objects and their contents, with
+    larger requests passed on to malloc. Each thread has its own value
+    arena, so poolAlloc and poolFree are safe to call from any thread.
+    A thread keeps a bounded amount of freed memory for itself and
+    shares the rest with the other threads, including everything it
+    kept once it exits. The arena's chunks are only returned to the
+    system by freePool. A Slab itself isn't synchronized.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/** Incomplete type for a slab of same-sized objects. */
+typedef struct SlabStruct Slab;
+
+/** Make an empty slab for objects of the given size.
+    @param objSize Size of each object the slab will hand out.
+    @return pointer to a new slab.
+*/
+Slab *makeSlab( size_t objSize );
+
+/** Get memory for one object from the given slab.
+    @param s Slab to allocate from.
+    @return pointer to uninitialized memory for one object.
+*/
+void *slabAlloc( Slab *s );
+
+/** Give an object back to the slab it came from, so it can be reused.
+    @param s Slab the object was allocated from.
+    @param p Pointer to the object.
+*/
+void slabFree( Slab *s, void *p );
+
+/** Free a slab along with every object allocated from it, whether or
+    not they were given back with slabFree.
+    @param s The slab to free.
+*/
+void freeSlab( Slab *s );
+
+/** Get memory from the value arena.
+    @param size Number of bytes needed.
+    @return pointer to uninitialized memory of at least size bytes.
+*/
+void *poolAlloc( size_t size );
+
+/** Give memory back to the value arena.
+    @param p Pointer returned by poolAlloc.
+    @param size The size that was passed to poolAlloc for p.
+*/
+void poolFree( void *p, size_t size );
+
+/** Release all of the memory held by the value arena. This should only
+    be called once every value allocated with poolAlloc is freed and
+    no other thread will use the arena again, for example just before
+    the program exits.
+*/
+void freePool( void );
+
+#endif
@@ -0,0 +1,258 @@
+/**
+    @file rcuBench.c
+    @author Christopher Fields (cwfields)
+    Benchmark for reader scalability. Runs a growing number of reader
+    threads doing lookups while one writer thread adds keys to a map
+    that starts out small, so its table grows under the readers, and
+    then keeps replacing values. It runs first against the lock-free
+    RcuMap and then against the lock-striped ConcurrentMap, and reports
+    lookups per second. Readers only look up keys the writer has
+    finished adding, and check every value they see, so a lookup that
+    misses during a resize or a value reclaimed too early shows up as a
+    failed assertion. Build it with -fsanitize=thread to check the
+    maps' synchronization as well.
+
+    Usage: rcuBench [max-readers [milliseconds [keys]]]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "vtype.h"
+#include "integer.h"
+#include "rcuMap.h"
+#include "concurrentMap.h"
+
+/** Default largest number of reader threads. */
+#define DEFAULT_READERS 8
+
+/** Default length of each run in milliseconds. */
+#define DEFAULT_MILLIS 500
+
+/** Default number of different keys. */
+#define DEFAULT_KEYS 100000
+
+/** Number of shards used for the ConcurrentMap. */
+#define SHARDS 64
+
+/** Initial table length for each map, and how many keys it starts with. */
+#define INITIAL_KEYS 16
+
+/** Settings and results shared by the threads in a run. */
+typedef struct {
+  /** True to test an RcuMap, false for a ConcurrentMap. */
+  bool lockFree;
+
+  /** Map being tested, if it's an RcuMap. */
+  RcuMap *rcu;
+
+  /** Map being tested, if it's a ConcurrentMap. */
+  ConcurrentMap *striped;
+
+  /** Number of different keys. */
+  int keys;
+
+  /** Number of keys the writer has added so far, keys 0 up to this. */
+  int added;
+
+  /** Set when the threads should stop. */
+  bool stop;
+
+  /** Total lookups done by all the readers. */
+  long lookups;
+
+  /** Number of values replaced by the writer. */
+  long writes;
+} Run;
+
+/** Work for one reader thread. */
+typedef struct {
+  /** Run the reader is part of. */
+  Run *run;
+
+  /** Index of the reader, used to seed its random numbers. */
+  int id;
+} Reader;
+
+/**
+   Small, fast random number generator (xorshift).
+   @param state Generator state, updated on each call.
+   @return the next random value.
+ */
+static unsigned int nextRandom( unsigned int *state )
+{
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+   Visitor that checks a value from the ConcurrentMap.
+   @param val Value found in the map.
+   @param arg Pointer to the key it was found for, and the key count.
+ */
+static void checkValue( VType const *val, void *arg )
+{
+  int const *k = (int const *) arg;
+  assert( ( (Integer const *) val )->val % k[ 1 ] == k[ 0 ] );
+}
+
+/**
+   Reader thread, looking up random keys until told to stop.
+   @param arg The reader's work.
+   @return NULL
+ */
+static void *readerThread( void *arg )
+{
+  Reader *r = (Reader *) arg;
+  Run *run = r->run;
+  unsigned int state = 2463534242u + r->id;
+  EpochReader *er = run->rcu ? rcuMapReader( run->rcu ) : NULL;
+  long count = 0;
+
+  while ( ! __atomic_load_n( &run->stop, __ATOMIC_RELAXED ) ) {
+    int added = __atomic_load_n( &run->added, __ATOMIC_ACQUIRE );
+    int k[ 2 ] = { nextRandom( &state ) % added, run->keys };
+    VType *key = makeInteger( k[ 0 ] );
+    if ( er ) {
+      rcuMapReadLock( er );
+      VType *v = rcuMapGet( run->rcu, key );
+      assert( v );
+      checkValue( v, k );
+      rcuMapReadUnlock( er );
+    } else
+      assert( cmapGet( run->striped, key, checkValue, k ) );
+    key->destroy( key );
+    count++;
+  }
+
+  if ( er )
+    epochUnregister( er );
+  __atomic_fetch_add( &run->lookups, count, __ATOMIC_RELAXED );
+  return NULL;
+}
+
+/**
+   Writer thread, adding the rest of the keys and then replacing values
+   until told to stop. The value for key k is always congruent to k
+   modulo the number of keys.
+   @param arg The run.
+   @return NULL
+ */
+static void *writerThread( void *arg )
+{
+  Run *run = (Run *) arg;
+  unsigned int state = 88675123u;
+  long count = 0;
+
+  while ( ! __atomic_load_n( &run->stop, __ATOMIC_RELAXED ) ) {
+    // Readers may look a key up as soon as added counts it.
+    int k = run->added < run->keys ? run->added : nextRandom( &state ) % run->keys;
+    int v = k + run->keys * (int) ( nextRandom( &state ) % 1000 );
+    if ( run->rcu )
+      rcuMapSet( run->rcu, makeInteger( k ), makeInteger( v ) );
+    else
+      cmapSet( run->striped, makeInteger( k ), makeInteger( v ) );
+    if ( k == run->added )
+      __atomic_store_n( &run->added, k + 1, __ATOMIC_RELEASE );
+    count++;
+  }
+
+  run->writes = count;
+  return NULL;
+}
+
+/**
+   Run readers and a writer against a new, small map of the run's kind
+   for the given time.
+   @param run Kind of map and settings for the run.
+   @param readers Number of reader threads.
+   @param millis How long to run.
+   @return lookups per second across all readers.
+ */
+static double timeRun( Run *run, int readers, int millis )
+{
+  bool rcu = run->lockFree;
+  run->rcu = rcu ? makeRcuMap( INITIAL_KEYS ) : NULL;
+  run->striped = rcu ? NULL : makeConcurrentMap( INITIAL_KEYS, SHARDS, NULL );
+  for ( int k = 0; k < INITIAL_KEYS && k < run->keys; k++ ) {
+    if ( rcu )
+      rcuMapSet( run->rcu, makeInteger( k ), makeInteger( k ) );
+    else
+      cmapSet( run->striped, makeInteger( k ), makeInteger( k ) );
+  }
+  run->added = INITIAL_KEYS < run->keys ? INITIAL_KEYS : run->keys;
+  run->stop = false;
+  run->lookups = 0;
+  run->writes = 0;
+
+  pthread_t writer;
+  pthread_t *tid = (pthread_t *) malloc( readers * sizeof( pthread_t ) );
+  Reader *work = (Reader *) malloc( readers * sizeof( Reader ) );
+
+  pthread_create( &writer, NULL, writerThread, run );
+  for ( int i = 0; i < readers; i++ ) {
+    work[ i ] = (Reader) { run, i };
+    pthread_create( &tid[ i ], NULL, readerThread, &work[ i ] );
+  }
+
+  struct timespec pause = { millis / 1000, ( millis % 1000 ) * 1000000L };
+  nanosleep( &pause, NULL );
+  __atomic_store_n( &run->stop, true, __ATOMIC_RELAXED );
+
+  for ( int i = 0; i < readers; i++ )
+    pthread_join( tid[ i ], NULL );
+  pthread_join( writer, NULL );
+  free( tid );
+  free( work );
+
+  if ( rcu ) {
+    assert( rcuMapSize( run->rcu ) == run->added );
+    freeRcuMap( run->rcu );
+  } else {
+    assert( cmapSize( run->striped ) == run->added );
+    freeConcurrentMap( run->striped );
+  }
+  return run->lookups / ( millis / 1000.0 );
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  int maxReaders = argc > 1 ? atoi( argv[ 1 ] ) : DEFAULT_READERS;
+  int millis = argc > 2 ? atoi( argv[ 2 ] ) : DEFAULT_MILLIS;
+  int keys = argc > 3 ? atoi( argv[ 3 ] ) : DEFAULT_KEYS;
+  if ( maxReaders < 1 || millis < 1 || keys < 1 ) {
+    fprintf( stderr, "usage: rcuBench [max-readers [milliseconds [keys]]]\n" );
+    return EXIT_FAILURE;
+  }
+
+  // Each run makes its own map.
+  Run rcu = { true, NULL, NULL, keys };
+  Run striped = { false, NULL, NULL, keys };
+
+  printf( "Lookups per second with one writer adding, then replacing, %d keys\n", keys );
+  printf( "%8s %14s %14s\n", "readers", "RcuMap", "ConcurrentMap" );
+  for ( int n = 1; ; n = n * 2 < maxReaders ? n * 2 : maxReaders ) {
+    double a = timeRun( &rcu, n, millis );
+    double b = timeRun( &striped, n, millis );
+    printf( "%8d %14.0f %14.0f\n", n, a, b );
+    if ( n == maxReaders )
+      break;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+/**
+    @file rcuMap.c
+    @author Christopher Fields (cwfields)
+    Implementation of the RCU map as a chained hash table whose bucket
+    and next pointers are only changed with atomic stores. A node is
+    fully built before it's linked in, so a reader following pointers
+    always sees complete nodes. Replaced values and removed nodes are
+    retired to the map's epoch domain. Growing the table copies the
+    nodes into a new table that's published with one pointer store;
+    the old table is retired along with its nodes, leaving their keys
+    and values to the copies.
+*/
+
+#include "rcuMap.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/** Mutlpilier to change capacity by if size reaches capacity of table */
+#define CAP_MULTIPLIER 2
+
+/** Node containing a key / value pair. */
+typedef struct NodeStruct {
+  /** Pointer to the key part of the key / value pair. */
+  VType *key;
+
+  /** Pointer to the value part of the key / value pair. */
+  VType *val;
+
+  /** Pointer to the next node in the same bucket. */
+  struct NodeStruct *next;
+
+  /** Hash of the key. */
+  unsigned int hash;
+} Node;
+
+/** A hash table, replaced as a whole when the map grows. */
+typedef struct {
+  /** Number of buckets. */
+  int len;
+
+  /** Heads of the bucket lists. */
+  Node *buckets[];
+} Table;
+
+/** Representation of an RCU map. */
+struct RcuMapStruct {
+  /** Current table, read by readers without locking. */
+  Table *table;
+
+  /** Number of key / value pairs in the map. */
+  int size;
+
+  /** Lock held by writers. */
+  pthread_mutex_t lock;
+
+  /** Domain for retiring anything readers might still see. */
+  Epoch *epoch;
+};
+
+/**
+   Helper function to make a table of empty buckets.
+
+   @param len number of buckets
+   @return the new table
+ */
+static Table *makeTable( int len )
+{
+  Table *t = (Table *) calloc( 1, sizeof( Table ) + len * sizeof( Node * ) );
+  t->len = len;
+  return t;
+}
+
+/**
+   Release function for a replaced value.
+
+   @param obj the VType to destroy
+ */
+static void releaseValue( void *obj )
+{
+  VType *v = (VType *) obj;
+  v->destroy( v );
+}
+
+/**
+   Release function for a removed node, destroying its key and value.
+
+   @param obj the Node to free
+ */
+static void releaseNode( void *obj )
+{
+  Node *n = (Node *) obj;
+  n->key->destroy( n->key );
+  n->val->destroy( n->val );
+  free( n );
+}
+
+/**
+   Release function for a table that was replaced by a larger one. Its
+   nodes were all copied into the new table, which now owns their keys
+   and values, so just the nodes and the table are freed.
+
+   @param obj the Table to free
+ */
+static void releaseTable( void *obj )
+{
+  Table *t = (Table *) obj;
+  for ( int i = 0; i < t->len; i++ ) {
+    Node *current = t->buckets[ i ];
+    while ( current ) {
+      Node *next = current->next;
+      free( current );
+      current = next;
+    }
+  }
+  free( t );
+}
+
+RcuMap *makeRcuMap( int len )
+{
+  RcuMap *m = (RcuMap *) malloc( sizeof( RcuMap ) );
+  m->table = makeTable( len > 0 ? len : 1 );
+  m->size = 0;
+  pthread_mutex_init( &m->lock, NULL );
+  m->epoch = makeEpoch();
+  return m;
+}
+
+EpochReader *rcuMapReader( RcuMap *m )
+{
+  return epochRegister( m->epoch );
+}
+
+void rcuMapReadLock( EpochReader *r )
+{
+  epochEnter( r );
+}
+
+void rcuMapReadUnlock( EpochReader *r )
+{
+  epochExit( r );
+}
+
+VType *rcuMapGet( RcuMap *m, VType *key )
+{
+  unsigned int h = key->hash( key );
+  Table *t = __atomic_load_n( &m->table, __ATOMIC_ACQUIRE );
+  Node *current = __atomic_load_n( &t->buckets[ h % t->len ], __ATOMIC_ACQUIRE );
+
+  while ( current ) {
+    if ( current->hash == h && current->key->equals( current->key, key ) )
+      return __atomic_load_n( &current->val, __ATOMIC_ACQUIRE );
+    current = __atomic_load_n( &current->next, __ATOMIC_ACQUIRE );
+  }
+  return NULL;
+}
+
+int rcuMapSize( RcuMap *m )
+{
+  return __atomic_load_n( &m->size, __ATOMIC_RELAXED );
+}
+
+/**
+   Helper function to copy every node into a larger table and publish
+   it. Must be called with the writer lock held.
+
+   @param m the map to expand
+ */
+static void expandRcuMap( RcuMap *m )
+{
+  Table *old = m->table;
+  Table *t = makeTable( CAP_MULTIPLIER * old->len );
+
+  for ( int i = 0; i < old->len; i++ ) {
+    for ( Node *current = old->buckets[ i ]; current; current = current->next ) {
+      Node *copy = (Node *) malloc( sizeof( Node ) );
+      *copy = *current;
+      int idx = copy->hash % t->len;
+      copy->next = t->buckets[ idx ];
+      t->buckets[ idx ] = copy;
+    }
+  }
+
+  // Readers see either the whole old table or the whole new one.
+  __atomic_store_n( &m->table, t, __ATOMIC_RELEASE );
+  epochRetire( m->epoch, old, releaseTable );
+}
+
+void rcuMapSet( RcuMap *m, VType *key, VType *val )
+{
+  pthread_mutex_lock( &m->lock );
+  if ( m->size >= m->table->len )
+    expandRcuMap( m );
+
+  unsigned int h = key->hash( key );
+  Table *t = m->table;
+  Node **head = &t->buckets[ h % t->len ];
+
+  for ( Node *current = *head; current; current = current->next ) {
+    if ( current->hash == h && current->key->equals( current->key, key ) ) {
+      // Swap in the new value, the old one may still be in use.
+      VType *old = __atomic_exchange_n( &current->val, val, __ATOMIC_ACQ_REL );
+      epochRetire( m->epoch, old, releaseValue );
+      key->destroy( key );
+      pthread_mutex_unlock( &m->lock );
+      return;
+    }
+  }
+
+  Node *node = (Node *) malloc( sizeof( Node ) );
+  node->key = key;
+  node->val = val;
+  node->hash = h;
+  node->next = *head;
+  __atomic_store_n( head, node, __ATOMIC_RELEASE );
+  __atomic_store_n( &m->size, m->size + 1, __ATOMIC_RELAXED );
+  pthread_mutex_unlock( &m->lock );
+}
+
+bool rcuMapRemove( RcuMap *m, VType *key )
+{
+  pthread_mutex_lock( &m->lock );
+  unsigned int h = key->hash( key );
+  Table *t = m->table;
+  Node **target = &t->buckets[ h % t->len ];
+
+  while ( *target && ( ( *target )->hash != h ||
+                       ! ( *target )->key->equals( ( *target )->key, key ) ) )
+    target = &( *target )->next;
+
+  Node *n = *target;
+  if ( n ) {
+    // Readers already on the node can still follow its next pointer.
+    __atomic_store_n( target, n->next, __ATOMIC_RELEASE );
+    epochRetire( m->epoch, n, releaseNode );
+    __atomic_store_n( &m->size, m->size - 1, __ATOMIC_RELAXED );
+  }
+
+  pthread_mutex_unlock( &m->lock );
+  return n != NULL;
+}
+
+void freeRcuMap( RcuMap *m )
+{
+  // Release everything retired first, then what's still in the table.
+  freeEpoch( m->epoch );
+
+  Table *t = m->table;
+  for ( int i = 0; i < t->len; i++ ) {
+    Node *current = t->buckets[ i ];
+    while ( current ) {
+      Node *next = current->next;
+      releaseNode( current );
+      current = next;
+    }
+  }
+
+  free( t );
+  pthread_mutex_destroy( &m->lock );
+  free( m );
+}
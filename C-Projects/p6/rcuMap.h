@@ -0,0 +1,85 @@
+/**
+    @file rcuMap.h
+    @author Christopher Fields (cwfields)
+    Header for the RCU map component, a thread-safe map for workloads
+    that are mostly lookups. Readers never take a lock: writers publish
+    new nodes and tables with atomic pointer stores, and anything a
+    reader might still be looking at is retired through the epoch
+    component instead of being destroyed right away. Writers are
+    serialized with a single lock.
+*/
+
+#ifndef RCUMAP_H
+#define RCUMAP_H
+
+#include "vtype.h"
+#include "epoch.h"
+#include <stdbool.h>
+
+/** Incomplete type for the RcuMap representation. */
+typedef struct RcuMapStruct RcuMap;
+
+/** Make an empty map.
+    @param len Initial length of the hash table.
+    @return pointer to a new map.
+*/
+RcuMap *makeRcuMap( int len );
+
+/** Register the calling thread as a reader of the map. Each thread
+    that calls rcuMapGet needs its own reader.
+    @param m The map to read.
+    @return the thread's reader record.
+*/
+EpochReader *rcuMapReader( RcuMap *m );
+
+/** Start a read-side critical section. Values returned by rcuMapGet
+    stay valid until rcuMapReadUnlock, even if they're replaced or
+    removed by a writer in the meantime.
+    @param r The thread's reader record.
+*/
+void rcuMapReadLock( EpochReader *r );
+
+/** End a read-side critical section.
+    @param r The thread's reader record.
+*/
+void rcuMapReadUnlock( EpochReader *r );
+
+/** Return the value associated with the given key. Must be called
+    between rcuMapReadLock and rcuMapReadUnlock. Never blocks.
+    @param m Map to query.
+    @param key Key to look for in the map.
+    @return Value associated with the given key, or NULL if the key
+    isn't in the map.
+*/
+VType *rcuMapGet( RcuMap *m, VType *key );
+
+/** Get the size of the given map.
+    @param m Pointer to the map.
+    @return Number of key/value pairs in the map. */
+int rcuMapSize( RcuMap *m );
+
+/**
+   Adds the given key/value pair to the given map, replacing the value
+   if the key is already in the map. The map takes ownership of both
+   key and val, as for mapSet.
+   @param m Pointer to the map to add to.
+   @param key Key of the value to add to Map.
+   @param val Value to add to the Map.
+ */
+void rcuMapSet( RcuMap *m, VType *key, VType *val );
+
+/**
+   Removes the key/value pair associated with the given key.
+   @param m Map to remove from.
+   @param key Key to remove.
+   @return true if the key was in the map.
+ */
+bool rcuMapRemove( RcuMap *m, VType *key );
+
+/** Free all the memory used to store a map, including all the memory
+    in its key/value pairs. No other thread may be using the map.
+    @param m The map to free.
+*/
+void freeRcuMap( RcuMap *m );
+
+#endif
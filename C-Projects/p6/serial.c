@@ -0,0 +1,102 @@
+/**
+    @file serial.c
+    @author Christopher Fields (cwfields)
+    Implementation of the serial component. Values are written through
+    the (buffered) FILE interface and read straight out of memory, so
+    a large file can be mapped and decoded without copying it first.
+*/
+
+#include "serial.h"
+#include "integer.h"
+#include "text.h"
+
+/** Tag byte for an Integer. */
+#define TAG_INTEGER 'I'
+
+/** Tag byte for a Text. */
+#define TAG_TEXT 'T'
+
+/**
+   Helper function to write a 32-bit number as four little-endian bytes.
+
+   @param fp file to write to
+   @param x number to write
+   @return true if it was written successfully
+ */
+static bool writeU32( FILE *fp, uint32_t x )
+{
+  unsigned char b[ 4 ] = { x, x >> 8, x >> 16, x >> 24 };
+  return fwrite( b, 1, sizeof( b ), fp ) == sizeof( b );
+}
+
+/**
+   Helper function to read a 32-bit number stored as four little-endian
+   bytes.
+
+   @param pos pointer to the position to read from, moved past the number
+   @param end end of the readable memory
+   @param x returns the number
+   @return true if there was room for the number
+ */
+static bool readU32( unsigned char const **pos, unsigned char const *end, uint32_t *x )
+{
+  unsigned char const *p = *pos;
+  if ( end - p < 4 )
+    return false;
+  *x = p[ 0 ] | p[ 1 ] << 8 | (uint32_t) p[ 2 ] << 16 | (uint32_t) p[ 3 ] << 24;
+  *pos = p + 4;
+  return true;
+}
+
+bool writeU64( FILE *fp, uint64_t x )
+{
+  return writeU32( fp, x ) && writeU32( fp, x >> 32 );
+}
+
+bool readU64( unsigned char const **pos, unsigned char const *end, uint64_t *x )
+{
+  uint32_t lo, hi;
+  if ( ! readU32( pos, end, &lo ) || ! readU32( pos, end, &hi ) )
+    return false;
+  *x = (uint64_t) hi << 32 | lo;
+  return true;
+}
+
+bool writeVType( FILE *fp, VType const *v )
+{
+  if ( isInteger( v ) )
+    return fputc( TAG_INTEGER, fp ) != EOF &&
+      writeU32( fp, ( (Integer const *) v )->val );
+
+  if ( isText( v ) ) {
+    int len = textLength( v );
+    return fputc( TAG_TEXT, fp ) != EOF && writeU32( fp, len ) &&
+      fwrite( textValue( v ), 1, len, fp ) == (size_t) len;
+  }
+
+  return false;
+}
+
+VType *readVType( unsigned char const **pos, unsigned char const *end )
+{
+  unsigned char const *p = *pos;
+  if ( p == end )
+    return NULL;
+
+  unsigned char tag = *p++;
+  uint32_t x;
+  if ( ! readU32( &p, end, &x ) )
+    return NULL;
+
+  VType *v = NULL;
+  if ( tag == TAG_INTEGER )
+    v = makeInteger( (int32_t) x );
+  else if ( tag == TAG_TEXT && x <= (uint32_t) ( end - p ) && x < INT32_MAX ) {
+    v = makeText( (char const *) p, x );
+    p += x;
+  }
+
+  if ( v )
+    *pos = p;
+  return v;
+}
@@ -0,0 +1,49 @@
+/**
+    @file serial.h
+    @author Christopher Fields (cwfields)
+    Header for the serial component, which converts VType values to and
+    from a compact binary form. An Integer is stored as a tag byte and
+    four bytes of value. A Text is stored as a tag byte, four bytes of
+    length and its characters. Multi-byte numbers are little-endian.
+*/
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "vtype.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Write the binary form of a value to a file.
+    @param fp File to write to.
+    @param v Value to write, which must be an Integer or a Text.
+    @return true if the value was written successfully.
+*/
+bool writeVType( FILE *fp, VType const *v );
+
+/** Make a value from its binary form in memory.
+    @param pos Pointer to the position to read from, moved past the
+    value if it's read successfully.
+    @param end End of the readable memory.
+    @return a new VType, or NULL if the memory doesn't hold a valid value.
+*/
+VType *readVType( unsigned char const **pos, unsigned char const *end );
+
+/** Write a number to a file as eight little-endian bytes.
+    @param fp File to write to.
+    @param x Number to write.
+    @return true if the number was written successfully.
+*/
+bool writeU64( FILE *fp, uint64_t x );
+
+/** Read a number stored as eight little-endian bytes.
+    @param pos Pointer to the position to read from, moved past the
+    number if it's read successfully.
+    @param end End of the readable memory.
+    @param x Returns the number.
+    @return true if there was room for the number.
+*/
+bool readU64( unsigned char const **pos, unsigned char const *end, uint64_t *x );
+
+#endif
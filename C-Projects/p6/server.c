@@ -0,0 +1,343 @@
+/**
+    @file server.c
+    @author Christopher Fields (cwfields)
+    TCP server for the map. Clients send commands in the same language
+    as the driver, one per line, and get a one-line response to each
+    (see runMapCommand). A single thread serves every client with a
+    non-blocking epoll event loop. Clients may pipeline, sending many
+    commands without waiting for responses; every complete line read is
+    performed, and all of their responses go back in as few writes as
+    possible. Runs until it's interrupted. With -c or -m, the map is a
+    cache holding at most that many pairs or bytes, evicting the least
+    recently used pairs to make room. Pairs set with setttl expire
+    after their time to live; the server wakes up regularly to remove
+    them even when no commands are arriving.
+
+    Usage: server [-c maxEntries] [-m maxBytes] [port]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "map.h"
+#include "command.h"
+#include "pool.h"
+
+/** Port the server listens on by default. */
+#define DEFAULT_PORT 5151
+
+/** Initial length of the map's table. */
+#define MAP_CAPACITY 100
+
+/** Most time, in milliseconds, the server waits for events before
+    removing expired pairs. */
+#define EXPIRE_MILLIS 100
+
+/** Most events handled per call to epoll_wait. */
+#define MAX_EVENTS 256
+
+/** Bytes read from a client at a time. */
+#define READ_BLOCK ( 64 * 1024 )
+
+/** A client's commands aren't performed while this much of its output
+    is waiting to be sent, so a client that doesn't read its responses
+    can't make the server buffer without limit. */
+#define OUTPUT_LIMIT ( 1 << 20 )
+
+/** Longest command line accepted. A client sending a longer one is
+    disconnected. */
+#define MAX_LINE ( 1 << 20 )
+
+/** State for one client connection. */
+typedef struct ConnStruct {
+  /** Socket for the connection. */
+  int fd;
+
+  /** Input read but not performed yet, which may end with part of a line. */
+  Buffer in;
+
+  /** Responses not sent yet. */
+  Buffer out;
+
+  /** Events the connection is registered for. */
+  unsigned int events;
+
+  /** True once the client has quit or closed its side, so the
+      connection closes when its output is sent. */
+  bool closing;
+
+  /** Neighbors in the list of open connections. */
+  struct ConnStruct *prev, *next;
+} Conn;
+
+/** Commands are acknowledged with OK, so every command gets a
+    response, and nothing is logged. */
+static CommandOptions const commandOptions = { true, NULL };
+
+/** List of open connections, so they can be closed when the server stops. */
+static Conn *conns = NULL;
+
+/** Set by the signal handler to stop the server. */
+static volatile sig_atomic_t stopping = 0;
+
+/**
+   Signal handler that asks the event loop to stop.
+   @param sig Signal received.
+ */
+static void stop( int sig )
+{
+  stopping = 1;
+}
+
+/**
+   Make a socket non-blocking.
+   @param fd Socket to change.
+ */
+static void setNonBlocking( int fd )
+{
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+}
+
+/**
+   Make the listening socket for the server.
+   @param port Port to listen on.
+   @return the socket, or -1 if it couldn't be made.
+ */
+static int makeListener( int port )
+{
+  int fd = socket( AF_INET, SOCK_STREAM, 0 );
+  if ( fd < 0 )
+    return -1;
+  int on = 1;
+  setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+
+  struct sockaddr_in addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_ANY );
+  addr.sin_port = htons( port );
+  if ( bind( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ||
+       listen( fd, SOMAXCONN ) != 0 ) {
+    close( fd );
+    return -1;
+  }
+  setNonBlocking( fd );
+  return fd;
+}
+
+/**
+   Close a connection and free its state.
+   @param c Connection to close.
+ */
+static void closeConn( Conn *c )
+{
+  if ( c->prev )
+    c->prev->next = c->next;
+  else
+    conns = c->next;
+  if ( c->next )
+    c->next->prev = c->prev;
+
+  close( c->fd );
+  freeBuffer( &c->in );
+  freeBuffer( &c->out );
+  free( c );
+}
+
+/**
+   Perform every complete command in a connection's input, stopping
+   early if its output gets too far behind.
+   @param c Connection to serve.
+   @param map Map the commands work on.
+ */
+static void runInput( Conn *c, Map *map )
+{
+  size_t start = 0;
+  while ( start < c->in.len && ! c->closing && c->out.len < OUTPUT_LIMIT ) {
+    char *line = c->in.data + start;
+    char *nl = memchr( line, '\n', c->in.len - start );
+    if ( ! nl )
+      break;
+    *nl = '\0';
+    if ( ! runMapCommand( map, line, &c->out, &commandOptions ) )
+      c->closing = true;
+    start = nl + 1 - c->in.data;
+  }
+  bufferConsume( &c->in, start );
+
+  if ( c->in.len > MAX_LINE )
+    c->closing = true;
+}
+
+/**
+   Send as much of a connection's output as the socket will take.
+   @param c Connection to send on.
+   @return false if the connection failed.
+ */
+static bool sendOutput( Conn *c )
+{
+  size_t sent = 0;
+  while ( sent < c->out.len ) {
+    ssize_t n = send( c->fd, c->out.data + sent, c->out.len - sent, MSG_NOSIGNAL );
+    if ( n < 0 ) {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        break;
+      return false;
+    }
+    sent += n;
+  }
+  bufferConsume( &c->out, sent );
+  return true;
+}
+
+/**
+   Handle activity on a client connection: read what's arrived, perform
+   the commands and send the responses.
+   @param ep The epoll instance.
+   @param c Connection with activity.
+   @param map Map the commands work on.
+   @return false if the connection should be closed.
+ */
+static bool serve( int ep, Conn *c, Map *map )
+{
+  // Read everything that's arrived, unless output is backed up.
+  while ( ! c->closing && c->out.len < OUTPUT_LIMIT ) {
+    char block[ READ_BLOCK ];
+    ssize_t n = recv( c->fd, block, sizeof( block ), 0 );
+    if ( n > 0 ) {
+      bufferAppend( &c->in, block, n );
+      runInput( c, map );
+    } else if ( n == 0 )
+      c->closing = true;
+    else if ( errno == EAGAIN || errno == EWOULDBLOCK )
+      break;
+    else
+      return false;
+  }
+
+  // Catch up on input left while output was backed up.
+  if ( ! sendOutput( c ) )
+    return false;
+  runInput( c, map );
+  if ( ! sendOutput( c ) )
+    return false;
+
+  if ( c->closing && c->out.len == 0 )
+    return false;
+
+  // Wait to write if output is left, and to read if there's room for more.
+  unsigned int events = 0;
+  if ( c->out.len )
+    events |= EPOLLOUT;
+  if ( ! c->closing && c->out.len < OUTPUT_LIMIT )
+    events |= EPOLLIN;
+  if ( events != c->events ) {
+    struct epoll_event ev = { events, { .ptr = c } };
+    epoll_ctl( ep, EPOLL_CTL_MOD, c->fd, &ev );
+    c->events = events;
+  }
+  return true;
+}
+
+/**
+   Accept every pending connection.
+   @param ep The epoll instance.
+   @param listener The listening socket.
+ */
+static void acceptAll( int ep, int listener )
+{
+  int fd;
+  while ( ( fd = accept( listener, NULL, NULL ) ) >= 0 ) {
+    setNonBlocking( fd );
+    int on = 1;
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+
+    Conn *c = (Conn *) calloc( 1, sizeof( Conn ) );
+    c->fd = fd;
+    c->events = EPOLLIN;
+    c->next = conns;
+    if ( conns )
+      conns->prev = c;
+    conns = c;
+    struct epoll_event ev = { c->events, { .ptr = c } };
+    epoll_ctl( ep, EPOLL_CTL_ADD, fd, &ev );
+  }
+}
+
+/**
+   Starting point for the program.
+   @param argc Number of command-line arguments.
+   @param argv Command-line arguments.
+   @return exit status for the program.
+ */
+int main( int argc, char *argv[] )
+{
+  MapOptions opts = { MAP_CHAINED };
+  opts.expiring = true;
+  int opt;
+  while ( ( opt = getopt( argc, argv, "c:m:" ) ) != -1 ) {
+    if ( opt == 'c' )
+      opts.maxEntries = atoi( optarg );
+    else if ( opt == 'm' )
+      opts.maxBytes = atol( optarg );
+    else
+      break;
+  }
+  int port = optind < argc ? atoi( argv[ optind ] ) : DEFAULT_PORT;
+  if ( opt != -1 || argc - optind > 1 || port <= 0 || port > 65535 ||
+       opts.maxEntries < 0 || opts.maxBytes < 0 ) {
+    fprintf( stderr, "usage: server [-c maxEntries] [-m maxBytes] [port]\n" );
+    return EXIT_FAILURE;
+  }
+
+  int listener = makeListener( port );
+  if ( listener < 0 ) {
+    perror( "Can't listen" );
+    return EXIT_FAILURE;
+  }
+
+  // Stop cleanly when interrupted.
+  struct sigaction sa;
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = stop;
+  sigaction( SIGINT, &sa, NULL );
+  sigaction( SIGTERM, &sa, NULL );
+
+  // The listener is registered with a NULL pointer, connections with their Conn.
+  int ep = epoll_create1( 0 );
+  struct epoll_event ev = { EPOLLIN, { .ptr = NULL } };
+  epoll_ctl( ep, EPOLL_CTL_ADD, listener, &ev );
+
+  Map *map = makeMapWith( MAP_CAPACITY, &opts );
+  struct epoll_event events[ MAX_EVENTS ];
+  while ( ! stopping ) {
+    int n = epoll_wait( ep, events, MAX_EVENTS, EXPIRE_MILLIS );
+    mapExpire( map );
+    for ( int i = 0; i < n; i++ ) {
+      Conn *c = events[ i ].data.ptr;
+      if ( ! c )
+        acceptAll( ep, listener );
+      else if ( ! serve( ep, c, map ) )
+        closeConn( c );
+    }
+  }
+
+  while ( conns )
+    closeConn( conns );
+  close( ep );
+  close( listener );
+  freeMap( map );
+  freePool();
+  return EXIT_SUCCESS;
+}
@@ -141,6 +141,69 @@ runTest() {
   return 0
 }
 
+# Run a test of the driver program in batch mode, which should
+# produce the same output as reading commands from standard input.
+runBatchTest() {
+  TESTNO=$1
+
+  echo "Batch test $TESTNO"
+  rm -f output.txt stderr.txt
+
+  echo "   ./driver -b input-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./driver -b input-$TESTNO.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-$TESTNO.txt" "output.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  echo "Batch test $TESTNO PASS"
+  return 0
+}
+
+# Run a pair of tests of the driver program with a write-ahead log. The
+# second test should start with the map the first one left in the log,
+# even though the log ends with part of a record, as after a crash.
+runWalTest() {
+  FIRST=$1
+  SECOND=$2
+
+  echo "Log test $FIRST $SECOND"
+  rm -f output.txt stderr.txt output.wal output.wal.snap.* output.wal.tmp
+
+  echo "   ./driver -w output.wal < input-$FIRST.txt > output.txt 2> stderr.txt"
+  ./driver -w output.wal < input-$FIRST.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-$FIRST.txt" "output.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  printf 'S' >> output.wal
+  echo "   ./driver -w output.wal < input-$SECOND.txt > output.txt 2> stderr.txt"
+  ./driver -w output.wal < input-$SECOND.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus 0 "$ASTATUS" ||
+     ! checkFile "Program output" "expected-$SECOND.txt" "output.txt" ||
+     ! checkEmpty "Stderr output" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  echo "Log test $FIRST $SECOND PASS"
+  return 0
+}
+
 # make a fresh copy of the target program
 make clean
 make
@@ -162,6 +225,16 @@ if [ -x driver ]; then
     runTest 10
     runTest 11
     runTest 12
+    runTest 13
+    runTest 14
+    runTest 17
+    runTest 18
+    runBatchTest 01
+    runBatchTest 06
+    runBatchTest 10
+    runBatchTest 12
+    runWalTest 15 16
+    runWalTest 19 20
 else
     fail "Your driver program didn't compile, so it couldn't be tested."
 fi
@@ -7,17 +7,34 @@
 */
 
 #include "text.h"
+#include "pool.h"
+#include "intern.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+/**
+   Helper function to find the characters of a Text, which are either
+   inside the object, in a separate block for a long string, or in the
+   intern table.
+
+   @param this the Text to get the characters of
+   @return pointer to the null-terminated characters
+ */
+static char *chars( Text const *this )
+{
+  if ( this->interned || this->len > TEXT_INLINE )
+    return this->val.ptr;
+  return (char *) this->val.buf;
+}
+
 // print method for Text.
 static void print( VType const *v )
 {
   // Convert the VType pointer to a more specific type.
   Text const *this = (Text const *) v;
-  printf( "\"%s\"", this->val );
+  printf( "\"%s\"", chars( this ) );
 }
 
 // equals method for Text.
@@ -32,7 +49,15 @@ static bool equals( VType const *a, VType const *b )
   Text const *this = (Text const *) a;
   Text const *that = (Text const *) b;
 
-  return strcmp(this->val, that->val) == 0;
+  // Strings of different lengths can't be equal.
+  if (this->len != that->len)
+    return false;
+
+  // There's only one interned Text for each string.
+  if (this->interned && that->interned)
+    return this == that;
+
+  return memcmp(chars(this), chars(that), this->len) == 0;
 }
 
 // hash method for Text.  It hashes to the string it contains,
@@ -42,14 +67,15 @@ static unsigned int hash( VType const *v )
   // Convert the VType pointer to a more specific type.
   Text const *this = (Text const *) v;
 
-  // Get the length of the string contained in the Text object.
-  int length = strlen(this->val);
+  // Get the string contained in the Text object and its length.
+  char const *str = chars(this);
+  int length = this->len;
 
   // Hash using Jenkins 32-bit hash function
-  size_t i = 0;
+  int i = 0;
   unsigned int hash = 0;
   while (i != length) {
-    hash += this->val[i++];
+    hash += str[i++];
     hash += hash << 10;
     hash ^= hash >> 6;
   }
@@ -65,81 +91,198 @@ static void destroy( VType *v )
   // Convert the VType pointer to a more specific type.
   Text *this = (Text *) v;
 
-  // Free dynamically allocated string within Text.
-  free(this->val);
+  // An interned Text is shared, so just release this reference to it.
+  // The intern table frees it along with its string.
+  if (this->interned) {
+    releaseString(this->val.ptr);
+    return;
+  }
+
+  // Free the pooled string within Text if it's too long to be inline.
+  if (this->len > TEXT_INLINE)
+    poolFree(this->val.ptr, this->len + 1);
 
   // Free entire Text object.
-  free(this);
+  poolFree(this, sizeof(Text));
 }
 
-VType *parseText( char const *init, int *n )
+/**
+   Helper function to decode the quoted string in init, replacing
+   escape sequences with the characters they stand for. Characters
+   before the opening quote are skipped. Called once to measure the
+   string and again to copy it, so the string can be allocated at
+   exactly the right size.
+
+   @param init string containing the quoted text
+   @param dest where to copy the decoded characters, or NULL to just count them
+   @param end returns the number of characters used from init, or zero
+   if there's no closing quote
+   @return number of decoded characters, or -1 if there's no opening quote
+ */
+static int decode(char const *init, char *dest, int *end)
 {
-  // Make sure the string is in the right format.
-  char *str = malloc(strlen(init));
   bool quote = false;
   int idx = 0;
-  int len = 0;
+  *end = 0;
   // Iterate through each character in initialization string.
   for (int i = 0; init[i]; i++) {
     if (init[i] == '"') {
       if (quote) { // Second quotation mark reached
-        len = i + 1;
-        str[idx] = '\0';
+        *end = i + 1;
         break;
       } else { // First quotation mark reached
         quote = true;
       }
-    } else {
-      if (quote) { // If the quote was found, read into str
-        if (init[i] == '\\') {
-          if (init[i + 1] == '"') { // Quotation escape sequence
-            str[idx] = '"';
-            i++;
-            idx++;
-            continue;
-          } else if (init[i + 1] == 'n') { // Newline escape sequence
-            str[idx] = '\n';
-            i++;
-            idx++;
-            continue;
-          } else if (init[i + 1] == 't') { // Horizontal tab escape sequence
-            str[idx] = '\t';
-            i++;
-            idx++;
-            continue;
-          } else if (init[i + 1] == '\\') { // Backslash escape sequence
-            str[idx] = '\\';
-            i++;
-            idx++;
-            continue;
-          }
+    } else if (quote) { // If the quote was found, read into dest
+      char c = init[i];
+      if (c == '\\') {
+        if (init[i + 1] == '"') { // Quotation escape sequence
+          c = '"';
+          i++;
+        } else if (init[i + 1] == 'n') { // Newline escape sequence
+          c = '\n';
+          i++;
+        } else if (init[i + 1] == 't') { // Horizontal tab escape sequence
+          c = '\t';
+          i++;
+        } else if (init[i + 1] == '\\') { // Backslash escape sequence
+          c = '\\';
+          i++;
         }
-        str[idx] = init[i];
-        idx++;
       }
+      if (dest)
+        dest[idx] = c;
+      idx++;
     }
   }
 
-  if (!quote) {
-    free(str);
+  return quote ? idx : -1;
+}
+
+VType *parseText( char const *init, int *n )
+{
+  // Make sure the string is in the right format, and measure it.
+  int len;
+  int size = decode(init, NULL, &len);
+  if (size < 0) {
     return NULL;
   }
 
-  // Reallocate str to take up exact space
-  str = realloc(str, strlen(str) + 1);
-
   // Fill in the end pointer, if the caller asked for it.
   if ( n )
     *n = len;
-  
-  // Allocate a Text object on the heap and fill in its fields.
-  Text *this = (Text *) malloc( sizeof( Text ) );
-  this->val = str;
+
+  // Make a Text object of exactly the right size and decode into it.
+  VType *v = makeText( NULL, size );
+  Text *this = (Text *) v;
+  decode( init, chars( this ), &len );
+  return v;
+}
+
+VType *parseInternedText( char const *init, int *n )
+{
+  int len;
+  int size = decode(init, NULL, &len);
+  if (size < 0) {
+    return NULL;
+  }
+
+  if ( n )
+    *n = len;
+
+  // A short string is cheaper to copy into its Text than to share.
+  if ( size <= TEXT_INLINE )
+    return parseText( init, NULL );
+
+  // Decode into temporary storage, which the intern table copies from.
+  char *buf = malloc( size );
+  decode( init, buf, &len );
+  VType *v = internText( buf, size );
+  free( buf );
+  return v;
+}
+
+/**
+   Helper function to fill in the methods of a new Text.
+
+   @param this the Text to fill in
+   @return the Text, as a pointer to the superclass
+ */
+static VType *initMethods( Text *this )
+{
   this->print = print;
   this->equals = equals;
   this->hash = hash;
   this->destroy = destroy;
+  return (VType *) this;
+}
+
+/**
+   Helper function to make the Text shared by every interned Text with
+   the same string, for internShared.
+
+   @param str the interned string
+   @param len length of the string
+   @return the new Text
+ */
+static void *makeShared( char const *str, int len )
+{
+  Text *this = (Text *) poolAlloc( sizeof( Text ) );
+  this->len = len;
+  this->interned = true;
+  this->val.ptr = (char *) str;
+  return initMethods( this );
+}
+
+/**
+   Helper function to free a shared Text once its string is released,
+   for internShared.
+
+   @param obj the Text to free
+ */
+static void dropShared( void *obj )
+{
+  poolFree( obj, sizeof( Text ) );
+}
+
+VType *internText( char const *str, int len )
+{
+  if ( len <= TEXT_INLINE )
+    return makeText( str, len );
+  return (VType *) internShared( str, len, makeShared, dropShared );
+}
+
+VType *makeText( char const *str, int len )
+{
+  // Allocate a Text object from the value pool and fill in its fields.
+  Text *this = (Text *) poolAlloc( sizeof( Text ) );
+  this->len = len;
+  this->interned = false;
+
+  // Long strings go in pooled memory of exactly the right size.
+  if ( len > TEXT_INLINE )
+    this->val.ptr = poolAlloc( len + 1 );
+
+  char *copy = chars( this );
+  if ( str )
+    memcpy( copy, str, len );
+  copy[ len ] = '\0';
 
   // Return it as a pointer to the superclass.
-  return (VType *) this;
+  return initMethods( this );
+}
+
+bool isText( VType const *v )
+{
+  return v->print == print;
+}
+
+char const *textValue( VType const *v )
+{
+  return chars( (Text const *) v );
+}
+
+int textLength( VType const *v )
+{
+  return ( (Text const *) v )->len;
 }
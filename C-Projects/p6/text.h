@@ -4,7 +4,10 @@
     Header for the Text subclass of VType. Defines
     the functions for Text, including an extra,
     parseText. Also includes a val field in the
-    Text typedefed struct.
+    Text typedefed struct, which holds short strings
+    inline to avoid a second allocation. A Text with a
+    longer string can also be interned (see intern.h),
+    so that all the equal values share one Text object.
 */
 
 #ifndef TEXT_H
@@ -12,6 +15,10 @@
 
 #include "vtype.h"
 
+/** Longest string stored inside a Text object instead of in a separate
+    block of memory. */
+#define TEXT_INLINE 22
+
 /** Subclass of VType for storing text. */
 typedef struct {
   /** Inherited from VType */
@@ -27,8 +34,24 @@ typedef struct {
   /** Inherited from VType */
   void (*destroy)( struct VTypeStruct *v );
 
-  /** Value stored by this text. */
-  char *val;
+  /** Length of the string, saved so it doesn't need to be recomputed. */
+  int len;
+
+  /** True if this is an interned Text, shared by every reference to
+      an interned Text with the same string. */
+  bool interned;
+
+  /** Value stored by this text. Short strings (up to TEXT_INLINE
+      characters) are stored right in the object, longer ones in a
+      separate block of memory, and interned ones in the intern table. */
+  union {
+    /** Pointer to a string longer than TEXT_INLINE, which for an
+        interned Text is in the intern table. */
+    char *ptr;
+
+    /** Characters of a short string, with its null terminator. */
+    char buf[ TEXT_INLINE + 1 ];
+  } val;
 } Text;
 
 /** Make an instance of Text holding a value parsed from the init string.
@@ -38,4 +61,50 @@ typedef struct {
 */
 VType *parseText( char const *init, int *n );
 
+/** Make an instance of Text holding a copy of the given characters.
+    @param str Characters for the new Text, which don't need to be
+    null terminated, or NULL to leave the characters uninitialized.
+    @param len Number of characters in str.
+    @return pointer to the new VType instance.
+*/
+VType *makeText( char const *str, int len );
+
+/** Make an instance of Text holding a value parsed from the init
+    string, like parseText, but interned as internText does.
+    @param init String containing the initializaiton value as text.
+    @param n Optional return for the number of characters used from init.
+    @return pointer to the new VType instance.
+*/
+VType *parseInternedText( char const *init, int *n );
+
+/** Get the interned Text for the given characters. A string longer than
+    TEXT_INLINE gets the one Text object shared by every interned Text
+    with that string, which is compared by pointer and counts as one
+    more reference until it's destroyed. A shorter string fits inside a
+    Text anyway, so it's just copied into a new one.
+    @param str Characters for the new Text, which don't need to be
+    null terminated.
+    @param len Number of characters in str.
+    @return pointer to the new VType instance.
+*/
+VType *internText( char const *str, int len );
+
+/** Return true if the given VType is a Text.
+    @param v VType to check.
+    @return True if v is a Text.
+*/
+bool isText( VType const *v );
+
+/** Get the string stored in a Text.
+    @param v Text to get the string from.
+    @return Null-terminated string owned by the Text.
+*/
+char const *textValue( VType const *v );
+
+/** Get the length of the string stored in a Text.
+    @param v Text to get the length of.
+    @return Number of characters in the Text's string.
+*/
+int textLength( VType const *v );
+
 #endif
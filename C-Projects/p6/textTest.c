@@ -7,6 +7,7 @@
 
 #include "vtype.h"
 #include "text.h"
+#include "intern.h"
 
 int main()
 {
@@ -56,6 +57,49 @@ int main()
   assert( t6->hash( t6 ) == 0x519E91F5 );
 
   
+  // Strings on either side of the inline storage limit.
+  VType *t7 = parseText( "\"0123456789abcdefghijkl\"", &n );
+  assert( n == 24 );
+  VType *t8 = parseText( "\"0123456789abcdefghijklm\"", &n );
+  assert( n == 25 );
+  assert( strcmp( textValue( t7 ), "0123456789abcdefghijkl" ) == 0 );
+  assert( strcmp( textValue( t8 ), "0123456789abcdefghijklm" ) == 0 );
+  assert( ! t7->equals( t7, t8 ) );
+  VType *t9 = makeText( "0123456789abcdefghijklm", 23 );
+  assert( t8->equals( t8, t9 ) );
+  assert( t8->hash( t8 ) == t9->hash( t9 ) );
+  t7->destroy( t7 );
+  t8->destroy( t8 );
+  t9->destroy( t9 );
+
+  // Interned Texts with equal strings are one shared object, but short
+  // strings aren't interned.
+  VType *i1 = parseInternedText( "\"0123456789abcdefghijklmnop\"", &n );
+  assert( n == 28 );
+  VType *i2 = internText( "0123456789abcdefghijklmnop", 26 );
+  VType *i3 = parseInternedText( " \"abc\" ", &n );
+  assert( n == 6 );
+  VType *i4 = internText( "abc", 3 );
+  assert( i1 == i2 );
+  assert( i3 != i4 && i3->equals( i3, i4 ) );
+  assert( internedCount() == 1 );
+
+  // They compare and hash the same as ordinary Texts.
+  assert( i1->equals( i1, i2 ) );
+  assert( ! i1->equals( i1, i3 ) );
+  assert( i3->equals( i3, t1 ) && t1->equals( t1, i3 ) );
+  assert( i3->hash( i3 ) == 0xED131F5B );
+  assert( strcmp( textValue( i1 ), "0123456789abcdefghijklmnop" ) == 0 );
+
+  // The shared Text lasts until each reference to it is destroyed.
+  i1->destroy( i1 );
+  assert( internedCount() == 1 );
+  assert( strcmp( textValue( i2 ), "0123456789abcdefghijklmnop" ) == 0 );
+  i2->destroy( i2 );
+  i3->destroy( i3 );
+  i4->destroy( i4 );
+  assert( internedCount() == 0 );
+
   // Get all the Text objects to print themselves (we can't test this
   // with assert)
   t1->print( t1 );
@@ -0,0 +1,52 @@
+/**
+    @file value.c
+    @author Christopher Fields (cwfields)
+    Implementation of the value component. The operations a map calls
+    on every probe are inline in value.h; the rest are here.
+*/
+
+#include "value.h"
+#include "integer.h"
+#include "text.h"
+#include "intern.h"
+
+#include <stdio.h>
+
+Value valueText( char const *str, int len )
+{
+  return (Value) { VALUE_TEXT, len, { .str = internString( str, len ) } };
+}
+
+Value valueFromVType( VType const *v )
+{
+  if ( isInteger( v ) )
+    return valueInteger( ( (Integer const *) v )->val );
+  return valueText( textValue( v ), textLength( v ) );
+}
+
+VType *valueToVType( Value v )
+{
+  switch ( v.tag ) {
+  case VALUE_INTEGER:
+    return makeInteger( v.as.i );
+  default:
+    return internText( v.as.str, v.len );
+  }
+}
+
+void valuePrint( Value v )
+{
+  switch ( v.tag ) {
+  case VALUE_INTEGER:
+    printf( "%d", v.as.i );
+    break;
+  default:
+    printf( "\"%s\"", v.as.str );
+  }
+}
+
+void valueDestroy( Value v )
+{
+  if ( v.tag == VALUE_TEXT )
+    releaseString( v.as.str );
+}
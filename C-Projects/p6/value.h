@@ -0,0 +1,136 @@
+/**
+    @file value.h
+    @author Christopher Fields (cwfields)
+    Header for the value component, a compact alternative to VType for
+    the Integer and Text types. A Value is a one-byte tag plus its
+    payload, passed and stored by value, with no function pointers: its
+    operations switch on the tag, and the ones a map calls on every
+    probe are inline so the compiler can specialize them. The text of a
+    Text Value is interned (see intern.h), so Texts are compared by
+    pointer and copying a Value never copies its characters. A Value
+    hashes, compares and prints exactly like the Integer or Text VType
+    with the same contents, and can be used with MAP_DEFINE_OWNED:
+
+    MAP_DEFINE_OWNED( ValueMap, Value, Value, valueHash, valueEquals,
+                      valueDestroy, valueDestroy )
+*/
+
+#ifndef VALUE_H
+#define VALUE_H
+
+#include "vtype.h"
+#include <stdbool.h>
+
+/** Tags for the kinds of Value. */
+enum {
+  /** An Integer, held in the Value itself. */
+  VALUE_INTEGER,
+
+  /** A Text, whose interned characters the Value points to. */
+  VALUE_TEXT
+};
+
+/** An Integer or a Text, in 16 bytes. */
+typedef struct {
+  /** Which kind of value this is, VALUE_INTEGER or VALUE_TEXT. */
+  unsigned char tag;
+
+  /** Number of characters in a Text. */
+  int len;
+
+  union {
+    /** Value of an Integer. */
+    int i;
+
+    /** Interned, null-terminated characters of a Text. */
+    char const *str;
+  } as;
+} Value;
+
+/** Make an Integer Value.
+    @param i Value of the Integer.
+    @return the new Value.
+*/
+static inline Value valueInteger( int i )
+{
+  return (Value) { VALUE_INTEGER, 0, { .i = i } };
+}
+
+/** Make a Text Value holding the interned copy of the given characters.
+    It must be freed with valueDestroy. Copies made by assignment share
+    its reference to the string, so only one of them is freed.
+    @param str Characters for the Text, which don't need to be null
+    terminated.
+    @param len Number of characters in str.
+    @return the new Value.
+*/
+Value valueText( char const *str, int len );
+
+/** Make a Value with the same contents as an Integer or Text VType.
+    A Text must be freed with valueDestroy.
+    @param v VType to copy, which must be an Integer or a Text.
+    @return the new Value.
+*/
+Value valueFromVType( VType const *v );
+
+/** Make an Integer or Text VType with the same contents as a Value.
+    @param v Value to copy.
+    @return the new VType, which the caller must destroy.
+*/
+VType *valueToVType( Value v );
+
+/** Hash a Value, giving the same hash as its Integer or Text VType.
+    @param v Value to hash.
+    @return hash of the value.
+*/
+static inline unsigned int valueHash( Value v )
+{
+  switch ( v.tag ) {
+  case VALUE_INTEGER:
+    return v.as.i;
+  default: {
+    // The Jenkins hash, as Text uses.
+    unsigned int hash = 0;
+    for ( int i = 0; i < v.len; i++ ) {
+      hash += v.as.str[ i ];
+      hash += hash << 10;
+      hash ^= hash >> 6;
+    }
+    hash += hash << 3;
+    hash ^= hash >> 11;
+    hash += hash << 15;
+    return hash;
+  }
+  }
+}
+
+/** Return true if two Values are equal. There's only one interned copy
+    of each string, so Texts are compared by pointer.
+    @param a Left-hand value.
+    @param b Right-hand value.
+    @return True if the values are equal.
+*/
+static inline bool valueEquals( Value a, Value b )
+{
+  if ( a.tag != b.tag )
+    return false;
+  switch ( a.tag ) {
+  case VALUE_INTEGER:
+    return a.as.i == b.as.i;
+  default:
+    return a.as.str == b.as.str;
+  }
+}
+
+/** Print a Value the way its VType would print it.
+    @param v Value to print.
+*/
+void valuePrint( Value v );
+
+/** Free the memory held by a Value. An Integer holds none, and a Text
+    releases its interned string.
+    @param v Value to free.
+*/
+void valueDestroy( Value v );
+
+#endif
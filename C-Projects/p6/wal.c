@@ -0,0 +1,493 @@
+/**
+    @file wal.c
+    @author Christopher Fields (cwfields)
+    Implementation of the write-ahead log. The log starts with a magic
+    number and the generation of the snapshot it follows, then has one
+    record for each operation: a tag byte, then
+    the key (and for a set, the value) in the binary form used by the
+    serial component. A set with a time to live also records the
+    wall-clock time the pair expires, so the time left can be worked out
+    again when the log is replayed. Records are buffered, and a background thread
+    forces them to disk once they've waited long enough, so a burst of
+    commands shares a single fdatasync. Compacting starts a new
+    generation: a snapshot named for it, then an empty log naming it,
+    renamed over the old log.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "wal.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "serial.h"
+
+/** Bytes at the start of every log file. */
+#define WAL_MAGIC "P6WAL\0\0\2"
+
+/** Number of bytes in WAL_MAGIC. */
+#define MAGIC_LEN 8
+
+/** Number of bytes in the magic number and the generation. */
+#define HEADER_LEN ( MAGIC_LEN + 8 )
+
+/** Size of the buffer records are collected in before they're written. */
+#define WAL_BUFFER ( 1 << 16 )
+
+/** Tag for a set record. */
+#define SET_RECORD 'S'
+
+/** Tag for a remove record. */
+#define REMOVE_RECORD 'R'
+
+/** Tag for a set record with a time to live. */
+#define TTL_RECORD 'T'
+
+/** Suffix added to the log's name, followed by the generation, to name
+    a snapshot. */
+#define SNAP_SUFFIX ".snap."
+
+/** Suffix added to the log's name to name a new log being started. */
+#define TMP_SUFFIX ".tmp"
+
+/** Representation of a write-ahead log. */
+struct WalStruct {
+  /** Log file, opened for appending. */
+  FILE *fp;
+
+  /** Name of the log file. */
+  char *name;
+
+  /** Generation of the snapshot the log's records follow, or zero if
+      the log has never been compacted. */
+  uint64_t generation;
+
+  /** Number of records to write before forcing them to disk. */
+  int groupCount;
+
+  /** Most time a record waits before it's forced to disk, or zero. */
+  int groupMillis;
+
+  /** Number of records written but not yet forced to disk. */
+  int pending;
+
+  /** False once anything couldn't be written. */
+  bool ok;
+
+  /** Lock held while writing records or syncing. */
+  pthread_mutex_t lock;
+
+  /** Signalled when the first record of a group is written, or to
+      stop the flusher thread. */
+  pthread_cond_t wake;
+
+  /** Thread that forces records to disk once they've waited too long. */
+  pthread_t flusher;
+
+  /** True once the log is closing, which stops the flusher thread. */
+  bool closing;
+};
+
+/**
+   Helper method to force the records written so far to disk. The
+   caller must hold the lock.
+
+   @param w the log to sync
+   @return true if every record so far is on disk
+ */
+static bool syncLocked(Wal *w)
+{
+  if (w->pending > 0) {
+    w->ok = fflush(w->fp) == 0 && fdatasync(fileno(w->fp)) == 0 && w->ok;
+    w->pending = 0;
+  }
+  return w->ok;
+}
+
+/**
+   Thread function that forces pending records to disk no more than
+   groupMillis milliseconds after the first of them is written, until
+   the log is closed. While nothing is pending, it sleeps until a
+   record is written.
+
+   @param arg the log to flush
+   @return NULL
+ */
+static void *flushLoop(void *arg)
+{
+  Wal *w = arg;
+  pthread_mutex_lock(&w->lock);
+  while (!w->closing) {
+    if (w->pending == 0) {
+      pthread_cond_wait(&w->wake, &w->lock);
+      continue;
+    }
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += (long) w->groupMillis * 1000000;
+    until.tv_sec += until.tv_nsec / 1000000000;
+    until.tv_nsec %= 1000000000;
+    pthread_cond_timedwait(&w->wake, &w->lock, &until);
+    syncLocked(w);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/**
+   Helper method to force the directory holding a file to disk, so a
+   rename into it survives a crash.
+
+   @param fname name of the file whose directory to sync
+   @return true if the directory was synced
+ */
+static bool syncDir(char const *fname)
+{
+  char const *slash = strrchr(fname, '/');
+  char *dir = slash ? strndup(fname, slash - fname + 1) : strdup(".");
+  int fd = open(dir, O_RDONLY);
+  free(dir);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = fsync(fd) == 0 || errno == EINVAL;
+  close(fd);
+  return ok;
+}
+
+/**
+   Helper method to make the name of the snapshot for a generation.
+
+   @param name name of the log
+   @param gen generation of the snapshot
+   @return the snapshot's name, which the caller must free
+ */
+static char *snapName(char const *name, uint64_t gen)
+{
+  size_t len = strlen(name) + sizeof(SNAP_SUFFIX) + 20;
+  char *snap = malloc(len);
+  snprintf(snap, len, "%s" SNAP_SUFFIX "%" PRIu64, name, gen);
+  return snap;
+}
+
+/**
+   Helper method to remove the snapshot for a generation, if it's there.
+
+   @param name name of the log
+   @param gen generation of the snapshot
+ */
+static void removeSnap(char const *name, uint64_t gen)
+{
+  char *snap = snapName(name, gen);
+  remove(snap);
+  free(snap);
+}
+
+/**
+   Helper method to write the header that starts a log, and force it
+   to disk.
+
+   @param fp the empty log file
+   @param gen generation of the snapshot the log follows
+   @return true if the header was written
+ */
+static bool writeHeader(FILE *fp, uint64_t gen)
+{
+  return fwrite(WAL_MAGIC, 1, MAGIC_LEN, fp) == MAGIC_LEN && writeU64(fp, gen) &&
+    fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+/**
+   Helper method to get the wall-clock time, which unlike the map's own
+   clock means the same thing after a restart.
+
+   @return milliseconds since the epoch
+ */
+static long wallMillis(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/**
+   Helper method to apply the records in a log to a map, stopping at
+   the first one that's incomplete.
+
+   @param m the map to apply the records to
+   @param pos start of the records
+   @param end end of the log
+   @return pointer just past the last complete record
+ */
+static unsigned char const *replay(Map *m, unsigned char const *pos, unsigned char const *end)
+{
+  while (pos < end) {
+    unsigned char const *rec = pos++;
+    VType *key = readVType(&pos, end);
+    if (!key) {
+      return rec;
+    }
+
+    if (*rec == SET_RECORD || *rec == TTL_RECORD) {
+      VType *val = readVType(&pos, end);
+      uint64_t deadline = 0;
+      if (!val || (*rec == TTL_RECORD && !readU64(&pos, end, &deadline))) {
+        if (val) {
+          val->destroy(val);
+        }
+        key->destroy(key);
+        return rec;
+      }
+
+      // A pair whose time ran out while the log wasn't open is given a
+      // time to live that's already over, so it's expired right away.
+      if (*rec == TTL_RECORD) {
+        mapSetTTL(m, key, val, (long) deadline - wallMillis());
+      } else {
+        mapSet(m, key, val);
+      }
+    } else if (*rec == REMOVE_RECORD) {
+      mapRemove(m, key);
+      key->destroy(key);
+    } else { // Not a record, so the rest can't be trusted
+      key->destroy(key);
+      return rec;
+    }
+  }
+  return pos;
+}
+
+/**
+   Helper method to recover the map a log records: the snapshot its
+   header names, if any, followed by its records. Anything after the
+   last complete record is cut off.
+
+   @param w the log, with its file open
+   @param m the map to recover into, which is replaced if there's a snapshot
+   @param opts options for a map loaded from the snapshot
+   @return true if the file is a log and could be read
+ */
+static bool recover(Wal *w, Map **m, MapOptions const *opts)
+{
+  int fd = fileno(w->fp);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+
+  // A new log, or one that crashed before its header was written.
+  // Compacting renames a complete log into place, so only the first
+  // log can be cut short like this.
+  w->generation = 0;
+  if (st.st_size < HEADER_LEN) {
+    return ftruncate(fd, 0) == 0 && writeHeader(w->fp, 0);
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+  bool ok = false;
+  unsigned char const *start = data;
+  unsigned char const *pos = start + MAGIC_LEN;
+  unsigned char const *end = start + st.st_size;
+  if (memcmp(start, WAL_MAGIC, MAGIC_LEN) == 0 && readU64(&pos, end, &w->generation)) {
+    // Start from the snapshot the log follows. One that's missing or
+    // can't be loaded is an error, not an empty map.
+    ok = true;
+    if (w->generation > 0) {
+      char *snap = snapName(w->name, w->generation);
+      Map *loaded = mapLoad(snap, opts);
+      free(snap);
+      if (loaded) {
+        freeMap(*m);
+        *m = loaded;
+      } else {
+        ok = false;
+      }
+    }
+
+    if (ok) {
+      unsigned char const *valid = replay(*m, pos, end);
+      ok = valid == end || ftruncate(fd, valid - start) == 0;
+    }
+
+    // A crash while compacting can leave behind the snapshot before
+    // this one or the one after it, and neither is needed.
+    if (ok && w->generation > 0) {
+      removeSnap(w->name, w->generation - 1);
+    }
+    if (ok) {
+      removeSnap(w->name, w->generation + 1);
+    }
+  }
+
+  munmap(data, st.st_size);
+  return ok;
+}
+
+Wal *walOpen( char const *fname, Map **m, MapOptions const *opts,
+              int groupCount, int groupMillis )
+{
+  Wal *w = (Wal *) malloc( sizeof( Wal ) );
+  w->name = strdup( fname );
+
+  int fd = open( fname, O_RDWR | O_CREAT, 0644 );
+  w->fp = fd >= 0 ? fdopen( fd, "a" ) : NULL;
+  if ( w->fp )
+    setvbuf( w->fp, NULL, _IOFBF, WAL_BUFFER );
+  if ( ! w->fp || ! recover( w, m, opts ) ) {
+    if ( w->fp )
+      fclose( w->fp );
+    else if ( fd >= 0 )
+      close( fd );
+    free( w->name );
+    free( w );
+    return NULL;
+  }
+
+  w->groupCount = groupCount > 0 ? groupCount : 1;
+  w->groupMillis = groupMillis;
+  w->pending = 0;
+  w->ok = true;
+  w->closing = false;
+  pthread_mutex_init( &w->lock, NULL );
+  pthread_cond_init( &w->wake, NULL );
+  // Without a flusher, nothing bounds how long a partial group waits, so
+  // fall back to forcing every record to disk as it's written.
+  if ( w->groupMillis > 0 &&
+       pthread_create( &w->flusher, NULL, flushLoop, w ) != 0 ) {
+    w->groupMillis = 0;
+    w->groupCount = 1;
+  }
+  return w;
+}
+
+/**
+   Helper method to append a record to the log, forcing it to disk
+   along with the others in its group once the group is full.
+
+   @param w the log to append to
+   @param tag the record's tag
+   @param key the key in the record
+   @param val the value in the record, or NULL for a remove
+   @param deadline wall-clock time the pair expires, for a TTL record
+   @return true if the record was written successfully
+ */
+static bool append(Wal *w, int tag, VType const *key, VType const *val, long deadline)
+{
+  pthread_mutex_lock(&w->lock);
+  w->ok = putc(tag, w->fp) != EOF && writeVType(w->fp, key) &&
+    (!val || writeVType(w->fp, val)) &&
+    (tag != TTL_RECORD || writeU64(w->fp, (uint64_t) deadline)) && w->ok;
+  bool ok = w->ok;
+  if (++w->pending >= w->groupCount) {
+    ok = syncLocked(w);
+  } else if (w->pending == 1 && w->groupMillis > 0) {
+    pthread_cond_signal(&w->wake); // Start the clock on this group
+  }
+  pthread_mutex_unlock(&w->lock);
+  return ok;
+}
+
+bool walSet( Wal *w, VType const *key, VType const *val )
+{
+  return append( w, SET_RECORD, key, val, 0 );
+}
+
+bool walSetTTL( Wal *w, VType const *key, VType const *val, long millis )
+{
+  long now = wallMillis();
+  long deadline = millis > LONG_MAX - now ? LONG_MAX : now + millis;
+  return append( w, TTL_RECORD, key, val, deadline );
+}
+
+bool walRemove( Wal *w, VType const *key )
+{
+  return append( w, REMOVE_RECORD, key, NULL, 0 );
+}
+
+bool walSync( Wal *w )
+{
+  pthread_mutex_lock( &w->lock );
+  bool ok = syncLocked( w );
+  pthread_mutex_unlock( &w->lock );
+  return ok;
+}
+
+bool walCompact( Wal *w, Map *m )
+{
+  pthread_mutex_lock( &w->lock );
+
+  // Save a snapshot for the next generation, then start a new, empty log
+  // naming it. Renaming that log over the old one is what switches
+  // generations: a crash before it recovers the old snapshot and log,
+  // and a crash after it recovers the new snapshot alone, so records
+  // from before the snapshot are never replayed over it.
+  uint64_t next = w->generation + 1;
+  char *snap = snapName( w->name, next );
+  char *tmp = malloc( strlen( w->name ) + sizeof( TMP_SUFFIX ) );
+  strcpy( tmp, w->name );
+  strcat( tmp, TMP_SUFFIX );
+
+  FILE *fp = NULL;
+  bool ok = syncLocked( w ) && mapSave( m, snap ) && syncDir( snap ) &&
+    ( fp = fopen( tmp, "w" ) ) && setvbuf( fp, NULL, _IOFBF, WAL_BUFFER ) == 0 &&
+    writeHeader( fp, next ) && rename( tmp, w->name ) == 0;
+  if ( ok ) {
+    fclose( w->fp );
+    w->fp = fp;
+    w->generation = next;
+
+    // Until the rename is on disk, a crash could still bring back the
+    // old generation, which no longer matches the map, so nothing more
+    // is logged. Once it is, the old snapshot isn't needed.
+    ok = syncDir( w->name );
+    if ( ok )
+      removeSnap( w->name, next - 1 );
+    else
+      w->ok = false;
+  } else {
+    if ( fp )
+      fclose( fp );
+    remove( tmp );
+    remove( snap );
+  }
+
+  free( tmp );
+  free( snap );
+  pthread_mutex_unlock( &w->lock );
+  return ok;
+}
+
+bool walClose( Wal *w )
+{
+  if ( w->groupMillis > 0 ) {
+    pthread_mutex_lock( &w->lock );
+    w->closing = true;
+    pthread_cond_signal( &w->wake );
+    pthread_mutex_unlock( &w->lock );
+    pthread_join( w->flusher, NULL );
+  }
+
+  bool ok = syncLocked( w );
+  ok = fclose( w->fp ) == 0 && ok;
+  pthread_mutex_destroy( &w->lock );
+  pthread_cond_destroy( &w->wake );
+  free( w->name );
+  free( w );
+  return ok;
+}
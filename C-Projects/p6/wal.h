@@ -0,0 +1,100 @@
+/**
+    @file wal.h
+    @author Christopher Fields (cwfields)
+    Header for the write-ahead log component, which makes a map durable.
+    Every set and remove is appended to a log file before the map is
+    changed, so the map can be rebuilt after a crash by loading the
+    last snapshot and replaying the operations logged since. The log is
+    forced to disk in groups, after a number of records or a short time,
+    whichever comes first, so each command doesn't wait for a flush.
+    The cost is a bounded window of loss: a record is acknowledged once
+    it's written, not once it's on disk, so a crash can lose the last
+    group: up to groupCount - 1 records, all written in the last
+    groupMillis milliseconds if groupMillis isn't zero. Opening the log
+    with a groupCount of 1 closes the window.
+*/
+
+#ifndef WAL_H
+#define WAL_H
+
+#include "vtype.h"
+#include "map.h"
+#include <stdbool.h>
+
+/** Incomplete type for the write-ahead log representation. */
+typedef struct WalStruct Wal;
+
+/** Open a log, creating it if it doesn't exist, and recover the map it
+    records: the snapshot written by the last walCompact (in a file
+    named fname with ".snap." and its generation number added), if there
+    is one, followed by every operation in the log. A record cut short
+    by a crash is dropped.
+    @param fname Name of the log file.
+    @param m On entry, an empty map to recover into if there's no
+    snapshot. Returns the recovered map, which replaces the given one
+    if a snapshot was loaded.
+    @param opts Options for a map loaded from the snapshot.
+    @param groupCount Number of records to write before forcing them to
+    disk, or 1 to force every record to disk before it's acknowledged.
+    @param groupMillis Most time, in milliseconds, a record waits before
+    it's forced to disk, or 0 to only force records by count. If the
+    thread that enforces this can't be started, every record is forced
+    to disk before it's acknowledged instead.
+    @return pointer to the open log, or NULL if it couldn't be opened
+    or isn't a log file.
+*/
+Wal *walOpen( char const *fname, Map **m, MapOptions const *opts,
+              int groupCount, int groupMillis );
+
+/** Append a set operation to the log.
+    @param w Log to append to.
+    @param key Key being set.
+    @param val Value it's set to.
+    @return true if the record was written successfully.
+*/
+bool walSet( Wal *w, VType const *key, VType const *val );
+
+/** Append a set operation with a time to live to the log. The log
+    records when the pair expires by the wall clock, so a pair replayed
+    after a restart only lives for whatever time it had left.
+    @param w Log to append to.
+    @param key Key being set.
+    @param val Value it's set to.
+    @param millis Milliseconds until the pair expires.
+    @return true if the record was written successfully.
+*/
+bool walSetTTL( Wal *w, VType const *key, VType const *val, long millis );
+
+/** Append a remove operation to the log.
+    @param w Log to append to.
+    @param key Key being removed.
+    @return true if the record was written successfully.
+*/
+bool walRemove( Wal *w, VType const *key );
+
+/** Force every record written so far to disk.
+    @param w Log to sync.
+    @return true if every record so far is on disk.
+*/
+bool walSync( Wal *w );
+
+/** Save the map as the log's snapshot and empty the log, so recovery
+    only has to load the snapshot. This also works for replacing the
+    whole map, as the map doesn't have to be the one the log records.
+    The new snapshot and the empty log take over together, so after a
+    crash the map recovered is either the old one or the new one.
+    @param w Log to compact.
+    @param m Map the log should record from now on.
+    @return true if the snapshot was saved and the log emptied. If
+    not, the log still records the old map, unless it may not have
+    made it to disk, in which case every later record fails.
+*/
+bool walCompact( Wal *w, Map *m );
+
+/** Force the log to disk and close it.
+    @param w The log to close.
+    @return true if every record was forced to disk successfully.
+*/
+bool walClose( Wal *w );
+
+#endif
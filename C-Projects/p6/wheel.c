@@ -0,0 +1,187 @@
+/**
+    @file wheel.c
+    @author Christopher Fields (cwfields)
+    Implementation of the timer wheel. The wheel has LEVELS levels of
+    SLOTS slots each. A slot at level 0 covers one tick, and a slot at
+    each level above covers SLOTS times as many ticks as one below it.
+    A timer goes in the lowest level whose slots reach far enough ahead.
+    As the wheel's clock enters a new block of ticks, the timers in the
+    upper-level slot for that block are moved down (cascaded), so every
+    timer reaches level 0 by the time it's due. A bit mask for each
+    level marks the slots that might be in use, so runs of empty slots
+    are skipped without looking at them.
+*/
+
+#include "wheel.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of bits of the tick used to pick a slot at each level. */
+#define LEVEL_BITS 6
+
+/** Number of slots at each level, one for each bit of a mask. */
+#define SLOTS ( 1 << LEVEL_BITS )
+
+/** Mask for the slot number at each level. */
+#define MASK ( SLOTS - 1 )
+
+/** Number of levels. */
+#define LEVELS 4
+
+/** Number of ticks the whole wheel covers. A timer due further out
+    than this waits in the top level until it's closer. */
+#define SPAN ( 1L << ( LEVEL_BITS * LEVELS ) )
+
+/** Representation of a timer wheel. */
+struct TimerWheelStruct {
+  /** Lists of timers in each slot of each level. */
+  Timer *slots[ LEVELS ][ SLOTS ];
+
+  /** For each level, a bit for each slot. Every slot holding timers has
+      its bit set; a slot that's been emptied may keep its bit until the
+      clock passes it. */
+  uint64_t used[ LEVELS ];
+
+  /** The wheel's clock. Every timer due before this tick has been
+      popped, and any due at it are in its slot at level 0. */
+  long cur;
+
+  /** Number of timers in the wheel. */
+  int count;
+};
+
+TimerWheel *makeTimerWheel( long now )
+{
+  TimerWheel *w = (TimerWheel *) calloc( 1, sizeof( TimerWheel ) );
+  w->cur = now;
+  return w;
+}
+
+/**
+   Helper function to put a timer in the slot it belongs in, given the
+   wheel's clock.
+
+   @param w the wheel to add to
+   @param t the timer to place
+ */
+static void place( TimerWheel *w, Timer *t )
+{
+  // A timer that's overdue goes in the current slot, and one that's
+  // too far out goes in the last slot the wheel reaches.
+  long when = t->expires < w->cur ? w->cur : t->expires;
+  if ( when - w->cur >= SPAN )
+    when = w->cur + SPAN - 1;
+
+  int level = 0;
+  long delta = when - w->cur;
+  while ( level < LEVELS - 1 && delta >= 1L << ( LEVEL_BITS * ( level + 1 ) ) )
+    level++;
+  int slot = ( when >> ( LEVEL_BITS * level ) ) & MASK;
+
+  Timer **head = &w->slots[ level ][ slot ];
+  t->next = *head;
+  if ( *head )
+    ( *head )->pprev = &t->next;
+  t->pprev = head;
+  *head = t;
+  w->used[ level ] |= 1ULL << slot;
+}
+
+/**
+   Helper function to unlink a timer from its slot.
+
+   @param w the wheel the timer is in
+   @param t the timer to unlink
+ */
+static void detach( TimerWheel *w, Timer *t )
+{
+  *t->pprev = t->next;
+  if ( t->next )
+    t->next->pprev = t->pprev;
+  t->pprev = NULL;
+  w->count--;
+}
+
+/**
+   Helper function to move the timers down from the upper-level slots
+   for the block of ticks the clock has just entered. The clock must be
+   at the start of a block at level 1.
+
+   @param w the wheel to cascade
+ */
+static void cascade( TimerWheel *w )
+{
+  for ( int level = 1; level < LEVELS; level++ ) {
+    int slot = ( w->cur >> ( LEVEL_BITS * level ) ) & MASK;
+    Timer *t = w->slots[ level ][ slot ];
+    w->slots[ level ][ slot ] = NULL;
+    w->used[ level ] &= ~( 1ULL << slot );
+    while ( t ) {
+      Timer *next = t->next;
+      place( w, t );
+      t = next;
+    }
+
+    // Only a new block at this level starts a new block at the next one.
+    if ( slot != 0 )
+      break;
+  }
+}
+
+void wheelAdd( TimerWheel *w, Timer *t, long expires )
+{
+  t->expires = expires;
+  place( w, t );
+  w->count++;
+}
+
+void wheelRemove( TimerWheel *w, Timer *t )
+{
+  if ( t->pprev )
+    detach( w, t );
+}
+
+Timer *wheelPop( TimerWheel *w, long now )
+{
+  // With nothing to wait for, the clock can jump straight to now.
+  if ( w->count == 0 ) {
+    if ( w->cur < now )
+      w->cur = now;
+    return NULL;
+  }
+
+  while ( w->cur <= now ) {
+    int idx = w->cur & MASK;
+    Timer *t = w->slots[ 0 ][ idx ];
+    if ( t ) {
+      detach( w, t );
+      return t;
+    }
+
+    // Skip to the next slot in use in this block, or the next block.
+    w->used[ 0 ] &= ~( 1ULL << idx );
+    uint64_t later = w->used[ 0 ] & ( ~0ULL << idx );
+    long next = later ? ( w->cur & ~(long) MASK ) + __builtin_ctzll( later )
+      : ( w->cur | MASK ) + 1;
+    if ( next > now ) {
+      // Nothing else is due. The clock stays at now, so a timer added
+      // later that's already due goes in a slot that's checked next time.
+      w->cur = now;
+      break;
+    }
+    w->cur = next;
+    if ( ( w->cur & MASK ) == 0 )
+      cascade( w );
+  }
+  return NULL;
+}
+
+int wheelCount( TimerWheel *w )
+{
+  return w->count;
+}
+
+void freeTimerWheel( TimerWheel *w )
+{
+  free( w );
+}
@@ -0,0 +1,73 @@
+/**
+    @file wheel.h
+    @author Christopher Fields (cwfields)
+    Header for the timer wheel component, a hierarchical timing wheel
+    that finds the timers that have come due without looking at any
+    that haven't. Timers are stored in the objects they time, so adding
+    and removing one never allocates memory. Time is measured in ticks,
+    which the caller can map to any unit; the map uses milliseconds.
+*/
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+/** A timer, to be embedded in whatever object it times. */
+typedef struct TimerStruct {
+  /** Tick the timer is due at. */
+  long expires;
+
+  /** Next timer in the same slot of the wheel. */
+  struct TimerStruct *next;
+
+  /** Link that points to this timer, or NULL if the timer isn't in a
+      wheel. */
+  struct TimerStruct **pprev;
+} Timer;
+
+/** Incomplete type for the timer wheel representation. */
+typedef struct TimerWheelStruct TimerWheel;
+
+/** Make an empty timer wheel.
+    @param now The current tick.
+    @return pointer to a new wheel.
+*/
+TimerWheel *makeTimerWheel( long now );
+
+/** Add a timer to the wheel. A timer already due comes due at the
+    next call to wheelPop.
+    @param w Wheel to add to.
+    @param t Timer to add, which must not be in a wheel already.
+    @param expires Tick the timer is due at.
+*/
+void wheelAdd( TimerWheel *w, Timer *t, long expires );
+
+/** Take a timer out of the wheel before it comes due. Does nothing if
+    the timer isn't in a wheel.
+    @param w Wheel the timer is in.
+    @param t Timer to remove.
+*/
+void wheelRemove( TimerWheel *w, Timer *t );
+
+/** Take one timer that's due out of the wheel. The wheel's clock moves
+    forward to now as needed, skipping empty slots a whole word of slots
+    at a time, so the work done is proportional to the timers that have
+    come due plus the number of slots passed at the upper levels.
+    @param w Wheel to check.
+    @param now The current tick.
+    @return a timer due at or before now, or NULL if there aren't any.
+*/
+Timer *wheelPop( TimerWheel *w, long now );
+
+/** Get the number of timers in the wheel.
+    @param w Wheel to check.
+    @return number of timers waiting to come due.
+*/
+int wheelCount( TimerWheel *w );
+
+/** Free the wheel. The timers in it belong to their objects, so they
+    aren't freed.
+    @param w Wheel to free.
+*/
+void freeTimerWheel( TimerWheel *w );
+
+#endif